@@ -0,0 +1,622 @@
+// Microbenchmarks of the opencv_kinect library, without Kinect
+//
+//   ./bench --benchmark_format=json --benchmark_out=bench.json
+//
+// Set BENCH_DEPTH to a 16-bit depth image (e.g. output.png written by "Save Output") to also
+// run the benchmarks on recorded data. Every benchmark reports its throughput in pixels/s
+// and the number of heap allocations per iteration.
+//
+// kernels/* compare the kernels specialised for the Kinect frame sizes with the generic ones,
+// and the colorization through the palette tables with the palette evaluated per pixel.
+// BM_palette_compile times a palette swap (compiling its tables for a range).
+// `./bench --check_palette [palette.yml]` checks that both colorizations agree on every raw
+// depth and dithering phase, for every calibrated range (and the default palette against the
+// former ladder).
+// hole_filling/* fill the invalid pixels (1% of the synthetic frames) by push-pull, alone or
+// after the last valid reading of each pixel.
+// smoothing/r* smooth the filled frames for several radii on one core (cv::setNumThreads(1)),
+// smoothing/r4_holes the frames with their holes (weighted path).
+// water/step advances the water simulation on the grid of the frames (half their size) with
+// rain, on all the cores; water/composite blends the water over a rendered frame. With
+// BENCH_DEPTH, the water flows on the recorded terrain.
+// occlusion/filter classifies the frames of an arm moving over the sand and holds its tiles.
+// recording/* encode and decode the frames losslessly (black box), with the compression ratio.
+// demosaic/* convert a Bayer mosaic of the colorized frames at full, half and quarter
+// resolution; demosaic/half_resize is the full demosaic then a resize, for comparison.
+// frame_pipeline/* run the whole H1 -> render -> H2 chain, in sequence or on pipelined threads
+// with rings of 1, 2 or 4 frames, and report the frame latency next to the throughput.
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <iterator>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include "calibration-utils.hpp"
+#include "demosaic.hpp"
+#include "depth-filters.hpp"
+#include "depth-kernels.hpp"
+#include "occlusion.hpp"
+#include "palette.hpp"
+#include "pipelined-executor.hpp"
+#include "recording.hpp"
+#include "utils.hpp"
+
+
+// Allocation counter: interpose the glibc allocator (OpenCV does not use operator new)
+static std::atomic<uint64_t> allocation_count = {0};
+
+#if defined(__GLIBC__)
+extern "C"
+{
+    void* __libc_malloc(size_t size);
+    void* __libc_calloc(size_t n, size_t size);
+    void* __libc_realloc(void* ptr, size_t size);
+    void* __libc_memalign(size_t alignment, size_t size);
+
+    void* malloc(size_t size) noexcept
+    {
+        allocation_count.fetch_add(1, std::memory_order_relaxed);
+        return __libc_malloc(size);
+    }
+
+    void* calloc(size_t n, size_t size) noexcept
+    {
+        allocation_count.fetch_add(1, std::memory_order_relaxed);
+        return __libc_calloc(n, size);
+    }
+
+    void* realloc(void* ptr, size_t size) noexcept
+    {
+        allocation_count.fetch_add(1, std::memory_order_relaxed);
+        return __libc_realloc(ptr, size);
+    }
+
+    int posix_memalign(void** ptr, size_t alignment, size_t size) noexcept
+    {
+        allocation_count.fetch_add(1, std::memory_order_relaxed);
+        *ptr = __libc_memalign(alignment, size);
+        return (*ptr != nullptr || size == 0) ? 0 : ENOMEM;
+    }
+
+    void* aligned_alloc(size_t alignment, size_t size) noexcept
+    {
+        allocation_count.fetch_add(1, std::memory_order_relaxed);
+        return __libc_memalign(alignment, size);
+    }
+}
+#endif
+
+
+struct bench_resolution
+{
+    const char* name;
+    int width;
+    int height;
+};
+
+// CVKinectCapture::resolution
+static const bench_resolution resolutions[] = {
+    {"LOW", 320, 240},
+    {"MEDIUM", 640, 480},
+    {"HIGH", 1280, 1024},
+};
+
+// Calibrated range used for every benchmark
+constexpr static int MIN_DEPTH = 750;
+constexpr static int MAX_DEPTH = 950;
+
+
+// Sand box terrain: a few hills and valleys, with 1% of invalid (2047) pixels
+static cv::Mat synthetic_depth(int width, int height)
+{
+    cv::Mat_<uint16_t> depth(height, width);
+    cv::RNG rng(42);
+    for (int y = 0; y < height; ++y)
+    {
+        for (int x = 0; x < width; ++x)
+        {
+            float u = float(x) / width;
+            float v = float(y) / height;
+            float h = 0.5f + 0.25f * std::sin(6.28f * 2 * u) * std::cos(6.28f * 1.5f * v)
+                    + 0.2f * std::exp(-((u - 0.3f) * (u - 0.3f) + (v - 0.6f) * (v - 0.6f)) * 30.f);
+            depth(y, x) = (uint16_t)(MIN_DEPTH + h * (MAX_DEPTH - MIN_DEPTH));
+            if (rng.uniform(0, 100) == 0)
+                depth(y, x) = 2047;
+        }
+    }
+    return depth;
+}
+
+static cv::Mat recorded_depth(const cv::Mat& recording, int width, int height)
+{
+    cv::Mat depth;
+    cv::resize(recording, depth, cv::Size(width, height), 0, 0, cv::INTER_NEAREST);
+    return depth;
+}
+
+
+// Report the throughput and the allocations of the benchmark loop
+class allocation_scope
+{
+    public:
+        allocation_scope(benchmark::State& state, int pixels) : m_state(state), m_pixels(pixels)
+        {
+            m_start = allocation_count.load(std::memory_order_relaxed);
+        }
+
+        ~allocation_scope()
+        {
+            uint64_t allocations = allocation_count.load(std::memory_order_relaxed) - m_start;
+            m_state.counters["allocs/iter"] = benchmark::Counter((double)allocations, benchmark::Counter::kAvgIterations);
+            m_state.counters["pixels/s"] = benchmark::Counter((double)m_pixels * m_state.iterations(), benchmark::Counter::kIsRate);
+        }
+
+    private:
+        benchmark::State& m_state;
+        int m_pixels;
+        uint64_t m_start;
+};
+
+
+static void report_latency(benchmark::State& state, const LatencyHistogram& latency)
+{
+    auto s = latency.summarize();
+    state.counters["latency_p50_ms"] = s.p50 / 1e6;
+    state.counters["latency_p99_ms"] = s.p99 / 1e6;
+}
+
+
+static void register_benchmarks(const std::string& source, const bench_resolution& res, const cv::Mat& depth)
+{
+    std::string suffix = "/" + source + "/" + res.name;
+    int w = res.width;
+    int h = res.height;
+    int pixels = w * h;
+
+    cv::Mat_<uint16_t> depth16 = depth;
+    std::vector<uint16_t> depth_vector(depth16.begin(), depth16.end());
+    cv::Mat colored = generate_colored_depth(depth_vector, w, h, MIN_DEPTH, MAX_DEPTH);
+
+    std::vector<cv::Point2f> corners = {{w * 0.05f, h * 0.08f}, {w * 0.97f, h * 0.02f}, {w * 0.93f, h * 0.95f}, {w * 0.02f, h * 0.9f}};
+    cv::Mat H = unwrap_estimate(corners, w, h);
+
+    benchmark::RegisterBenchmark(("process_depth" + suffix).c_str(), [=](benchmark::State& state) {
+        allocation_scope scope(state, pixels);
+        for (auto _ : state)
+        {
+            uint8_t* res = process_depth(depth_vector, w, h, MAX_DEPTH, MIN_DEPTH);
+            benchmark::DoNotOptimize(res);
+            delete[] res;
+        }
+    });
+
+    benchmark::RegisterBenchmark(("generate_colored_depth" + suffix).c_str(), [=](benchmark::State& state) {
+        allocation_scope scope(state, pixels);
+        for (auto _ : state)
+            benchmark::DoNotOptimize(generate_colored_depth(depth_vector, w, h, MIN_DEPTH, MAX_DEPTH));
+    });
+
+    // Kernels specialised for the frame size against the generic instantiation
+    for (const depth_kernels* kernels : {&get_depth_kernels(w, h), &get_generic_depth_kernels()})
+    {
+        std::string variant = (kernels == &get_generic_depth_kernels()) ? "/generic" : "/specialised";
+
+        benchmark::RegisterBenchmark(("kernels/colorize" + suffix + variant).c_str(), [=](benchmark::State& state) {
+            cv::Mat output(h, w, CV_8UC3);
+            allocation_scope scope(state, pixels);
+            for (auto _ : state)
+            {
+                kernels->colorize(depth_vector.data(), output.ptr<cv::Vec3b>(), w, h, MIN_DEPTH, MAX_DEPTH);
+                benchmark::ClobberMemory();
+            }
+        });
+
+        benchmark::RegisterBenchmark(("kernels/colorize_float" + suffix + variant).c_str(), [=](benchmark::State& state) {
+            cv::Mat output(h, w, CV_8UC3);
+            allocation_scope scope(state, pixels);
+            for (auto _ : state)
+            {
+                kernels->colorize_float(depth_vector.data(), output.ptr<cv::Vec3b>(), w, h, MIN_DEPTH, MAX_DEPTH);
+                benchmark::ClobberMemory();
+            }
+        });
+
+        benchmark::RegisterBenchmark(("kernels/contour_levels" + suffix + variant).c_str(), [=](benchmark::State& state) {
+            cv::Mat output(h, w, CV_8UC1);
+            allocation_scope scope(state, pixels);
+            for (auto _ : state)
+            {
+                kernels->contour_levels(depth_vector.data(), output.ptr<uint8_t>(), w, h, TerrainRenderer::CONTOUR_STEP);
+                benchmark::ClobberMemory();
+            }
+        });
+    }
+
+    for (auto mode : {hole_filling::PUSH_PULL, hole_filling::TEMPORAL})
+    {
+        benchmark::RegisterBenchmark(("hole_filling/" + std::string(hole_filling_name(mode)) + suffix).c_str(), [=](benchmark::State& state) {
+            DepthHoleFiller filler;
+            filler.set_mode(mode);
+            cv::Mat output;
+            filler.fill(depth, output);
+            allocation_scope scope(state, pixels);
+            for (auto _ : state)
+            {
+                filler.fill(depth, output);
+                benchmark::ClobberMemory();
+            }
+        });
+    }
+
+    cv::Mat filled;
+    DepthHoleFiller().fill(depth, filled);
+    auto register_smoothing = [&](const std::string& name, float radius, const cv::Mat& input) {
+        benchmark::RegisterBenchmark(("smoothing/" + name + suffix).c_str(), [=](benchmark::State& state) {
+            DepthSmoother smoother;
+            smoother.set_parameters(radius, 10);
+            cv::Mat output;
+            smoother.smooth(input, output);
+            int threads = cv::getNumThreads();
+            cv::setNumThreads(1);
+            {
+                allocation_scope scope(state, pixels);
+                for (auto _ : state)
+                {
+                    smoother.smooth(input, output);
+                    benchmark::ClobberMemory();
+                }
+            }
+            cv::setNumThreads(threads);
+        });
+    };
+    for (int radius : {2, 4, 8, 16})
+        register_smoothing("r" + std::to_string(radius), radius, filled);
+    register_smoothing("r4_holes", 4, depth);
+
+    cv::Size water_grid(w / TerrainRenderer::WATER_GRID_SCALE, h / TerrainRenderer::WATER_GRID_SCALE);
+    benchmark::RegisterBenchmark(("water/step" + suffix).c_str(), [=](benchmark::State& state) {
+        WaterSimulation water;
+        water.set_terrain(filled, water_grid, MAX_DEPTH);
+        // Let the water gather in the hollows before measuring
+        for (int i = 0; i < 120; ++i)
+            water.step(2.f, 0.05f);
+        {
+            allocation_scope scope(state, water_grid.area());
+            for (auto _ : state)
+            {
+                water.step(2.f, 0.05f);
+                benchmark::ClobberMemory();
+            }
+        }
+        state.counters["steps/s"] = benchmark::Counter((double)state.iterations(), benchmark::Counter::kIsRate);
+    });
+    benchmark::RegisterBenchmark(("water/composite" + suffix).c_str(), [=](benchmark::State& state) {
+        WaterSimulation water;
+        water.set_terrain(filled, water_grid, MAX_DEPTH);
+        for (int i = 0; i < 120; ++i)
+            water.step(2.f, 0.05f);
+        cv::Mat img = colored.clone();
+        water.composite(img);
+        allocation_scope scope(state, pixels);
+        for (auto _ : state)
+        {
+            water.composite(img);
+            benchmark::ClobberMemory();
+        }
+    });
+
+    // An arm reaching in from the left, about 150 raw units above the sand, moving at every frame
+    cv::Mat arm[2];
+    for (int i = 0; i < 2; ++i)
+    {
+        arm[i] = filled.clone();
+        cv::rectangle(arm[i], cv::Rect(0, h * 35 / 100 + 4 * i, w * 2 / 5, h / 5), cv::Scalar(MIN_DEPTH - 150 + 10 * i), cv::FILLED);
+    }
+    benchmark::RegisterBenchmark(("occlusion/filter" + suffix).c_str(), [=](benchmark::State& state) {
+        OcclusionFilter occlusion;
+        occlusion.set_parameters(40, 6);
+        occlusion.filter(filled, MIN_DEPTH);
+        int frame = 0;
+        allocation_scope scope(state, pixels);
+        for (auto _ : state)
+        {
+            benchmark::DoNotOptimize(occlusion.filter(arm[frame++ % 2], MIN_DEPTH).data);
+            benchmark::ClobberMemory();
+        }
+        state.counters["held_tiles"] = occlusion.held_tiles();
+    });
+
+    // Lossless encoding of the black box and of the recordings
+    benchmark::RegisterBenchmark(("recording/encode" + suffix).c_str(), [=](benchmark::State& state) {
+        encoded_frame encoded = encode_frame(depth, 0);
+        allocation_scope scope(state, pixels);
+        for (auto _ : state)
+        {
+            encoded = encode_frame(depth, 0);
+            benchmark::ClobberMemory();
+        }
+        state.counters["ratio"] = double(pixels * 2) / encoded.payload.size();
+    });
+    benchmark::RegisterBenchmark(("recording/decode" + suffix).c_str(), [=](benchmark::State& state) {
+        encoded_frame encoded = encode_frame(depth, 0);
+        cv::Mat decoded;
+        decode_frame(encoded.header, encoded.payload.data(), decoded);
+        allocation_scope scope(state, pixels);
+        for (auto _ : state)
+        {
+            decode_frame(encoded.header, encoded.payload.data(), decoded);
+            benchmark::ClobberMemory();
+        }
+    });
+
+    // GRBG mosaic of the colorized frame, as sent by the Kinect in FREENECT_VIDEO_BAYER
+    cv::Mat bayer(h, w, CV_8UC1);
+    for (int y = 0; y < h; ++y)
+        for (int x = 0; x < w; ++x)
+            bayer.at<uint8_t>(y, x) = colored.at<cv::Vec3b>(y, x)[(y % 2 == 0) ? ((x % 2 == 0) ? 1 : 0) : ((x % 2 == 0) ? 2 : 1)];
+    for (auto scale : {demosaic_scale::FULL, demosaic_scale::HALF, demosaic_scale::QUARTER})
+    {
+        const char* name = (scale == demosaic_scale::FULL) ? "full" : (scale == demosaic_scale::HALF) ? "half" : "quarter";
+        benchmark::RegisterBenchmark(("demosaic/" + std::string(name) + suffix).c_str(), [=](benchmark::State& state) {
+            cv::Mat rgb;
+            demosaic(bayer, rgb, scale);
+            allocation_scope scope(state, pixels);
+            for (auto _ : state)
+            {
+                demosaic(bayer, rgb, scale);
+                benchmark::ClobberMemory();
+            }
+        });
+    }
+    benchmark::RegisterBenchmark(("demosaic/half_resize" + suffix).c_str(), [=](benchmark::State& state) {
+        cv::Mat rgb, half;
+        allocation_scope scope(state, pixels);
+        for (auto _ : state)
+        {
+            demosaic(bayer, rgb, demosaic_scale::FULL);
+            cv::resize(rgb, half, rgb.size() / 2, 0, 0, cv::INTER_AREA);
+            benchmark::ClobberMemory();
+        }
+    });
+
+    benchmark::RegisterBenchmark(("add_contour_lines" + suffix).c_str(), [=](benchmark::State& state) {
+        cv::Mat img = colored.clone();
+        allocation_scope scope(state, pixels);
+        for (auto _ : state)
+        {
+            add_contour_lines(img, depth_vector, w, h, 25);
+            benchmark::ClobberMemory();
+        }
+    });
+
+    benchmark::RegisterBenchmark(("add_shading" + suffix).c_str(), [=](benchmark::State& state) {
+        cv::Mat img = colored.clone();
+        allocation_scope scope(state, pixels);
+        for (auto _ : state)
+        {
+            add_shading(img, depth);
+            benchmark::ClobberMemory();
+        }
+    });
+
+    benchmark::RegisterBenchmark(("unwrap/depth" + suffix).c_str(), [=](benchmark::State& state) {
+        allocation_scope scope(state, pixels);
+        for (auto _ : state)
+            benchmark::DoNotOptimize(unwrap(depth, H));
+    });
+
+    benchmark::RegisterBenchmark(("unwrap/rgb" + suffix).c_str(), [=](benchmark::State& state) {
+        allocation_scope scope(state, pixels);
+        for (auto _ : state)
+            benchmark::DoNotOptimize(unwrap(colored, H));
+    });
+
+    benchmark::RegisterBenchmark(("frame_pipeline/sequential" + suffix).c_str(), [=](benchmark::State& state) {
+        TerrainRenderer renderer;
+        LatencyHistogram latency;
+        cv::Mat W, depth_rgb, out;
+        allocation_scope scope(state, pixels);
+        for (auto _ : state)
+        {
+            uint64_t start = profiling_now();
+            unwrap(depth, H, W);
+            renderer.render(W, MIN_DEPTH, MAX_DEPTH, depth_rgb);
+            unwrap(depth_rgb, H, out);
+            benchmark::DoNotOptimize(out.data);
+            latency.record(profiling_now() - start);
+        }
+        report_latency(state, latency);
+    })->UseRealTime();
+
+    // Each iteration pushes a frame: the rate is the throughput of the slowest stage
+    benchmark::RegisterBenchmark(("frame_pipeline/pipelined" + suffix).c_str(), [=](benchmark::State& state) {
+        TerrainRenderer renderer;
+        LatencyHistogram latency;
+        PipelinedExecutor executor("bench", (int)state.range(0));
+        executor.add_stage("h1", [&](const cv::Mat& input, cv::Mat& W) { unwrap(input, H, W); });
+        executor.add_stage("render", [&](const cv::Mat& W, cv::Mat& depth_rgb) { renderer.render(W, MIN_DEPTH, MAX_DEPTH, depth_rgb); });
+        executor.add_stage("h2", [&](const cv::Mat& depth_rgb, cv::Mat& out) { unwrap(depth_rgb, H, out); });
+        executor.set_sink([&](const cv::Mat&, uint64_t, uint64_t latency_ns) { latency.record(latency_ns); });
+        executor.start();
+
+        allocation_scope scope(state, pixels);
+        for (auto _ : state)
+            executor.push(depth);
+        executor.flush();
+        executor.stop();
+        report_latency(state, latency);
+    })->Arg(1)->Arg(2)->Arg(4)->UseRealTime();
+}
+
+static void BM_unwrap_estimate(benchmark::State& state)
+{
+    std::vector<cv::Point2f> corners = {{32, 38}, {620, 10}, {595, 456}, {12, 432}};
+    allocation_scope scope(state, 0);
+    for (auto _ : state)
+        benchmark::DoNotOptimize(unwrap_estimate(corners, 640, 480));
+}
+BENCHMARK(BM_unwrap_estimate);
+
+static void BM_get_cmap(benchmark::State& state)
+{
+    allocation_scope scope(state, 2048);
+    for (auto _ : state)
+        benchmark::DoNotOptimize(get_cmap(4.f));
+}
+BENCHMARK(BM_get_cmap);
+
+
+static void BM_palette_compile(benchmark::State& state)
+{
+    // The default ladder, and a linear dithered palette (four tables)
+    palette colors = default_palette();
+    if (state.range(0))
+    {
+        colors.interpolation = palette_interpolation::LINEAR;
+        colors.dither = 3.f;
+    }
+    allocation_scope scope(state, PALETTE_DEPTHS);
+    for (auto _ : state)
+        benchmark::DoNotOptimize(compile_palette(colors, MIN_DEPTH, MAX_DEPTH));
+}
+BENCHMARK(BM_palette_compile)->ArgName("dithered")->Arg(0)->Arg(1);
+
+
+// Former hardcoded ladder (utils.cpp before the palette files), frozen: default_palette()
+// must give the same color for every raw depth of every range
+static cv::Vec3b former_ladder_color(int depth, int min_depth, int max_depth)
+{
+    static const float limits[] = {-220.0f, -200.0f, -150.0f, -125.0f, -100.5f, -90.5f, -88.5f, -80.0f,
+                                   5.0f, 15.0f, 25.0f, 30.0f, 35.0f, 40.0f, 170.0f, 200.0f};
+    static const cv::Vec3b colors[] = {
+        {80, 0, 0}, {80, 0, 0}, {102, 50, 0}, {160, 108, 19}, {205, 140, 24}, {250, 206, 135},
+        {255, 226, 176}, {71, 97, 0}, {47, 122, 16}, {60, 180, 40}, {90, 220, 80}, {240, 240, 60},
+        {255, 255, 160}, {255, 255, 255}, {0, 67, 161}, {30, 30, 130}, {0, 0, 0},
+    };
+    int nb = std::clamp(depth, min_depth, max_depth);
+    float height = static_cast<float>(nb - min_depth) / (max_depth - min_depth) * (220.0f - -220.0f) + -220.0f;
+    size_t band = 0;
+    while (band < std::size(limits) && !(height <= limits[band]))
+        ++band;
+    return colors[band];
+}
+
+// The tables of the palette and its evaluation per pixel must give the same color for every
+// raw depth (beyond 11 bits too) and dithering phase, for every range min_depth <= max_depth.
+// Without a palette file, the tables of the default palette must also give the colors of the
+// former ladder (for min_depth < max_depth: the ladder divided by zero on an empty range).
+static int run_palette_check(const char* filename)
+{
+    try
+    {
+        if (filename != nullptr)
+            set_active_palette(std::make_shared<const palette>(load_palette(filename)));
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    bool check_ladder = filename == nullptr;
+
+    // Each depth on a 2x2 block (all the phases), then depths beyond 11 bits
+    std::vector<uint16_t> depths(PALETTE_DEPTHS);
+    for (int d = 0; d < PALETTE_DEPTHS; ++d)
+        depths[d] = (uint16_t)d;
+    depths.insert(depths.end(), {PALETTE_DEPTHS, 4095, 65535});
+    const int width = 2 * (int)depths.size(), height = 2;
+    std::vector<uint16_t> depth(width * height);
+    for (int y = 0; y < height; ++y)
+        for (int x = 0; x < width; ++x)
+            depth[y * width + x] = depths[x / 2];
+
+    // 2.1 million ranges: the min_depth are interleaved between the threads
+    const depth_kernels& kernels = get_generic_depth_kernels();
+    std::atomic<bool> failed = {false};
+    std::mutex report_mutex;
+    auto check = [&](int first, int stride) {
+        std::vector<cv::Vec3b> colors(depth.size()), reference(depth.size());
+        auto fail = [&](size_t i, int min_depth, int max_depth, const char* what, cv::Vec3b expected) {
+            std::lock_guard lock(report_mutex);
+            if (!failed.exchange(true))
+                std::cerr << "check_palette: depth " << depth[i] << " (phase " << dither_phase(i % width, i / width)
+                          << ") in [" << min_depth << ", " << max_depth << "]: table " << colors[i] << ", " << what
+                          << " " << expected << std::endl;
+        };
+        for (int min_depth = first; min_depth < PALETTE_DEPTHS && !failed; min_depth += stride)
+        {
+            for (int max_depth = min_depth; max_depth < PALETTE_DEPTHS && !failed; ++max_depth)
+            {
+                kernels.colorize(depth.data(), colors.data(), width, height, min_depth, max_depth);
+                kernels.colorize_float(depth.data(), reference.data(), width, height, min_depth, max_depth);
+                for (size_t i = 0; i < depth.size(); ++i)
+                {
+                    if (colors[i] != reference[i])
+                        return fail(i, min_depth, max_depth, "palette", reference[i]);
+                }
+                // The ladder has no dithering: one pixel per depth
+                for (size_t i = 0; check_ladder && min_depth < max_depth && i < (size_t)width; i += 2)
+                {
+                    cv::Vec3b ladder = former_ladder_color(depth[i], min_depth, max_depth);
+                    if (colors[i] != ladder)
+                        return fail(i, min_depth, max_depth, "former ladder", ladder);
+                }
+            }
+        }
+    };
+    int threads = std::max(1, (int)std::thread::hardware_concurrency());
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t)
+        workers.emplace_back(check, t, threads);
+    for (auto& worker : workers)
+        worker.join();
+    if (failed)
+        return 1;
+
+    std::cout << "check_palette: the tables and the palette give the same colors"
+              << (check_ladder ? ", and the default palette those of the former ladder" : "") << std::endl;
+    return 0;
+}
+
+
+int main(int argc, char** argv)
+{
+    if (argc > 1 && std::strcmp(argv[1], "--check_palette") == 0)
+        return run_palette_check(argc > 2 ? argv[2] : nullptr);
+
+    for (auto& res : resolutions)
+        register_benchmarks("synthetic", res, synthetic_depth(res.width, res.height));
+
+    if (const char* path = std::getenv("BENCH_DEPTH"))
+    {
+        cv::Mat recording = cv::imread(path, cv::IMREAD_ANYDEPTH);
+        if (recording.empty() || recording.type() != CV_16UC1)
+        {
+            std::cerr << "BENCH_DEPTH: " << path << " is not a 16-bit depth image" << std::endl;
+            return 1;
+        }
+        for (auto& res : resolutions)
+            register_benchmarks("recorded", res, recorded_depth(recording, res.width, res.height));
+    }
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv))
+        return 1;
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
@@ -0,0 +1,148 @@
+#include "black-box.hpp"
+#include "metrics.hpp"
+#include "profiling.hpp"
+#include "tracing.hpp"
+
+#include <stdexcept>
+#include <vector>
+
+#include <pthread.h>
+
+
+BlackBoxRecorder::BlackBoxRecorder(double seconds, size_t max_bytes)
+{
+    set_limits(seconds, max_bytes);
+}
+
+BlackBoxRecorder::~BlackBoxRecorder()
+{
+    if (m_dump_thread.joinable())
+        m_dump_thread.join();
+}
+
+void BlackBoxRecorder::set_limits(double seconds, size_t max_bytes)
+{
+    if (!(seconds > 0) || max_bytes == 0)
+        throw std::invalid_argument("BlackBoxRecorder: invalid duration or size");
+    std::lock_guard lock(m_mutex);
+    m_seconds = seconds;
+    m_max_bytes = max_bytes;
+    m_byte_limited = false;
+    evict();
+    report();
+}
+
+void BlackBoxRecorder::push(const cv::Mat& frame, uint32_t timestamp, frame_kind kind)
+{
+    entry e;
+    e.time = clock::now();
+    e.raw_bytes = frame.total() * frame.elemSize();
+    {
+        // Outside the lock: a dump only waits for the append
+        PROFILE_SCOPE("blackbox.encode");
+        e.frame = std::make_shared<const encoded_frame>(encode_frame(frame, timestamp, kind));
+    }
+
+    std::lock_guard lock(m_mutex);
+    m_bytes += e.frame->payload.size();
+    m_raw_bytes += e.raw_bytes;
+    m_ring.push_back(std::move(e));
+    evict();
+    report();
+}
+
+void BlackBoxRecorder::evict()
+{
+    // The newest frame is always kept
+    while (m_ring.size() > 1)
+    {
+        const entry& oldest = m_ring.front();
+        double age = std::chrono::duration<double>(m_ring.back().time - oldest.time).count();
+        if (m_bytes <= m_max_bytes && age <= m_seconds)
+            break;
+        m_byte_limited = age <= m_seconds;
+        m_bytes -= oldest.frame->payload.size();
+        m_raw_bytes -= oldest.raw_bytes;
+        m_ring.pop_front();
+    }
+}
+
+void BlackBoxRecorder::report() const
+{
+    static MetricGauge& frames = get_metric_gauge("kinect_blackbox_frames", "Frames kept by the black box");
+    static MetricGauge& bytes = get_metric_gauge("kinect_blackbox_bytes", "Memory of the encoded frames of the black box");
+    static MetricGauge& seconds = get_metric_gauge("kinect_blackbox_seconds", "Time span of the frames of the black box");
+    static MetricGauge& byte_limited = get_metric_gauge("kinect_blackbox_byte_limited", "1 if the memory budget, not the duration, bounds the black box");
+    frames.set((double)m_ring.size());
+    bytes.set((double)m_bytes);
+    seconds.set(m_ring.empty() ? 0. : std::chrono::duration<double>(m_ring.back().time - m_ring.front().time).count());
+    byte_limited.set(m_byte_limited);
+}
+
+BlackBoxRecorder::stats BlackBoxRecorder::statistics() const
+{
+    std::lock_guard lock(m_mutex);
+    stats s;
+    s.frames = m_ring.size();
+    s.bytes = m_bytes;
+    s.raw_bytes = m_raw_bytes;
+    s.byte_limited = m_byte_limited;
+    if (!m_ring.empty())
+        s.seconds = std::chrono::duration<double>(m_ring.back().time - m_ring.front().time).count();
+    return s;
+}
+
+void BlackBoxRecorder::clear()
+{
+    std::lock_guard lock(m_mutex);
+    m_ring.clear();
+    m_bytes = 0;
+    m_raw_bytes = 0;
+    m_byte_limited = false;
+    report();
+}
+
+bool BlackBoxRecorder::dump(const std::string& filename, dump_callback done)
+{
+    if (m_dumping.exchange(true))
+        return false;
+    // The previous dump has ended
+    if (m_dump_thread.joinable())
+        m_dump_thread.join();
+
+    std::vector<std::shared_ptr<const encoded_frame>> frames;
+    {
+        std::lock_guard lock(m_mutex);
+        frames.reserve(m_ring.size());
+        for (const entry& e : m_ring)
+            frames.push_back(e.frame);
+    }
+
+    m_dump_thread = std::thread([this, filename, frames = std::move(frames), done = std::move(done)]() {
+        pthread_setname_np(pthread_self(), "kinect-blackbox");
+        trace_thread_name("blackbox");
+        static MetricCounter& dumps = get_metric_counter("kinect_blackbox_dumps_total", "Black box dumps written");
+
+        uint64_t written = 0;
+        std::string error;
+        try
+        {
+            RecordingWriter writer(filename);
+            for (const auto& frame : frames)
+            {
+                writer.write(*frame);
+                ++written;
+            }
+            writer.close();
+            dumps.add();
+        }
+        catch (const std::exception& e)
+        {
+            error = e.what();
+        }
+        if (done)
+            done(written, error);
+        m_dumping = false;
+    });
+    return true;
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <opencv2/core.hpp>
+
+#include "recording.hpp"
+
+
+/// \brief Always-on recorder of the last seconds of the streams, kept in memory
+///
+/// Every frame is encoded by encode_frame() (lossless, DELTA for the depth: about a quarter of
+/// its raw size on sand) and appended to a ring. The oldest frames are dropped when the ring
+/// spans more than \p seconds or holds more than \p max_bytes of encoded frames, so its memory
+/// stays bounded whatever the content. The default budget holds 60 s of 640x480 depth at 30 fps
+/// up to 0.93 byte per pixel (0.53 measured on sand, 293 MB a minute); beyond it, the byte limit
+/// bounds the ring before the time limit and statistics() reports it.
+///
+/// dump() writes the ring to a recording file (replayed by sandbox-run) on a background thread:
+/// it takes a snapshot of the ring (the encoded frames are shared, not copied) and returns, the
+/// ring keeps recording meanwhile. The frames of a running dump stay in memory until it ends,
+/// at most twice \p max_bytes in all.
+///
+/// The ring size is exported with the metrics (kinect_blackbox_*).
+class BlackBoxRecorder
+{
+    public:
+        static constexpr double DEFAULT_SECONDS = 60;
+        static constexpr size_t DEFAULT_MAX_BYTES = size_t(512) << 20;
+
+        /// \brief Called on the dump thread when a dump ends
+        /// \param frames Frames written
+        /// \param error Empty on success
+        using dump_callback = std::function<void(uint64_t frames, const std::string& error)>;
+
+        explicit BlackBoxRecorder(double seconds = DEFAULT_SECONDS, size_t max_bytes = DEFAULT_MAX_BYTES);
+        /// \brief Wait for the running dump
+        ~BlackBoxRecorder();
+
+        /// \throw std::invalid_argument for a duration or a size that is not positive
+        void set_limits(double seconds, size_t max_bytes);
+
+        /// \brief Encode a frame and append it to the ring
+        void push(const cv::Mat& frame, uint32_t timestamp, frame_kind kind = frame_kind::DEPTH);
+
+        /// \brief Write the frames of the ring to \p filename, in the background
+        /// \return false (and nothing is written) while the previous dump runs
+        bool dump(const std::string& filename, dump_callback done = {});
+        bool is_dumping() const { return m_dumping.load(); }
+
+        /// \brief Content of the ring
+        struct stats
+        {
+            size_t frames = 0;
+            size_t bytes = 0;       // Encoded frames
+            size_t raw_bytes = 0;   // Same frames before the encoding
+            double seconds = 0;     // Between the oldest and the newest frame
+            bool byte_limited = false;  // The last frame dropped was within the time limit
+        };
+        stats statistics() const;
+
+        /// \brief Drop all the frames
+        void clear();
+
+    private:
+        using clock = std::chrono::steady_clock;
+
+        struct entry
+        {
+            clock::time_point time;
+            std::shared_ptr<const encoded_frame> frame;
+            size_t raw_bytes;
+        };
+
+        // Drop the oldest frames beyond the limits (m_mutex held)
+        void evict();
+        // Export the ring size (m_mutex held)
+        void report() const;
+
+        mutable std::mutex m_mutex;
+        std::deque<entry> m_ring;
+        size_t m_bytes = 0;
+        size_t m_raw_bytes = 0;
+        double m_seconds;
+        size_t m_max_bytes;
+        bool m_byte_limited = false;
+
+        std::thread m_dump_thread;
+        std::atomic<bool> m_dumping = {false};
+};
@@ -3,58 +3,29 @@
 #include "utils.hpp"
 
 
-cv::Mat depthmap_colorize(cv::Mat _depth, int min_depth, int max_depth)
-{
-
-    auto now = std::chrono::high_resolution_clock::now();
-
-    static auto cmap = get_cmap(4.f);
-    cv::Mat_<uint16_t> depth16 = _depth;
-
-    std::vector<uint16_t> depth_vector = matToVector(depth16);
-    uint8_t* final_img = process_depth(depth_vector,depth16.cols, depth16.rows, max_depth, min_depth);
-    cv::Mat depth_rgb2 = uint8ArrayToMat(final_img, depth16.rows, depth16.cols, CV_8UC3);
-    cv::Mat rgbImage;
-    cv::cvtColor(depth_rgb2, rgbImage, cv::COLOR_BGR2RGB);
-    delete[] final_img;
-    return depth_rgb2;
-}
+// Keeps the contour lines between frames and the quality set by the governor
+static TerrainRenderer renderer;
 
-/*
 cv::Mat depthmap_colorize(cv::Mat _depth, int min_depth, int max_depth)
 {
-    static auto cmap = get_cmap(5.f);
-    cv::Mat_<uint16_t> depth16 = _depth;
-
-    // Scale the depth image
-    if (min_depth > 0 && max_depth > 0)
-    {
-        min_depth = std::clamp((int)(0.75f * min_depth), 0, 2047);
-        max_depth = std::clamp((int)(1.25f * max_depth), 0, 2047);
-        depth16.forEach([&](uint16_t &pixel, const int position[2]) {
-            int value = (pixel - min_depth) * 2048 / (max_depth - min_depth);
-            pixel = std::clamp(value, 0, 2047);
-        });
-    }
-
-
-    // Colorize the unwrapped depth image
-    cv::Mat depth_rgb(depth16.rows, depth16.cols, CV_8UC3);
-    depth16.forEach([&](uint16_t &pixel, const int position[2]) {
-        rgb8 color = cmap[pixel];
-        depth_rgb.at<cv::Vec3b>(position[0], position[1]) = cv::Vec3b(color.r, color.g, color.b); }
-    );
-
-    return depth_rgb;
-}*/
+    return renderer.render(_depth, min_depth, max_depth);
+}
 
 int main(int argc, char** argv)
 {
+    // The GPU output needs OpenGL 3.3 core (also provided by Mesa's llvmpipe)
+    QSurfaceFormat format;
+    format.setVersion(3, 3);
+    format.setProfile(QSurfaceFormat::CoreProfile);
+    QSurfaceFormat::setDefaultFormat(format);
+
     // Create a QT application with a window and side-by-side RGB and Depth panel
     QApplication app(argc, argv);
 
     QCalibrationApp win;
     win.setOnDepthFrameChange(depthmap_colorize);
+    win.setOnQualityChange([](const render_quality& quality) { renderer.set_quality(quality); });
+    win.setOnStyleChange([](const terrain_style& style) { renderer.set_style(style); });
     win.show();
 
     return app.exec();
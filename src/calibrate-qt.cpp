@@ -4,14 +4,35 @@
 
 #include <QtGui>
 #include <QtWidgets>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <fstream>
+#include <functional>
 #include <iostream>
+#include <mutex>
+#include <thread>
+#include <utility>
 // OpenCV includes
 
 #include <opencv2/core.hpp>
 #include <opencv2/imgproc.hpp>
 #include <opencv2/calib3d.hpp>
-#include "capture-cv.hpp"
+#include "black-box.hpp"
+#include "capture-async.hpp"
+#include "calibration-cache.hpp"
 #include "calibration-utils.hpp"
+#include "demosaic.hpp"
+#include "gl-view.hpp"
+#include "metrics.hpp"
+#include "palette.hpp"
+#include "pipeline.hpp"
+#include "pipelined-executor.hpp"
+#include "raster-view.hpp"
+#include "recording.hpp"
+#include "structured-light.hpp"
+#include "thread-policy.hpp"
 #include "utils.hpp"
 
 //using namespace cv;
@@ -47,45 +68,182 @@ class QFullscreenView : public QWidget {
     }
 
     void setImage(const QImage& image) {
+        m_timer.start();
         m_item->setPixmap(QPixmap::fromImage(image));
         m_scene->setSceneRect(m_item->boundingRect());
         m_view->fitInView(m_item, Qt::KeepAspectRatio);
+        m_timer.stop();
     }
 
 
     private:
+        FrameTimer m_timer{"qt.calibration_view"};
         QGraphicsScene* m_scene;
         QGraphicsPixmapItem* m_item;
         QGraphicsView* m_view;
 };
 
 constexpr static int CONTROL_SIZE = 10;
+// Size of the camera frames (CVKinectCapture::MEDIUM), for the calibration tables
+static const cv::Size CAPTURE_SIZE(640, 480);
+// Delay between a change of the preset file and its reload (editors write in several steps)
+constexpr static int PRESET_RELOAD_DELAY_MS = 200;
+// Size of the image sent to the projector (calibration image, structured light)
+constexpr static int PROJECTOR_WIDTH = 640;
+constexpr static int PROJECTOR_HEIGHT = 480;
+// Number of RGB frames to skip after a pattern change before capturing it
+constexpr static int STRUCTURED_LIGHT_SETTLE_FRAMES = 5;
+// Period of the stats overlay refresh and of the stats dump in STATS_LOG_FILE
+constexpr static int STATS_OVERLAY_PERIOD_MS = 500;
+constexpr static int STATS_LOG_PERIOD_MS = 10000;
+constexpr static const char* STATS_LOG_FILE = "pipeline-stats.log";
+// The log is renamed to STATS_LOG_FILE.1 beyond this size: two files at most are kept
+constexpr static std::streamoff STATS_LOG_MAX_BYTES = 4 << 20;
+// Raw depth recording written by the "Record" option
+constexpr static const char* RECORDING_FILE = "recording.krec";
+// Black box dumps (the last seconds of the streams): blackbox-<date>.krec
+constexpr static const char* BLACKBOX_FILE_PREFIX = "blackbox-";
+// Timeline written when the "Trace" option is turned off
+constexpr static const char* TRACE_FILE = "pipeline-trace.json";
+// Metrics socket for the monitoring agent (KINECT_METRICS_SOCKET overrides it, empty to disable)
+constexpr static const char* METRICS_SOCKET = "/tmp/kinect-sandbox.sock";
+// Previews are downscaled by this factor when captured
+constexpr static double PREVIEW_SCALE = 0.5;
+// The RGB preview is demosaiced directly at the preview resolution
+constexpr static demosaic_scale PREVIEW_DEMOSAIC = demosaic_scale::HALF;
+constexpr static int DEFAULT_PREVIEW_FPS = 10;
+// Preview rate at the lowest quality level
+constexpr static int REDUCED_PREVIEW_FPS = 2;
+// Projector frame rate held by the quality governor
+constexpr static int DEFAULT_TARGET_FPS = 25;
+// Projectors side by side (KINECT_PROJECTORS sets the count at startup)
+constexpr static int MAX_PROJECTORS = 4;
+
+// Latest frame of a stream, handed from the capture thread to the Qt thread (older frames are dropped)
+struct FrameMailbox
+{
+    std::mutex mutex;
+    cv::Mat frame;
+    uint32_t timestamp = 0;
+    uint64_t frame_id = 0;
+    uint64_t arrival_ns = 0;    // Host time of the arrival of the frame, for the end-to-end latency
+    bool pending = false;
+
+    // Capture thread: return true when the Qt thread has to be woken up
+    bool put(const cv::Mat& input, uint32_t input_timestamp, uint64_t input_arrival_ns = 0)
+    {
+        // A new buffer: the Qt thread may still use the previous frame
+        cv::Mat copy = input.clone();
+        std::lock_guard lock(mutex);
+        frame = copy;
+        timestamp = input_timestamp;
+        frame_id = trace_current_frame();
+        arrival_ns = input_arrival_ns;
+        bool wake = !pending;
+        pending = true;
+        return wake;
+    }
+
+    // Qt thread
+    bool take(cv::Mat& output, uint32_t& output_timestamp, uint64_t& output_frame_id, uint64_t& output_arrival_ns)
+    {
+        std::lock_guard lock(mutex);
+        if (!pending)
+            return false;
+        output = frame;
+        output_timestamp = timestamp;
+        output_frame_id = frame_id;
+        output_arrival_ns = arrival_ns;
+        frame.release();
+        pending = false;
+        return true;
+    }
+};
+
+// Format of the RGB stream: raw Bayer frames, demosaiced on the Qt thread only when they are
+// consumed (KINECT_VIDEO_FORMAT=rgb lets libfreenect demosaic every frame on the USB thread)
+static CVKinectCapture::video_format capture_video_format()
+{
+    const char* format = std::getenv("KINECT_VIDEO_FORMAT");
+    return (format != nullptr && std::string(format) == "rgb") ? CVKinectCapture::VIDEO_RGB : CVKinectCapture::VIDEO_BAYER;
+}
+
+// RGB frame at 1 / scale of the resolution of a frame of the stream (Bayer or RGB)
+static cv::Mat video_frame(const cv::Mat& input, demosaic_scale scale)
+{
+    cv::Mat rgb;
+    if (input.type() == CV_8UC1)
+        demosaic(input, rgb, scale);
+    else if (scale == demosaic_scale::FULL)
+        rgb = input;
+    else
+        cv::resize(input, rgb, input.size() / (int)scale, 0, 0, cv::INTER_AREA);
+    return rgb;
+}
+
+// Style of the depth preview: the water and the hands follow the frames of the output only
+static terrain_style preview_style(terrain_style style)
+{
+    style.water_rain = 0;
+    style.occlusion_height = 0;
+    return style;
+}
+
+// Set by SIGUSR1 (kill -USR1 <pid> dumps the black box), polled by the stats timer
+static volatile std::sig_atomic_t blackbox_signal = 0;
+
+static void on_blackbox_signal(int)
+{
+    blackbox_signal = 1;
+}
+
+// Handle colors of the projector quads
+static const Qt::GlobalColor PROJECTOR_COLORS[MAX_PROJECTORS] = {Qt::green, Qt::yellow, Qt::cyan, Qt::magenta};
+
+enum PreviewPanel
+{
+    PREVIEW_RGB = 0,
+    PREVIEW_UNWRAPPED = 1,
+    PREVIEW_DEPTH = 2,
+    PREVIEW_COUNT = 3
+};
 
 
 class QControl : public QGraphicsRectItem
  {
-    QCalibrationApp* parent;
+    std::function<void()> moved;
 
     public:
-        QControl(QCalibrationApp* parent,  Qt::GlobalColor color, int x, int y) : QGraphicsRectItem(0, 0, CONTROL_SIZE, CONTROL_SIZE) {
+        // moved: called after each move of the handle
+        QControl(std::function<void()> moved,  Qt::GlobalColor color, int x, int y) : QGraphicsRectItem(0, 0, CONTROL_SIZE, CONTROL_SIZE) {
             setBrush(QBrush(color));
             setFlags(QGraphicsItem::ItemIsMovable | QGraphicsItem::ItemSendsGeometryChanges);
-            this->parent = parent;
+            this->moved = std::move(moved);
             this->setPos(x, y);
         }
 
         QVariant itemChange(GraphicsItemChange change, const QVariant& value) override {
-            if (change == ItemPositionHasChanged) {
-                parent->recompute_homography();
+            if (change == ItemPositionHasChanged && moved) {
+                moved();
             }
             return QGraphicsRectItem::itemChange(change, value);
         }
 };
 
+// One projector of the output: its window, its quad and its calibration
+struct ProjectorOutput
+{
+    QRasterView* m_output_view = nullptr;
+    std::vector<QControl*> m_control_mire;
+    cv::Mat H2;             // Homography (table -> projector)
+    cv::Mat map_x, map_y;   // Dense projector map (structured light), replaces H2 when set
+    cv::Mat output;         // Warped frame, reused
+};
+
 struct QCalibrationApp::QCalibrationAppImpl
 {
     QFullscreenView* m_calibration_view = nullptr;
-    QFullscreenView* m_output_view = nullptr;
+    QGLDepthView* m_gl_view = nullptr;
 
     QGraphicsView* lview;
     QGraphicsView* cview;
@@ -97,74 +255,290 @@ struct QCalibrationApp::QCalibrationAppImpl
     QGraphicsPixmapItem* unwrapped;
     QGraphicsPixmapItem* depth;
     QTimer* timer;
-    CVKinectCapture capture;
+    QTimer* m_preview_timer;
+    QCheckBox* m_preview_enabled;
+    QLabel* m_stats_overlay;
+
+    // Preview frames, downscaled when captured and displayed by the preview timer
+    cv::Mat preview_frames[PREVIEW_COUNT];
+    cv::Size preview_sizes[PREVIEW_COUNT];
+    bool preview_wanted[PREVIEW_COUNT] = {false, false, false};
+    bool preview_ready[PREVIEW_COUNT] = {false, false, false};
+    int preview_fps = DEFAULT_PREVIEW_FPS;
+    // Depth preview when the projector output does not render the frame: from the downscaled
+    // depth, without the water and the hands (their state follows the frames of the output)
+    TerrainRenderer preview_renderer;
+
+    // Degrades the CPU rendering of the depth map to hold the target frame rate
+    QualityGovernor governor{DEFAULT_TARGET_FPS};
+    // Time spent on the previews since the last depth frame, outside the depth pipeline: added
+    // to the frame time given to the governor, so that its last step (reduced previews) is measured
+    uint64_t preview_ns = 0;
+    cv::Size rgb_size;
+    // Opened in the background, the frames are processed on the Qt thread. Stopped first by
+    // ~QCalibrationApp(), since its callbacks use the members declared below
+    AsyncKinectCapture capture{CVKinectCapture::MEDIUM, CVKinectCapture::MEDIUM, capture_video_format()};
+    std::atomic<bool> rgb_consumed = {false};  // An RGB sink is enabled, read by the capture thread
+    FrameMailbox rgb_mailbox;
+    FrameMailbox depth_mailbox;
+    QLabel* m_sensor_status;
     QCheckBox* m_output_choice;
     QCheckBox* m_output_depth;
+    QCheckBox* m_output_gpu;
+    QComboBox* m_calibration_menu;
+    QSpinBox* m_projector_count;
+    QComboBox* m_projector_menu;
+    FrameTimer m_cpu_timer{"depth.cpu_output"};
 
     // Control
     std::vector<QControl*> m_control_box;
-    std::vector<QControl*> m_control_mire;
     std::vector<QControl*> m_control_depth;
 
-    cv::Mat H1, H2; // Homography matrix
+    // Frames are rendered once in table space, then warped into each projector on its own worker
+    std::vector<ProjectorOutput> projectors;
+    int current_projector = 0;  // Projector of the "Mire" handles and of the structured light
+    FanoutExecutor projector_fanout{"projectors"};
+
+    // Frame processing graphs, only the branches consumed by an enabled sink run
+    FramePipeline rgb_pipeline{"rgb"};
+    FramePipeline depth_pipeline{"depth"};
+    struct
+    {
+        int preview, structured_light, preview_transformed, preview_output, projector, black_box;
+    } rgb_sinks;
+    struct
+    {
+        int calibration, gpu, save, record, black_box, preview, preview_small, projector;
+    } depth_sinks;
+
+    // Metrics export (calibration state, refreshed with the stats)
+    MetricsServer metrics_server;
+    MetricGauge& metric_min_depth = get_metric_gauge("kinect_calibration_min_depth", "Raw depth of the top of the sand");
+    MetricGauge& metric_max_depth = get_metric_gauge("kinect_calibration_max_depth", "Raw depth of the bottom of the sand");
+    MetricGauge& metric_box = get_metric_gauge("kinect_calibration_box", "1 if the box homography (H1) is set");
+    MetricGauge& metric_projector = get_metric_gauge("kinect_calibration_projector", "Projector calibration: 0 none, 1 homography, 2 dense map");
+    MetricGauge& metric_projectors = get_metric_gauge("kinect_calibration_projectors", "Number of projectors of the output");
+
+    // Raw depth recording, replayed by sandbox-run
+    RecordingWriter recorder;
+    uint32_t depth_timestamp = 0;
+    uint64_t depth_arrival_ns = 0;  // Of the frame being processed, for the end-to-end latency
+    uint32_t rgb_timestamp = 0;
+
+    // Last seconds of the depth (and RGB) streams, dumped on demand (KINECT_BLACKBOX_SECONDS=0 disables it)
+    BlackBoxRecorder black_box;
+    bool black_box_enabled = true;
+    bool black_box_rgb = false;
+    bool black_box_byte_limited = false;
+
+    cv::Mat H1; // Homography matrix
+    // Remap tables of H1 and of the projectors (with their edge blending), empty while the handles are moved
+    calibration_tables tables;
+    terrain_style style;
+
+    // Hot reload of the preset file, loaded (and its tables built) in the background
+    // with its palette file, which is watched too
+    QFileSystemWatcher* preset_watcher = nullptr;
+    std::string palette_filename;
+    QTimer* preset_reload_timer = nullptr;
+    std::thread reload_thread;
+    // Reloads requested while one runs are coalesced: the running worker loads the file once more
+    std::atomic<bool> reload_pending = {false};
+    std::atomic<bool> reload_running = {false};
+
+    // Structured light sequence
+    std::vector<cv::Mat> sl_patterns;
+    std::vector<cv::Mat> sl_captures;
+    int sl_index = -1;
+    int sl_wait = 0;
 
     bool calibrate_depth = false;
     bool mirror_output = false;
     bool saved_requested = false;
-    int min_depth, max_depth;
+    int min_depth = 0, max_depth = 2047;
     std::string preset_filename = "calibration.yml";
+
+    ~QCalibrationAppImpl()
+    {
+        if (reload_thread.joinable())
+            reload_thread.join();
+    }
 };
 
 void QCalibrationApp::savePresets()
 {
-    cv::FileStorage fs(m_impl->preset_filename, cv::FileStorage::WRITE);
-    fs.write("H1", m_impl->H1);
-    fs.write("H2", m_impl->H2);
-    fs.write("min_depth", m_impl->min_depth);
-    fs.write("max_depth", m_impl->max_depth);
+    calibration_data calibration;
+    calibration.H1 = m_impl->H1;
+    calibration.min_depth = m_impl->min_depth;
+    calibration.max_depth = m_impl->max_depth;
+    calibration.style = m_impl->style;
 
     cv::Mat points_box(4, 2, CV_32F);
-    cv::Mat points_mire(4, 2, CV_32F);
     cv::Mat points_depth(2, 2, CV_32F);
     for (int i = 0; i < 4; ++i)
     {
         points_box.at<float>(i, 0) = m_impl->m_control_box[i]->scenePos().x() + CONTROL_SIZE / 2;
         points_box.at<float>(i, 1) = m_impl->m_control_box[i]->scenePos().y() + CONTROL_SIZE / 2;
-        points_mire.at<float>(i, 0) = m_impl->m_control_mire[i]->scenePos().x() + CONTROL_SIZE / 2;
-        points_mire.at<float>(i, 1) = m_impl->m_control_mire[i]->scenePos().y() + CONTROL_SIZE / 2;
     }
     for (int i = 0; i < 2; ++i)
     {
         points_depth.at<float>(i, 0) = m_impl->m_control_depth[i]->scenePos().x() + CONTROL_SIZE / 2;
         points_depth.at<float>(i, 1) = m_impl->m_control_depth[i]->scenePos().y() + CONTROL_SIZE / 2;
     }
-    fs.write("points_box", points_box);
-    fs.write("points_mire", points_mire);
-    fs.write("points_depth", points_depth);
+    calibration.points_box = points_box;
+    calibration.points_depth = points_depth;
+
+    for (const ProjectorOutput& output : m_impl->projectors)
+    {
+        projector_calibration projector;
+        projector.H2 = output.H2;
+        projector.map_x = output.map_x;
+        projector.map_y = output.map_y;
+        projector.points_mire.create(4, 2, CV_32F);
+        for (int i = 0; i < 4; ++i)
+        {
+            projector.points_mire.at<float>(i, 0) = output.m_control_mire[i]->scenePos().x() + CONTROL_SIZE / 2;
+            projector.points_mire.at<float>(i, 1) = output.m_control_mire[i]->scenePos().y() + CONTROL_SIZE / 2;
+        }
+        calibration.projectors.push_back(projector);
+    }
+
+    try
+    {
+        save_calibration(m_impl->preset_filename, calibration);
+        m_impl->tables = build_calibration_tables(calibration, CAPTURE_SIZE);
+        write_calibration_cache(m_impl->preset_filename, calibration, m_impl->tables);
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+    }
+}
+
+// Palette file of the presets, nullptr for the default palette
+static std::shared_ptr<const palette> load_style_palette(const terrain_style& style)
+{
+    if (style.palette.empty())
+        return nullptr;
+    return std::make_shared<const palette>(load_palette(style.palette));
 }
 
 void QCalibrationApp::loadPresets()
 {
+    try
+    {
+        cached_calibration cached = load_calibration_cached(m_impl->preset_filename, CAPTURE_SIZE);
+        applyCalibration(cached, load_style_palette(cached.calibration.style));
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+    }
+}
 
-    cv::FileStorage fs(m_impl->preset_filename, cv::FileStorage::READ);
-    fs["H1"] >> m_impl->H1;
-    fs["H2"] >> m_impl->H2;
-    fs["min_depth"] >> m_impl->min_depth;
-    fs["max_depth"] >> m_impl->max_depth;
+void QCalibrationApp::reloadPresets()
+{
+    // The file may have been replaced (and no longer be watched)
+    if (!m_impl->preset_watcher->files().contains(QString::fromStdString(m_impl->preset_filename)))
+        m_impl->preset_watcher->addPath(QString::fromStdString(m_impl->preset_filename));
 
-    cv::Mat points_box, points_mire, points_depth;
-    fs["points_box"] >> points_box;
-    fs["points_mire"] >> points_mire;
-    fs["points_depth"] >> points_depth;
+    // A running worker picks the request up, the Qt thread never waits for it
+    m_impl->reload_pending = true;
+    if (m_impl->reload_running.exchange(true))
+        return;
+    // The previous worker has ended (or is returning)
+    if (m_impl->reload_thread.joinable())
+        m_impl->reload_thread.join();
+
+    // Parsing and building the tables would stall the frames: only the result is applied here
+    m_impl->reload_thread = std::thread([this, filename = m_impl->preset_filename]() {
+        auto& impl = *m_impl;
+        do
+        {
+            while (impl.reload_pending.exchange(false))
+            {
+                try
+                {
+                    auto cached = std::make_shared<cached_calibration>(load_calibration_cached(filename, CAPTURE_SIZE));
+                    auto colors = load_style_palette(cached->calibration.style);
+                    QMetaObject::invokeMethod(this, [this, cached, colors]() {
+                        applyCalibration(*cached, colors);
+                        std::cout << "Calibration reloaded from " << m_impl->preset_filename << std::endl;
+                    }, Qt::QueuedConnection);
+                }
+                catch (const std::exception& e)
+                {
+                    std::cerr << e.what() << std::endl;
+                }
+            }
+            impl.reload_running = false;
+            // A request made after the last check, that saw this worker still running
+        } while (impl.reload_pending && !impl.reload_running.exchange(true));
+    });
+}
 
-    for (int i = 0; i < 4; ++i)
+void QCalibrationApp::applyCalibration(const cached_calibration& cached, std::shared_ptr<const palette> colors)
+{
+    const calibration_data& calibration = cached.calibration;
+    setProjectorCount((int)calibration.projectors.size());
+    m_impl->H1 = calibration.H1;
+    m_impl->min_depth = calibration.min_depth;
+    m_impl->max_depth = calibration.max_depth;
+
+    const cv::Mat& points_box = calibration.points_box;
+    const cv::Mat& points_depth = calibration.points_depth;
+    if (points_box.rows == 4)
     {
-        m_impl->m_control_box[i]->setPos(points_box.at<float>(i, 0) - CONTROL_SIZE / 2, points_box.at<float>(i, 1) - CONTROL_SIZE / 2);
-        m_impl->m_control_mire[i]->setPos(points_mire.at<float>(i, 0) - CONTROL_SIZE / 2, points_mire.at<float>(i, 1) - CONTROL_SIZE / 2);
+        for (int i = 0; i < 4; ++i)
+        {
+            m_impl->m_control_box[i]->setPos(points_box.at<float>(i, 0) - CONTROL_SIZE / 2, points_box.at<float>(i, 1) - CONTROL_SIZE / 2);
+        }
     }
-    for (int i = 0; i < 2; ++i)
+    for (size_t k = 0; k < m_impl->projectors.size(); ++k)
+    {
+        const cv::Mat& points_mire = calibration.projectors[k].points_mire;
+        if (points_mire.rows != 4)
+            continue;
+        for (int i = 0; i < 4; ++i)
+        {
+            m_impl->projectors[k].m_control_mire[i]->setPos(points_mire.at<float>(i, 0) - CONTROL_SIZE / 2, points_mire.at<float>(i, 1) - CONTROL_SIZE / 2);
+        }
+    }
+    if (points_depth.rows == 2)
     {
-        m_impl->m_control_depth[i]->setPos(points_depth.at<float>(i, 0) - CONTROL_SIZE / 2, points_depth.at<float>(i, 1) - CONTROL_SIZE / 2);
+        for (int i = 0; i < 2; ++i)
+        {
+            m_impl->m_control_depth[i]->setPos(points_depth.at<float>(i, 0) - CONTROL_SIZE / 2, points_depth.at<float>(i, 1) - CONTROL_SIZE / 2);
+        }
+    }
+
+    // Set after the handles: moving them discards the dense maps and the tables
+    for (size_t k = 0; k < m_impl->projectors.size(); ++k)
+    {
+        const projector_calibration& projector = calibration.projectors[k];
+        m_impl->projectors[k].H2 = projector.H2;
+        m_impl->projectors[k].map_x = projector.map_x;
+        m_impl->projectors[k].map_y = projector.map_y;
+    }
+    m_impl->tables = cached.tables;
+
+    m_impl->style = calibration.style;
+    if (m_onStyleChange)
+        m_onStyleChange(m_impl->style);
+    m_impl->preview_renderer.set_style(preview_style(m_impl->style));
+
+    // Compiled again by the renderers at their next frame
+    set_active_palette(std::move(colors));
+    if (m_impl->preset_watcher != nullptr)
+    {
+        // A palette file replaced by an editor is no longer watched
+        QString previous = QString::fromStdString(m_impl->palette_filename);
+        QString current = QString::fromStdString(calibration.style.palette);
+        if (!previous.isEmpty() && previous != current)
+            m_impl->preset_watcher->removePath(previous);
+        if (!current.isEmpty() && !m_impl->preset_watcher->files().contains(current))
+            m_impl->preset_watcher->addPath(current);
+        m_impl->palette_filename = calibration.style.palette;
     }
 }
 
@@ -174,32 +548,472 @@ void QCalibrationApp::setPresetName(std::string_view filename)
 }
 
 
-void QCalibrationApp::peek_frame()
+void QCalibrationApp::processRGBFrame()
+{
+    cv::Mat input;
+    uint32_t timestamp;
+    uint64_t frame_id, arrival_ns;
+    if (!m_impl->rgb_mailbox.take(input, timestamp, frame_id, arrival_ns))
+        return;
+
+    trace_set_current_frame(frame_id);
+    trace_frame_flow(trace_phase::FLOW_STEP);
+    m_impl->rgb_size = input.size();
+    m_impl->rgb_timestamp = timestamp;
+    m_impl->rgb_pipeline.run(input);
+}
+
+void QCalibrationApp::processDepthFrame()
+{
+    cv::Mat depth;
+    uint32_t timestamp;
+    uint64_t frame_id, arrival_ns;
+    if (!m_impl->depth_mailbox.take(depth, timestamp, frame_id, arrival_ns) || !m_onDepthFrameChange)
+        return;
+
+    trace_set_current_frame(frame_id);
+    trace_frame_flow(trace_phase::FLOW_STEP);
+    m_impl->m_cpu_timer.start();
+    m_impl->depth_timestamp = timestamp;
+    m_impl->depth_arrival_ns = arrival_ns;
+    uint64_t start = profiling_now();
+    m_impl->depth_pipeline.run(depth);
+
+    // The governor only drives the CPU rendering
+    uint64_t frame_ns = profiling_now() - start + std::exchange(m_impl->preview_ns, 0);
+    bool cpu_output = m_impl->depth_pipeline.is_enabled(m_impl->depth_sinks.projector);
+    if (cpu_output && m_impl->governor.update(frame_ns))
+        applyQuality();
+}
+
+void QCalibrationApp::dumpBlackBox()
+{
+    if (!m_impl->black_box_enabled)
+        return;
+    std::string filename = BLACKBOX_FILE_PREFIX + QDateTime::currentDateTime().toString("yyyyMMdd-HHmmss").toStdString() + ".krec";
+    bool started = m_impl->black_box.dump(filename, [filename](uint64_t frames, const std::string& error) {
+        if (error.empty())
+            std::cout << "Black box: " << frames << " frames written to " << filename << std::endl;
+        else
+            std::cerr << "Black box: " << error << std::endl;
+    });
+    if (!started)
+        std::cerr << "Black box: a dump is already running" << std::endl;
+}
+
+void QCalibrationApp::setSensorState(int state)
 {
-    m_impl->capture.next_loop_event();
+    bool running = (state == AsyncKinectCapture::RUNNING);
+    m_impl->m_sensor_status->setText(running ? "Sensor OK" : "Waiting for sensor...");
+    m_impl->m_sensor_status->setStyleSheet(running ? "" : "QLabel { color: orange; }");
 }
 
-void QCalibrationApp::recompute_homography()
+void QCalibrationApp::recompute_homography(int moved_projector)
 {
-    if (m_impl->rgb->pixmap().isNull())
+    if (m_impl->rgb_size.empty())
         return;
 
     std::vector<cv::Point2f> coordinates_box(4);
-    std::vector<cv::Point2f> coordinates_mire(4);
 
     for (int i = 0; i < 4; ++i)
     {
         coordinates_box[i].x = m_impl->m_control_box[i]->scenePos().x() + CONTROL_SIZE / 2;
         coordinates_box[i].y = m_impl->m_control_box[i]->scenePos().y() + CONTROL_SIZE / 2;
-        coordinates_mire[i].x = m_impl->m_control_mire[i]->scenePos().x() + CONTROL_SIZE / 2;
-        coordinates_mire[i].y = m_impl->m_control_mire[i]->scenePos().y() + CONTROL_SIZE / 2;
     }
-    int w = m_impl->rgb->pixmap().width();
-    int h = m_impl->rgb->pixmap().height();
+    int w = m_impl->rgb_size.width;
+    int h = m_impl->rgb_size.height;
 
     m_impl->H1 = unwrap_estimate(coordinates_box, w, h);
-    auto H2 = unwrap_estimate(coordinates_mire, w, h, m_impl->mirror_output);
-    m_impl->H2 = H2 * m_impl->H1.inv();
+    for (int p = 0; p < (int)m_impl->projectors.size(); ++p)
+    {
+        auto& projector = m_impl->projectors[p];
+        std::vector<cv::Point2f> coordinates_mire(4);
+        for (int i = 0; i < 4; ++i)
+        {
+            coordinates_mire[i].x = projector.m_control_mire[i]->scenePos().x() + CONTROL_SIZE / 2;
+            coordinates_mire[i].y = projector.m_control_mire[i]->scenePos().y() + CONTROL_SIZE / 2;
+        }
+        auto H2 = unwrap_estimate(coordinates_mire, w, h, m_impl->mirror_output);
+        projector.H2 = H2 * m_impl->H1.inv();
+
+        // The dense map was built for the previous H1 and quad: the other projectors keep theirs
+        if (moved_projector < 0 || moved_projector == p)
+        {
+            projector.map_x.release();
+            projector.map_y.release();
+        }
+    }
+    m_impl->tables = calibration_tables();
+}
+
+bool QCalibrationApp::previewsActive() const
+{
+    return m_impl->m_preview_enabled->isChecked() && this->isVisible() && !this->isMinimized();
+}
+
+void QCalibrationApp::setPreview(int panel, const cv::Mat& frame, double frame_scale)
+{
+    uint64_t start = profiling_now();
+    if (frame_scale == PREVIEW_SCALE)
+        frame.copyTo(m_impl->preview_frames[panel]);
+    else
+        cv::resize(frame, m_impl->preview_frames[panel], cv::Size(), PREVIEW_SCALE / frame_scale, PREVIEW_SCALE / frame_scale, cv::INTER_AREA);
+    m_impl->preview_sizes[panel] = cv::Size(cvRound(frame.cols / frame_scale), cvRound(frame.rows / frame_scale));
+    m_impl->preview_wanted[panel] = false;
+    m_impl->preview_ready[panel] = true;
+    updateSinks();
+    // The depth preview is timed with the depth pipeline
+    if (panel != PREVIEW_DEPTH)
+        m_impl->preview_ns += profiling_now() - start;
+}
+
+void QCalibrationApp::refreshPreviews()
+{
+    if (!previewsActive())
+    {
+        // Stop capturing previews until they are visible again
+        std::fill(std::begin(m_impl->preview_wanted), std::end(m_impl->preview_wanted), false);
+        updateSinks();
+        return;
+    }
+
+    uint64_t start = profiling_now();
+    QGraphicsPixmapItem* items[PREVIEW_COUNT] = {m_impl->rgb, m_impl->unwrapped, m_impl->depth};
+    QGraphicsScene* scenes[PREVIEW_COUNT] = {m_impl->lscene, m_impl->cscene, m_impl->rscene};
+
+    for (int i = 0; i < PREVIEW_COUNT; ++i)
+    {
+        if (m_impl->preview_ready[i])
+        {
+            const cv::Mat& frame = m_impl->preview_frames[i];
+            QImage image(frame.data, frame.cols, frame.rows, frame.step, QImage::Format_RGB888);
+            items[i]->setPixmap(QPixmap::fromImage(image));
+            // Keep the scene in full resolution coordinates (for the handles)
+            items[i]->setScale(1. / PREVIEW_SCALE);
+            scenes[i]->setSceneRect(0, 0, m_impl->preview_sizes[i].width, m_impl->preview_sizes[i].height);
+            m_impl->preview_ready[i] = false;
+        }
+        // Ask the frame callbacks for a new preview
+        m_impl->preview_wanted[i] = true;
+    }
+    updateSinks();
+    m_impl->preview_ns += profiling_now() - start;
+}
+
+void QCalibrationApp::updatePreviewRate()
+{
+    int fps = m_impl->preview_fps;
+    if (get_render_quality(m_impl->governor.level()).reduced_previews)
+        fps = std::min(fps, REDUCED_PREVIEW_FPS);
+    m_impl->m_preview_timer->start(1000 / fps);
+}
+
+void QCalibrationApp::applyQuality()
+{
+    int level = m_impl->governor.level();
+    std::cout << "Quality: " << quality_level_name(level) << std::endl;
+    if (m_onQualityChange)
+        m_onQualityChange(get_render_quality(level));
+    updatePreviewRate();
+}
+
+void QCalibrationApp::buildPipelines()
+{
+    // RGB: raw -> demosaic -> H1 -> user transform -> H2 (of each projector)
+    auto& rgb = m_impl->rgb_pipeline;
+    int rgb_preview = rgb.add_stage("demosaic_preview", FramePipeline::SOURCE, [](const cv::Mat& input) {
+        return video_frame(input, PREVIEW_DEMOSAIC);
+    });
+    int rgb_frame = rgb.add_stage("demosaic", FramePipeline::SOURCE, [](const cv::Mat& input) {
+        return video_frame(input, demosaic_scale::FULL);
+    });
+    m_impl->rgb_sinks.preview = rgb.add_sink("preview_rgb", rgb_preview, [this](const cv::Mat& input) {
+        setPreview(PREVIEW_RGB, input, 1. / (int)PREVIEW_DEMOSAIC);
+    });
+    // The black box keeps the RGB frames at the preview resolution (a quarter of the pixels)
+    m_impl->rgb_sinks.black_box = rgb.add_sink("black_box", rgb_preview, [this](const cv::Mat& input) {
+        m_impl->black_box.push(input, m_impl->rgb_timestamp, frame_kind::RGB);
+    });
+    m_impl->rgb_sinks.structured_light = rgb.add_sink("structured_light", rgb_frame, [this](const cv::Mat& input) {
+        onStructuredLightFrame(input);
+    });
+    int rgb_h1 = rgb.add_stage("h1", rgb_frame, [this](const cv::Mat& input) {
+        return unwrapBox(input);
+    });
+    int rgb_transform = rgb.add_stage("transform", rgb_h1, [this](const cv::Mat& W) {
+        return (m_onRGBFrameChange) ? m_onRGBFrameChange(W) : W;
+    });
+    int rgb_h2 = rgb.add_stage("h2", rgb_transform, [this](const cv::Mat& transformed) {
+        return project(transformed);
+    });
+    m_impl->rgb_sinks.preview_transformed = rgb.add_sink("preview_transformed", rgb_transform, [this](const cv::Mat& transformed) {
+        setPreview(PREVIEW_UNWRAPPED, transformed);
+    });
+    m_impl->rgb_sinks.preview_output = rgb.add_sink("preview_output", rgb_h2, [this](const cv::Mat& output) {
+        setPreview(PREVIEW_UNWRAPPED, output);
+    });
+    m_impl->rgb_sinks.projector = rgb.add_sink("projector", rgb_transform, [this](const cv::Mat& transformed) {
+        presentProjectors(transformed);
+    });
+
+    // Depth: raw -> H1 -> colorize -> H2 (of each projector)
+    auto& depth = m_impl->depth_pipeline;
+    m_impl->depth_sinks.calibration = depth.add_sink("depth_calibration", FramePipeline::SOURCE, [this](const cv::Mat& input) {
+        auto depth16 = (cv::Mat_<uint16_t>)input;
+        auto p1 = m_impl->m_control_depth[0]->scenePos();
+        auto p2 = m_impl->m_control_depth[1]->scenePos();
+        auto q1 = cv::Point2f(p1.x() + CONTROL_SIZE / 2, p1.y() + CONTROL_SIZE / 2);
+        auto q2 = cv::Point2f(p2.x() + CONTROL_SIZE / 2, p2.y() + CONTROL_SIZE / 2);
+        uint16_t d1 = depth16.at<uint16_t>(q1);
+        uint16_t d2 = depth16.at<uint16_t>(q2);
+        std::tie(m_impl->min_depth, m_impl->max_depth) = std::minmax(d1, d2);
+        std::cout << "Depth calibration: " << m_impl->min_depth << " " << m_impl->max_depth << std::endl;
+        m_impl->calibrate_depth = false;
+        updateSinks();
+    });
+    m_impl->depth_sinks.gpu = depth.add_sink("gpu", FramePipeline::SOURCE, [this](const cv::Mat& input) {
+        // The shader does the whole chain from the raw depth (single projector)
+        const ProjectorOutput& projector = m_impl->projectors.front();
+        m_impl->m_gl_view->setCalibration(m_impl->H1, projector.H2, projector.map_x, projector.map_y, m_impl->min_depth, m_impl->max_depth);
+        // Its end-to-end latency is recorded by the view, once the frame is drawn
+        m_impl->m_gl_view->setDepth(input, m_impl->depth_arrival_ns);
+    });
+    m_impl->depth_sinks.record = depth.add_sink("record", FramePipeline::SOURCE, [this](const cv::Mat& input) {
+        m_impl->recorder.write(input, m_impl->depth_timestamp);
+    });
+    m_impl->depth_sinks.black_box = depth.add_sink("black_box", FramePipeline::SOURCE, [this](const cv::Mat& input) {
+        m_impl->black_box.push(input, m_impl->depth_timestamp);
+    });
+    int depth_h1 = depth.add_stage("h1", FramePipeline::SOURCE, [this](const cv::Mat& input) {
+        return unwrapBox(input);
+    });
+    m_impl->depth_sinks.save = depth.add_sink("save", depth_h1, [this](const cv::Mat& W) {
+        cv::imwrite("output.png", W);
+        m_impl->saved_requested = false;
+        updateSinks();
+    });
+    int depth_colorize = depth.add_stage("colorize", depth_h1, [this](const cv::Mat& W) {
+        return m_onDepthFrameChange(W, m_impl->min_depth, m_impl->max_depth);
+    });
+    m_impl->depth_sinks.preview = depth.add_sink("preview_depth", depth_colorize, [this](const cv::Mat& depth_rgb) {
+        setPreview(PREVIEW_DEPTH, depth_rgb);
+    });
+    // Without the CPU output, only the preview pixels are colorized (nearest: no blending of the invalid depths)
+    int depth_preview_scale = depth.add_stage("preview_scale", depth_h1, [](const cv::Mat& W) {
+        cv::Mat small;
+        cv::resize(W, small, cv::Size(), PREVIEW_SCALE, PREVIEW_SCALE, cv::INTER_NEAREST);
+        return small;
+    });
+    m_impl->depth_sinks.preview_small = depth.add_sink("preview_depth_small", depth_preview_scale, [this](const cv::Mat& small) {
+        setPreview(PREVIEW_DEPTH, m_impl->preview_renderer.render(small, m_impl->min_depth, m_impl->max_depth), PREVIEW_SCALE);
+    });
+    m_impl->depth_sinks.projector = depth.add_sink("projector", depth_colorize, [this](const cv::Mat& depth_rgb) {
+        presentProjectors(depth_rgb);
+        m_impl->m_cpu_timer.stop();
+        depth_frame_presented(m_impl->depth_arrival_ns);
+    });
+}
+
+void QCalibrationApp::updateSinks()
+{
+    auto& impl = *m_impl;
+    bool structured_light = impl.sl_index >= 0;
+    bool output_depth = impl.m_output_depth->isChecked();
+    bool gpu = output_depth && impl.m_output_gpu->isChecked();
+    bool real_output = impl.m_output_choice->isChecked();
+
+    impl.rgb_pipeline.set_enabled(impl.rgb_sinks.preview, impl.preview_wanted[PREVIEW_RGB]);
+    impl.rgb_pipeline.set_enabled(impl.rgb_sinks.structured_light, structured_light);
+    impl.rgb_pipeline.set_enabled(impl.rgb_sinks.preview_transformed, !structured_light && !real_output && impl.preview_wanted[PREVIEW_UNWRAPPED]);
+    impl.rgb_pipeline.set_enabled(impl.rgb_sinks.preview_output, !structured_light && real_output && impl.preview_wanted[PREVIEW_UNWRAPPED]);
+    impl.rgb_pipeline.set_enabled(impl.rgb_sinks.projector, !structured_light && !output_depth);
+    impl.rgb_pipeline.set_enabled(impl.rgb_sinks.black_box, impl.black_box_enabled && impl.black_box_rgb);
+    auto& sinks = impl.rgb_sinks;
+    impl.rgb_consumed = false;
+    for (int sink : {sinks.preview, sinks.structured_light, sinks.preview_transformed, sinks.preview_output, sinks.projector, sinks.black_box})
+        impl.rgb_consumed = impl.rgb_consumed || impl.rgb_pipeline.is_enabled(sink);
+
+    impl.depth_pipeline.set_enabled(impl.depth_sinks.calibration, impl.calibrate_depth);
+    impl.depth_pipeline.set_enabled(impl.depth_sinks.gpu, gpu);
+    impl.depth_pipeline.set_enabled(impl.depth_sinks.save, impl.saved_requested);
+    impl.depth_pipeline.set_enabled(impl.depth_sinks.record, impl.recorder.is_open());
+    impl.depth_pipeline.set_enabled(impl.depth_sinks.black_box, impl.black_box_enabled);
+    // The depth preview reuses the frame of the CPU output, or renders its own smaller one
+    bool cpu_output = output_depth && !gpu;
+    impl.depth_pipeline.set_enabled(impl.depth_sinks.preview, impl.preview_wanted[PREVIEW_DEPTH] && cpu_output);
+    impl.depth_pipeline.set_enabled(impl.depth_sinks.preview_small, impl.preview_wanted[PREVIEW_DEPTH] && !cpu_output);
+    impl.depth_pipeline.set_enabled(impl.depth_sinks.projector, cpu_output);
+}
+
+cv::Mat QCalibrationApp::unwrapBox(const cv::Mat& input) const
+{
+    if (m_impl->tables.valid_for(input.size()))
+        return unwrap_box(input, m_impl->tables);
+    return (m_impl->H1.empty()) ? input : unwrap(input, m_impl->H1);
+}
+
+bool QCalibrationApp::projectorTablesValid(const cv::Size& size) const
+{
+    return m_impl->tables.valid_for(size) && m_impl->tables.projectors.size() == m_impl->projectors.size();
+}
+
+cv::Mat QCalibrationApp::project(const cv::Mat& input) const
+{
+    if (projectorTablesValid(input.size()))
+        return unwrap_projector(input, m_impl->tables, m_impl->current_projector);
+    const ProjectorOutput& projector = m_impl->projectors[m_impl->current_projector];
+    return unwrap_output(input, projector.H2, projector.map_x, projector.map_y);
+}
+
+void QCalibrationApp::presentProjectors(const cv::Mat& input)
+{
+    auto& projectors = m_impl->projectors;
+    bool tables = projectorTablesValid(input.size());
+    // The Qt thread waits for the warps: the views are only touched here
+    m_impl->projector_fanout.run((int)projectors.size(), [&](int i) {
+        ProjectorOutput& projector = projectors[i];
+        if (tables)
+            unwrap_projector(input, m_impl->tables, i, projector.output);
+        else
+            unwrap_output(input, projector.H2, projector.map_x, projector.map_y, projector.output);
+    });
+    for (auto& projector : projectors)
+        projector.m_output_view->setImage(projector.output);
+}
+
+static QScreen* projector_screen(int index, int count)
+{
+    // The projectors are the last screens, from left to right
+    auto screens = QGuiApplication::screens();
+    return screens[std::max(0, (int)screens.size() - count + index)];
+}
+
+void QCalibrationApp::setProjectorCount(int count)
+{
+    count = std::clamp(count, 1, MAX_PROJECTORS);
+    auto& projectors = m_impl->projectors;
+    if ((int)projectors.size() == count)
+        return;
+
+    while ((int)projectors.size() > count)
+    {
+        for (auto c : projectors.back().m_control_mire)
+        {
+            m_impl->lscene->removeItem(c);
+            delete c;
+        }
+        delete projectors.back().m_output_view;
+        projectors.pop_back();
+    }
+    while ((int)projectors.size() < count)
+    {
+        ProjectorOutput projector;
+        int index = projectors.size();
+        Qt::GlobalColor color = PROJECTOR_COLORS[index];
+        auto moved = [this, index]() { recompute_homography(index); };
+        projector.m_control_mire = {
+            new QControl(moved, color, 10, 10),
+            new QControl(moved, color, 630, 10),
+            new QControl(moved, color, 630, 470),
+            new QControl(moved, color, 10, 470),
+        };
+        for (auto c : projector.m_control_mire)
+        {
+            m_impl->lscene->addItem(c);
+            c->hide();
+        }
+        projector.m_output_view = new QRasterView(this);
+        projectors.push_back(std::move(projector));
+    }
+
+    for (int i = 0; i < count; ++i)
+    {
+        QRasterView* view = projectors[i].m_output_view;
+        view->move(projector_screen(i, count)->geometry().topLeft());
+        view->setVisible(!(m_impl->m_output_depth->isChecked() && m_impl->m_output_gpu->isChecked()));
+    }
+    m_impl->m_gl_view->move(projector_screen(0, count)->geometry().topLeft());
+
+    // The shader warps the frame for a single projector: the others would stay black
+    m_impl->m_output_gpu->setEnabled(count == 1);
+    m_impl->m_output_gpu->setToolTip(count == 1 ? "" : "The GPU output drives a single projector");
+    if (count > 1 && m_impl->m_output_gpu->isChecked())
+    {
+        std::cerr << "GPU output disabled: it drives a single projector, " << count << " are set" << std::endl;
+        m_impl->m_output_gpu->setChecked(false);
+    }
+
+    // The tables no longer match the projectors
+    m_impl->tables = calibration_tables();
+
+    QSignalBlocker count_blocker(m_impl->m_projector_count);
+    m_impl->m_projector_count->setValue(count);
+    QSignalBlocker menu_blocker(m_impl->m_projector_menu);
+    m_impl->m_projector_menu->clear();
+    for (int i = 0; i < count; ++i)
+        m_impl->m_projector_menu->addItem(QString("Projector %1").arg(i + 1));
+    m_impl->current_projector = std::min(m_impl->current_projector, count - 1);
+    m_impl->m_projector_menu->setCurrentIndex(m_impl->current_projector);
+
+    // Show the handles of the projector being calibrated
+    if (m_impl->m_calibration_menu->currentIndex() == 1)
+        onCalibrationMenuChanged(1);
+}
+
+static QImage mat_to_qimage(const cv::Mat& pattern)
+{
+    return QImage(pattern.data, pattern.cols, pattern.rows, pattern.step, QImage::Format_Grayscale8);
+}
+
+void QCalibrationApp::startStructuredLight()
+{
+    m_impl->sl_patterns = generate_graycode_patterns(PROJECTOR_WIDTH, PROJECTOR_HEIGHT);
+    m_impl->sl_captures.clear();
+    m_impl->sl_index = 0;
+    m_impl->sl_wait = 0;
+    m_impl->m_calibration_view->setImage(mat_to_qimage(m_impl->sl_patterns[0]));
+    m_impl->m_calibration_view->show();
+    updateSinks();
+}
+
+void QCalibrationApp::onStructuredLightFrame(const cv::Mat& input)
+{
+    if (++m_impl->sl_wait <= STRUCTURED_LIGHT_SETTLE_FRAMES)
+        return;
+
+    m_impl->sl_wait = 0;
+    m_impl->sl_captures.push_back(input.clone());
+
+    if (++m_impl->sl_index < (int)m_impl->sl_patterns.size())
+    {
+        m_impl->m_calibration_view->setImage(mat_to_qimage(m_impl->sl_patterns[m_impl->sl_index]));
+        return;
+    }
+
+    // All the patterns have been captured
+    m_impl->sl_index = -1;
+    updateSinks();
+    m_impl->m_calibration_view->hide();
+    m_impl->m_calibration_view->setImage(get_calibration_image(PROJECTOR_WIDTH, PROJECTOR_HEIGHT));
+
+    auto start = std::chrono::steady_clock::now();
+    try
+    {
+        cv::Mat proj_x, proj_y, valid;
+        decode_graycode(m_impl->sl_captures, PROJECTOR_WIDTH, PROJECTOR_HEIGHT, proj_x, proj_y, valid);
+        ProjectorOutput& projector = m_impl->projectors[m_impl->current_projector];
+        build_projector_map(proj_x, proj_y, valid, PROJECTOR_WIDTH, PROJECTOR_HEIGHT, m_impl->H1, projector.map_x, projector.map_y);
+        // The tables (and edge blending) are rebuilt when the presets are saved
+        m_impl->tables = calibration_tables();
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+        std::cout << "Structured light: " << cv::countNonZero(valid) << " pixels decoded in " << elapsed.count() << "ms" << std::endl;
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+    }
+    m_impl->sl_captures.clear();
+    m_impl->sl_patterns.clear();
 }
 /*
 void QCalibrationApp::onCalibrationMenuChanged(int index)
@@ -230,15 +1044,27 @@ void QCalibrationApp::onCalibrationMenuChanged(int index)
     {
         c->hide();
     }
-    for (auto &c : m_impl->m_control_mire)
+    for (auto &projector : m_impl->projectors)
     {
-        c->hide();
+        for (auto &c : projector.m_control_mire)
+        {
+            c->hide();
+        }
     }
     for (auto &c : m_impl->m_control_depth)
     {
         c->hide();
     }
     m_impl->m_calibration_view->hide();
+    // The calibration image and the patterns go to the projector being calibrated
+    int count = (int)m_impl->projectors.size();
+    m_impl->m_calibration_view->move(projector_screen(m_impl->current_projector, count)->geometry().topLeft());
+    if (m_impl->sl_index >= 0)
+    {
+        m_impl->sl_index = -1;
+        m_impl->m_calibration_view->setImage(get_calibration_image(PROJECTOR_WIDTH, PROJECTOR_HEIGHT));
+        updateSinks();
+    }
 
     switch (index)
     {
@@ -249,7 +1075,7 @@ void QCalibrationApp::onCalibrationMenuChanged(int index)
             }
         break;
         case 1:
-            for (auto &c : m_impl->m_control_mire)
+            for (auto &c : m_impl->projectors[m_impl->current_projector].m_control_mire)
             {
                 c->show();
             }
@@ -261,15 +1087,25 @@ void QCalibrationApp::onCalibrationMenuChanged(int index)
                 c->show();
             }
         break;
+        case 3:
+            startStructuredLight();
+        break;
     }
 }
 
 
-QCalibrationApp::~QCalibrationApp() = default;
+QCalibrationApp::~QCalibrationApp()
+{
+    // The capture callbacks use the mailboxes, the recorder and the black box: the capture thread
+    // is joined before any member of m_impl (declared after the capture) is destroyed
+    m_impl->capture.stop();
+}
 
 QCalibrationApp::QCalibrationApp(QWidget* parent) : QMainWindow(parent)
 {
     m_impl = std::make_unique<QCalibrationAppImpl>();
+    // Until a preset is applied (none, or it fails to load)
+    m_impl->preview_renderer.set_style(preview_style(m_impl->style));
     m_impl->rgb = new QGraphicsPixmapItem();
     m_impl->unwrapped = new QGraphicsPixmapItem();
     m_impl->depth = new QGraphicsPixmapItem();
@@ -282,26 +1118,23 @@ QCalibrationApp::QCalibrationApp(QWidget* parent) : QMainWindow(parent)
     m_impl->rscene = new QGraphicsScene();
 
     m_impl->m_control_box.resize(4);
-    m_impl->m_control_box[0] = new QControl(this, Qt::red, 10, 10);
-    m_impl->m_control_box[1] = new QControl(this, Qt::red, 630, 10);
-    m_impl->m_control_box[2] = new QControl(this, Qt::red, 630, 470);
-    m_impl->m_control_box[3] = new QControl(this, Qt::red, 10, 470);
-    
-    m_impl->m_control_mire.resize(4);
-    m_impl->m_control_mire[0] = new QControl(this, Qt::green, 10, 10);
-    m_impl->m_control_mire[1] = new QControl(this, Qt::green, 630, 10);
-    m_impl->m_control_mire[2] = new QControl(this, Qt::green, 630, 470);
-    m_impl->m_control_mire[3] = new QControl(this, Qt::green, 10, 470);
+    // H1 changes: every projector drops its dense map
+    auto box_moved = [this]() { recompute_homography(); };
+    m_impl->m_control_box[0] = new QControl(box_moved, Qt::red, 10, 10);
+    m_impl->m_control_box[1] = new QControl(box_moved, Qt::red, 630, 10);
+    m_impl->m_control_box[2] = new QControl(box_moved, Qt::red, 630, 470);
+    m_impl->m_control_box[3] = new QControl(box_moved, Qt::red, 10, 470);
 
     m_impl->m_control_depth.resize(2);
-    m_impl->m_control_depth[0] = new QControl(this, Qt::blue, 50, 230);
-    m_impl->m_control_depth[1] = new QControl(this, Qt::blue, 590, 230);
+    // Read when the depth is calibrated: moving them changes neither H1, H2 nor the maps
+    m_impl->m_control_depth[0] = new QControl(nullptr, Qt::blue, 50, 230);
+    m_impl->m_control_depth[1] = new QControl(nullptr, Qt::blue, 590, 230);
 
     m_impl->lscene->addItem(m_impl->rgb);
     m_impl->cscene->addItem(m_impl->unwrapped);
     m_impl->rscene->addItem(m_impl->depth);
 
-    for (auto& controlers : {m_impl->m_control_box, m_impl->m_control_mire, m_impl->m_control_depth})
+    for (auto& controlers : {m_impl->m_control_box, m_impl->m_control_depth})
         for (auto& c : controlers) {
             m_impl->lscene->addItem(c);
             c->hide();
@@ -322,88 +1155,151 @@ QCalibrationApp::QCalibrationApp(QWidget* parent) : QMainWindow(parent)
     layout->addWidget(m_impl->rview);
     this->setCentralWidget(central);
 
+    // Stage latencies, drawn over the previews
+    m_impl->m_stats_overlay = new QLabel(central);
+    m_impl->m_stats_overlay->setFont(QFontDatabase::systemFont(QFontDatabase::FixedFont));
+    m_impl->m_stats_overlay->setStyleSheet("QLabel { background-color: rgba(0, 0, 0, 160); color: white; padding: 6px; }");
+    m_impl->m_stats_overlay->setAttribute(Qt::WA_TransparentForMouseEvents);
+    m_impl->m_stats_overlay->move(10, 10);
+    m_impl->m_stats_overlay->hide();
 
 
-    m_impl->capture.set_rgb_callback([&](cv::Mat& input, uint32_t timestamp) {
-        QImage image(input.data, input.cols, input.rows, input.step, QImage::Format_RGB888);
-        m_impl->rgb->setPixmap(QPixmap::fromImage(image));
-        m_impl->lscene->setSceneRect(image.rect());
 
-        cv::Mat W = (m_impl->H1.empty()) ? input : unwrap(input, m_impl->H1);
-        cv::Mat transformed = (m_onRGBFrameChange) ? m_onRGBFrameChange(W) : W;
-        cv::Mat output = (m_impl->H2.empty()) ? transformed : unwrap(transformed, m_impl->H2);
-        {
-            auto& to_disp = m_impl->m_output_choice->isChecked() ? output : transformed;
-            QImage unwrapped_image(to_disp.data, to_disp.cols, to_disp.rows, to_disp.step, QImage::Format_RGB888);
-            m_impl->unwrapped->setPixmap(QPixmap::fromImage(unwrapped_image));
-            m_impl->cscene->setSceneRect(unwrapped_image.rect());
-        }
-        if (!m_impl->m_output_depth->isChecked())
-        {
-            QImage image(output.data, output.cols, output.rows, output.step, QImage::Format_RGB888);
-            m_impl->m_output_view->setImage(image);
-        }
-    });
-
-    m_impl->capture.set_depth_callback([&](cv::Mat& depth, uint32_t timestamp) {
+    trace_thread_name("qt-main");
+    apply_thread_policy(thread_role::DISPLAY, "qt-main");
+    buildPipelines();
 
-        if (!m_onDepthFrameChange)
+    // The capture thread only hands the frames over: the UI never waits for the device
+    m_impl->capture.set_rgb_callback([this](cv::Mat& input, uint32_t timestamp) {
+        if (!m_impl->rgb_consumed)
             return;
+        if (m_impl->rgb_mailbox.put(input, timestamp))
+            QMetaObject::invokeMethod(this, [this]() { processRGBFrame(); }, Qt::QueuedConnection);
+    });
+    m_impl->capture.set_depth_callback([this](cv::Mat& depth, uint32_t timestamp) {
+        if (m_impl->depth_mailbox.put(depth, timestamp, depth_frame_arrival()))
+            QMetaObject::invokeMethod(this, [this]() { processDepthFrame(); }, Qt::QueuedConnection);
+    });
+    m_impl->capture.set_state_callback([this](AsyncKinectCapture::state state) {
+        QMetaObject::invokeMethod(this, [this, state]() { setSensorState(state); }, Qt::QueuedConnection);
+    });
 
-        auto depth16 = (cv::Mat_<uint16_t>)depth;
-
+    // Previews are refreshed at a lower rate, independently of the projector output
+    m_impl->m_preview_timer = new QTimer(this);
+    connect(m_impl->m_preview_timer, &QTimer::timeout, this, &QCalibrationApp::refreshPreviews);
+    updatePreviewRate();
+
+    // Black box: 60 s in 512 MB by default (about 290 MB of depth a minute), configurable at startup
+    const char* black_box_seconds = std::getenv("KINECT_BLACKBOX_SECONDS");
+    const char* black_box_mb = std::getenv("KINECT_BLACKBOX_MB");
+    const char* black_box_rgb = std::getenv("KINECT_BLACKBOX_RGB");
+    double seconds = (black_box_seconds != nullptr) ? std::atof(black_box_seconds) : BlackBoxRecorder::DEFAULT_SECONDS;
+    double megabytes = (black_box_mb != nullptr) ? std::atof(black_box_mb) : BlackBoxRecorder::DEFAULT_MAX_BYTES / double(1 << 20);
+    m_impl->black_box_enabled = seconds > 0 && megabytes > 0;
+    m_impl->black_box_rgb = black_box_rgb != nullptr && std::string(black_box_rgb) == "1";
+    if (m_impl->black_box_enabled)
+    {
+        m_impl->black_box.set_limits(seconds, (size_t)(megabytes * (1 << 20)));
+        std::signal(SIGUSR1, on_blackbox_signal);
+    }
 
-        if (m_impl->calibrate_depth)
+    QTimer* stats_timer = new QTimer(this);
+    connect(stats_timer, &QTimer::timeout, [this]() {
+        auto& impl = *m_impl;
+        if (blackbox_signal)
         {
-            m_impl->calibrate_depth = false;
-            auto p1 = m_impl->m_control_depth[0]->scenePos();
-            auto p2 = m_impl->m_control_depth[1]->scenePos();
-            auto q1 = cv::Point2f(p1.x() + CONTROL_SIZE / 2, p1.y() + CONTROL_SIZE / 2);
-            auto q2 = cv::Point2f(p2.x() + CONTROL_SIZE / 2, p2.y() + CONTROL_SIZE / 2);
-            uint16_t d1 = depth16.at<uint16_t>(q1);
-            uint16_t d2 = depth16.at<uint16_t>(q2);
-            std::tie(m_impl->min_depth, m_impl->max_depth) = std::minmax(d1, d2);
-            std::cout << "Depth calibration: " << m_impl->min_depth << " " << m_impl->max_depth << std::endl;
+            blackbox_signal = 0;
+            dumpBlackBox();
         }
-
-        // 1. Wrap with H1
-        cv::Mat W = (m_impl->H1.empty()) ? depth : unwrap(depth, m_impl->H1);
-
-        if (m_impl->saved_requested)
+        impl.metric_min_depth.set(impl.min_depth);
+        impl.metric_max_depth.set(impl.max_depth);
+        impl.metric_box.set(!impl.H1.empty());
+        const ProjectorOutput& projector = impl.projectors.front();
+        impl.metric_projector.set(!projector.map_x.empty() ? 2 : !projector.H2.empty() ? 1 : 0);
+        impl.metric_projectors.set((double)impl.projectors.size());
+
+        BlackBoxRecorder::stats box;
+        if (impl.black_box_enabled)
         {
-            m_impl->saved_requested = false;
-            cv::imwrite("output.png", W);
+            box = impl.black_box.statistics();
+            // Said once each time the memory budget starts to cut the duration short
+            if (box.byte_limited && !impl.black_box_byte_limited)
+                std::cerr << "Black box: the memory budget only holds " << box.seconds << " s, raise KINECT_BLACKBOX_MB" << std::endl;
+            impl.black_box_byte_limited = box.byte_limited;
         }
 
-        cv::Mat depth_rgb = m_onDepthFrameChange(W, m_impl->min_depth, m_impl->max_depth);
-        cv::Mat out = (m_impl->H2.empty()) ? depth_rgb : unwrap(depth_rgb, m_impl->H2);
-
-
+        if (!m_impl->m_stats_overlay->isVisible())
+            return;
+        std::string quality = std::string("quality: ") + quality_level_name(impl.governor.level()) + "\n";
+        if (impl.black_box_enabled)
         {
-            QImage image(depth_rgb.data, depth_rgb.cols, depth_rgb.rows, depth_rgb.step, QImage::Format_RGB888);
-            m_impl->depth->setPixmap(QPixmap::fromImage(image));
-            m_impl->rscene->setSceneRect(image.rect());
+            char line[128];
+            std::snprintf(line, sizeof(line), "black box: %.1f s, %zu frames, %.1f MB (%.1fx)%s\n", box.seconds, box.frames,
+                          box.bytes / double(1 << 20), box.bytes > 0 ? box.raw_bytes / double(box.bytes) : 0.,
+                          box.byte_limited ? ", memory bound" : "");
+            quality += line;
         }
+        m_impl->m_stats_overlay->setText(QString::fromStdString(quality + profiling_report()));
+        m_impl->m_stats_overlay->adjustSize();
+    });
+    stats_timer->start(STATS_OVERLAY_PERIOD_MS);
 
-        if (m_impl->m_output_depth->isChecked())
+    QTimer* stats_log_timer = new QTimer(this);
+    connect(stats_log_timer, &QTimer::timeout, []() {
         {
-            QImage image(out.data, out.cols, out.rows, out.step, QImage::Format_RGB888);
-            m_impl->m_output_view->setImage(image);
+            std::ofstream log(STATS_LOG_FILE, std::ios::app);
+            log << QDateTime::currentDateTime().toString(Qt::ISODate).toStdString() << '\n' << profiling_report() << std::endl;
+            if (log.tellp() < STATS_LOG_MAX_BYTES)
+                return;
         }
+        std::rename(STATS_LOG_FILE, (std::string(STATS_LOG_FILE) + ".1").c_str());
     });
+    stats_log_timer->start(STATS_LOG_PERIOD_MS);
 
-    QTimer* timer = new QTimer(this);
-    connect(timer, &QTimer::timeout, this, &QCalibrationApp::peek_frame);
-    timer->start(10);
+    const char* metrics_socket = std::getenv("KINECT_METRICS_SOCKET");
+    std::string metrics_path = (metrics_socket != nullptr) ? metrics_socket : METRICS_SOCKET;
+    if (!metrics_path.empty())
+    {
+        try
+        {
+            m_impl->metrics_server.start(metrics_path);
+            std::cout << "Metrics served on " << metrics_path << std::endl;
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << e.what() << std::endl;
+        }
+    }
 
     QToolBar *toolbar = this->addToolBar("Calibration");
 
     QComboBox* calibrartion_menu = new QComboBox();
+    m_impl->m_calibration_menu = calibrartion_menu;
     calibrartion_menu->addItem("Box");
     calibrartion_menu->addItem("Mire");
     calibrartion_menu->addItem("Depth");
+    calibrartion_menu->addItem("Structured Light");
     m_impl->m_output_choice = new QCheckBox("Real output");
     m_impl->m_output_depth = new QCheckBox("Output Depth Map");
+    m_impl->m_output_gpu = new QCheckBox("GPU Output");
+    m_impl->m_preview_enabled = new QCheckBox("Previews");
+    m_impl->m_preview_enabled->setChecked(true);
+    auto stats_button = new QCheckBox("Stats");
+    auto trace_button = new QCheckBox("Trace");
+    trace_button->setChecked(is_tracing_enabled());
+    auto preview_fps = new QSpinBox();
+    preview_fps->setRange(1, 30);
+    preview_fps->setValue(DEFAULT_PREVIEW_FPS);
+    preview_fps->setSuffix(" fps");
+    auto target_fps = new QSpinBox();
+    target_fps->setRange(10, 30);
+    target_fps->setValue(DEFAULT_TARGET_FPS);
+    target_fps->setPrefix("target ");
+    target_fps->setSuffix(" fps");
+    m_impl->m_projector_count = new QSpinBox();
+    m_impl->m_projector_count->setRange(1, MAX_PROJECTORS);
+    m_impl->m_projector_count->setSuffix(" projector(s)");
+    m_impl->m_projector_menu = new QComboBox();
     auto zoom_slider = new QSlider(Qt::Horizontal);
     zoom_slider->setMinimum(1);
     zoom_slider->setMaximum(5);
@@ -420,18 +1316,36 @@ QCalibrationApp::QCalibrationApp(QWidget* parent) : QMainWindow(parent)
     auto load_presets_button = new QPushButton("Load Presets");
     // Save output button
     auto save_output_button = new QPushButton("Save Output");
+    // Record the raw depth stream
+    auto record_button = new QCheckBox("Record");
+    // Write the last seconds of the streams (also on SIGUSR1)
+    auto black_box_button = new QPushButton("Dump Black Box");
+    black_box_button->setEnabled(m_impl->black_box_enabled);
+    m_impl->m_sensor_status = new QLabel();
+    setSensorState(AsyncKinectCapture::WAITING);
 
 
 
     toolbar->addWidget(m_impl->m_output_choice);
     toolbar->addWidget(m_impl->m_output_depth);
+    toolbar->addWidget(m_impl->m_output_gpu);
+    toolbar->addWidget(m_impl->m_preview_enabled);
+    toolbar->addWidget(preview_fps);
+    toolbar->addWidget(target_fps);
+    toolbar->addWidget(stats_button);
+    toolbar->addWidget(trace_button);
     toolbar->addWidget(calibrartion_menu);
+    toolbar->addWidget(m_impl->m_projector_count);
+    toolbar->addWidget(m_impl->m_projector_menu);
     toolbar->addWidget(zoom_slider); 
     toolbar->addWidget(depth_calibration_button);
     toolbar->addWidget(mirror_button);
     toolbar->addWidget(save_presets_button);
     toolbar->addWidget(load_presets_button);
     toolbar->addWidget(save_output_button);
+    toolbar->addWidget(record_button);
+    toolbar->addWidget(black_box_button);
+    toolbar->addWidget(m_impl->m_sensor_status);
 
 
 
@@ -440,8 +1354,39 @@ QCalibrationApp::QCalibrationApp(QWidget* parent) : QMainWindow(parent)
         view->resetTransform();
         view->scale(value, value);
     });
+    connect(m_impl->m_projector_menu, &QComboBox::currentIndexChanged, [this, calibrartion_menu](int index) {
+        if (index < 0)
+            return;
+        m_impl->current_projector = index;
+        onCalibrationMenuChanged(calibrartion_menu->currentIndex());
+    });
+    // The GPU path only renders the depth map, for a single projector (see setProjectorCount)
+    auto update_output_views = [this]() {
+        bool gpu = m_impl->m_output_depth->isChecked() && m_impl->m_output_gpu->isChecked();
+        for (auto& projector : m_impl->projectors)
+            projector.m_output_view->setVisible(!gpu);
+        m_impl->m_gl_view->setVisible(gpu);
+    };
+    connect(m_impl->m_output_gpu, &QCheckBox::toggled, update_output_views);
+    connect(m_impl->m_output_depth, &QCheckBox::toggled, update_output_views);
+    for (auto checkbox : {m_impl->m_output_choice, m_impl->m_output_depth, m_impl->m_output_gpu})
+        connect(checkbox, &QCheckBox::toggled, this, &QCalibrationApp::updateSinks);
+    connect(stats_button, &QCheckBox::toggled, m_impl->m_stats_overlay, &QLabel::setVisible);
+    connect(trace_button, &QCheckBox::toggled, [](bool checked) {
+        set_tracing_enabled(checked);
+        if (!checked && write_trace(TRACE_FILE))
+            std::cout << "Trace written to " << TRACE_FILE << std::endl;
+    });
+    connect(preview_fps, &QSpinBox::valueChanged, [this](int fps) {
+        m_impl->preview_fps = fps;
+        updatePreviewRate();
+    });
+    connect(target_fps, &QSpinBox::valueChanged, [this](int fps) {
+        m_impl->governor.set_target_fps(fps);
+    });
     connect(depth_calibration_button, &QPushButton::clicked, [this]() {
         m_impl->calibrate_depth = true;
+        updateSinks();
     });
     connect(mirror_button, &QCheckBox::toggled, [this](bool checked) {
         m_impl->mirror_output = checked;
@@ -449,20 +1394,71 @@ QCalibrationApp::QCalibrationApp(QWidget* parent) : QMainWindow(parent)
     });
     connect(save_presets_button, &QPushButton::clicked, this, (void(QCalibrationApp::*)()) &QCalibrationApp::savePresets);
     connect(load_presets_button, &QPushButton::clicked, this, (void(QCalibrationApp::*)()) &QCalibrationApp::loadPresets);
-    connect(save_output_button, &QPushButton::clicked, [this]() { this->m_impl->saved_requested = true; });
+    connect(save_output_button, &QPushButton::clicked, [this]() {
+        this->m_impl->saved_requested = true;
+        updateSinks();
+    });
+    connect(black_box_button, &QPushButton::clicked, this, &QCalibrationApp::dumpBlackBox);
+    connect(record_button, &QCheckBox::toggled, [this](bool checked) {
+        if (checked)
+        {
+            try
+            {
+                m_impl->recorder.open(RECORDING_FILE);
+            }
+            catch (const std::exception& e)
+            {
+                std::cerr << e.what() << std::endl;
+            }
+        }
+        else
+        {
+            m_impl->recorder.close();
+            std::cout << "Recording: " << m_impl->recorder.frame_count() << " frames written to " << RECORDING_FILE << std::endl;
+        }
+        updateSinks();
+    });
 
 
     m_impl->capture.start();
 
     // Display the calibration image on the second screen
-    auto calibration_image = get_calibration_image(640, 480);
+    auto calibration_image = get_calibration_image(PROJECTOR_WIDTH, PROJECTOR_HEIGHT);
     m_impl->m_calibration_view = new QFullscreenView(&calibration_image, this);
     m_impl->m_calibration_view->move(QGuiApplication::screens().last()->geometry().topLeft());
     m_impl->m_calibration_view->hide();
 
-    m_impl->m_output_view = new QFullscreenView(nullptr, this);
-    m_impl->m_output_view->move(QGuiApplication::screens().last()->geometry().topLeft());
-    m_impl->m_output_view->show();
+    m_impl->m_gl_view = new QGLDepthView(this);
+    m_impl->m_gl_view->hide();
+
+    // One output view per projector, on the last screens (the presets may change the count)
+    const char* projectors = std::getenv("KINECT_PROJECTORS");
+    setProjectorCount((projectors != nullptr) ? std::atoi(projectors) : 1);
+    connect(m_impl->m_projector_count, &QSpinBox::valueChanged, this, &QCalibrationApp::setProjectorCount);
+
+    updateSinks();
+}
+
+void QCalibrationApp::showEvent(QShowEvent* event)
+{
+    QMainWindow::showEvent(event);
+    if (m_impl->preset_watcher != nullptr)
+        return;
+
+    // After setPresetName(): load the presets (from the cache) and follow their changes
+    m_impl->preset_reload_timer = new QTimer(this);
+    m_impl->preset_reload_timer->setSingleShot(true);
+    connect(m_impl->preset_reload_timer, &QTimer::timeout, this, &QCalibrationApp::reloadPresets);
+
+    m_impl->preset_watcher = new QFileSystemWatcher(this);
+    connect(m_impl->preset_watcher, &QFileSystemWatcher::fileChanged, [this]() {
+        m_impl->preset_reload_timer->start(PRESET_RELOAD_DELAY_MS);
+    });
+
+    QString preset_filename = QString::fromStdString(m_impl->preset_filename);
+    if (QFileInfo::exists(preset_filename))
+        loadPresets();
+    m_impl->preset_watcher->addPath(preset_filename);
 }
 
 
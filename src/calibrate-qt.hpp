@@ -4,6 +4,12 @@
 // OpenCV includes
 #include <opencv2/core.hpp>
 
+#include "quality.hpp"
+#include "utils.hpp"
+
+struct cached_calibration;
+struct palette;
+
 class QCalibrationApp : public QMainWindow
 {
     public:
@@ -21,21 +27,63 @@ class QCalibrationApp : public QMainWindow
             m_onRGBFrameChange = onRGBFrameChange;
         }
 
+        // Called when the quality governor changes the rendering options of the depth map
+        void setOnQualityChange(std::function<void(const render_quality&)> onQualityChange)
+        {
+            m_onQualityChange = onQualityChange;
+        }
+
+        // Called when the rendering parameters of the preset file change
+        void setOnStyleChange(std::function<void(const terrain_style&)> onStyleChange)
+        {
+            m_onStyleChange = onStyleChange;
+        }
+
         void setPresetName(std::string_view filename);
         void savePresets();
         void loadPresets();
 
+    protected:
+        void showEvent(QShowEvent* event) override;
+
 
     private:
-        friend class QControl;
         struct QCalibrationAppImpl;
 
-        void peek_frame();
-        void recompute_homography();
+        void processRGBFrame();
+        void processDepthFrame();
+        void setSensorState(int state);
+        // moved_projector: the projector whose handles moved, -1 when H1 (or all the quads) changed
+        void recompute_homography(int moved_projector = -1);
         void onCalibrationMenuChanged(int);
+        void startStructuredLight();
+        void onStructuredLightFrame(const cv::Mat& input);
+        cv::Mat unwrapBox(const cv::Mat& input) const;
+        bool projectorTablesValid(const cv::Size& size) const;
+        // Output of the projector being calibrated (previews)
+        cv::Mat project(const cv::Mat& input) const;
+        // Warp a frame in table space into every projector and display it
+        void presentProjectors(const cv::Mat& input);
+        void setProjectorCount(int count);
+        void reloadPresets();
+        // colors: palette of the presets, loaded with them (nullptr: default palette)
+        void applyCalibration(const cached_calibration& cached, std::shared_ptr<const palette> colors);
+        // Write the black box to a new recording, in the background
+        void dumpBlackBox();
+
+        bool previewsActive() const;
+        // frame_scale: resolution of the frame relative to the camera frames
+        void setPreview(int panel, const cv::Mat& frame, double frame_scale = 1.);
+        void refreshPreviews();
+        void updatePreviewRate();
+        void applyQuality();
+        void buildPipelines();
+        void updateSinks();
 
         std::unique_ptr<QCalibrationAppImpl> m_impl;
         std::function<cv::Mat(cv::Mat, int, int)> m_onDepthFrameChange;
         std::function<cv::Mat(cv::Mat)> m_onRGBFrameChange;
+        std::function<void(const render_quality&)> m_onQualityChange;
+        std::function<void(const terrain_style&)> m_onStyleChange;
 };
 
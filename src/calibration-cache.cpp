@@ -0,0 +1,500 @@
+#include "calibration-cache.hpp"
+#include "pipelined-executor.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <opencv2/imgproc.hpp>
+
+static const char CACHE_MAGIC[4] = {'K', 'C', 'A', 'L'};
+constexpr static uint32_t CACHE_VERSION = 8;
+// Alignment of the matrices in the cache file
+constexpr static uint64_t CACHE_ALIGNMENT = 64;
+// Upper bound of the projector count read from a cache file
+constexpr static uint32_t CACHE_MAX_PROJECTORS = 64;
+// Response of the projectors: the pixel values are gamma encoded, the light adds up linearly
+constexpr static double PROJECTOR_GAMMA = 2.2;
+
+/// Matrices stored in the cache, in this order
+enum cache_entry
+{
+    ENTRY_H1,
+    ENTRY_POINTS_BOX,
+    ENTRY_POINTS_DEPTH,
+    ENTRY_H1_MAP1,
+    ENTRY_H1_MAP2,
+    ENTRY_PALETTE,      // terrain_style::palette, as a row of characters
+    BASE_ENTRIES
+};
+
+/// Matrices of each projector, stored after the base entries
+enum cache_projector_entry
+{
+    ENTRY_H2,
+    ENTRY_MAP_X,
+    ENTRY_MAP_Y,
+    ENTRY_POINTS_MIRE,
+    ENTRY_OUTPUT_MAP1,
+    ENTRY_OUTPUT_MAP2,
+    ENTRY_BLEND,
+    PROJECTOR_ENTRIES
+};
+
+/// \brief Header of a cache file (native endianness, the cache is not meant to be moved)
+///
+/// Followed by `entries` cache_mat descriptors (BASE_ENTRIES + PROJECTOR_ENTRIES per
+/// projector), then the data of the matrices.
+struct cache_header
+{
+    char magic[4];
+    uint32_t version;
+    uint64_t key;           // Hash of the preset file
+    int32_t width;          // Frame size of the tables
+    int32_t height;
+    int32_t min_depth;
+    int32_t max_depth;
+    int32_t contour_step;
+    float shading_strength;
+    uint32_t entries;
+    uint32_t projectors;
+    int32_t hole_mode;      // terrain_style::holes
+    float smoothing_radius;
+    float smoothing_range;
+    float water_rain;
+    float water_evaporation;
+    int32_t occlusion_height;
+    int32_t occlusion_motion;
+};
+static_assert(sizeof(cache_header) == 72, "cache_header must be packed");
+
+struct cache_mat
+{
+    int32_t type;
+    int32_t rows;
+    int32_t cols;
+    int32_t reserved;
+    uint64_t offset;        // From the beginning of the file, 0 for an empty matrix
+};
+static_assert(sizeof(cache_mat) == 24, "cache_mat must be packed");
+
+
+static std::string cache_filename(const std::string& filename)
+{
+    return filename + ".cache";
+}
+
+// FNV-1a of the preset file content
+static uint64_t hash_file(const std::string& filename)
+{
+    std::ifstream file(filename, std::ios::binary);
+    if (!file)
+        throw std::runtime_error("Failed to open calibration " + filename);
+
+    uint64_t hash = 14695981039346656037ull;
+    char buffer[65536];
+    while (file.read(buffer, sizeof(buffer)) || file.gcount() > 0)
+    {
+        for (std::streamsize i = 0; i < file.gcount(); ++i)
+        {
+            hash ^= (uint8_t)buffer[i];
+            hash *= 1099511628211ull;
+        }
+    }
+    return hash;
+}
+
+
+// Same coordinates as cv::warpPerspective: each output pixel samples the input at H^-1 (x, y)
+static void homography_maps(const cv::Mat& H, cv::Size size, cv::Mat& map_x, cv::Mat& map_y)
+{
+    cv::Matx33d M = cv::Matx33d(cv::Mat(H.inv()));
+    map_x.create(size, CV_32FC1);
+    map_y.create(size, CV_32FC1);
+    for (int y = 0; y < size.height; ++y)
+    {
+        float* mx = map_x.ptr<float>(y);
+        float* my = map_y.ptr<float>(y);
+        for (int x = 0; x < size.width; ++x)
+        {
+            double w = M(2, 0) * x + M(2, 1) * y + M(2, 2);
+            w = (w != 0) ? 1. / w : 0.;
+            mx[x] = (float)((M(0, 0) * x + M(0, 1) * y + M(0, 2)) * w);
+            my[x] = (float)((M(1, 0) * x + M(1, 1) * y + M(1, 2)) * w);
+        }
+    }
+}
+
+static void homography_tables(const cv::Mat& H, cv::Size size, cv::Mat& map1, cv::Mat& map2)
+{
+    cv::Mat map_x, map_y;
+    homography_maps(H, size, map_x, map_y);
+    cv::convertMaps(map_x, map_y, map1, map2, CV_16SC2);
+}
+
+// Table points sampled by the pixels of a projector
+static cv::Mat projector_coverage(const cv::Mat& map_x, const cv::Mat& map_y, cv::Size table_size)
+{
+    cv::Mat coverage = cv::Mat::zeros(table_size, CV_8UC1);
+    for (int y = 0; y < map_x.rows; ++y)
+    {
+        const float* mx = map_x.ptr<float>(y);
+        const float* my = map_y.ptr<float>(y);
+        for (int x = 0; x < map_x.cols; ++x)
+        {
+            int tx = cvRound(mx[x]);
+            int ty = cvRound(my[x]);
+            if (tx >= 0 && ty >= 0 && tx < table_size.width && ty < table_size.height)
+                coverage.at<uint8_t>(ty, tx) = 255;
+        }
+    }
+    // Fill the gaps between the samples when the projector has fewer pixels than the table
+    cv::morphologyEx(coverage, coverage, cv::MORPH_CLOSE, cv::getStructuringElement(cv::MORPH_RECT, cv::Size(5, 5)));
+    return coverage;
+}
+
+// Cross-fade of the overlapping projectors (maps_x[i], maps_y[i]: float maps of projector i)
+static void build_blend(const std::vector<cv::Mat>& maps_x, const std::vector<cv::Mat>& maps_y, cv::Size table_size,
+                        std::vector<projector_tables>& projectors)
+{
+    size_t count = projectors.size();
+    std::vector<cv::Mat> distances(count);
+    cv::Mat total = cv::Mat::zeros(table_size, CV_32FC1);
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (maps_x[i].empty())
+            continue;
+        cv::distanceTransform(projector_coverage(maps_x[i], maps_y[i], table_size), distances[i], cv::DIST_L2, 3);
+        total += distances[i];
+    }
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (maps_x[i].empty())
+            continue;
+        // 0 where no projector covers the table (division by zero)
+        cv::Mat weight, blend;
+        cv::divide(distances[i], total, weight);
+        cv::remap(weight, blend, maps_x[i], maps_y[i], cv::INTER_LINEAR, cv::BORDER_CONSTANT, cv::Scalar(0));
+        // The weights sum to 1 in light: a pixel scaled by w^(1/gamma) emits w of its light
+        cv::pow(blend, 1. / PROJECTOR_GAMMA, blend);
+        blend.convertTo(blend, CV_8U, 255);
+
+        // Alone on its whole area: nothing to blend
+        if (cv::countNonZero((blend > 0) & (blend < 255)) == 0)
+            continue;
+        cv::merge(std::vector<cv::Mat>{blend, blend, blend}, projectors[i].blend);
+    }
+}
+
+calibration_tables build_calibration_tables(const calibration_data& calibration, cv::Size frame_size)
+{
+    calibration_tables tables;
+    tables.frame_size = frame_size;
+    if (!calibration.H1.empty())
+        homography_tables(calibration.H1, frame_size, tables.h1_map1, tables.h1_map2);
+
+    size_t count = calibration.projectors.size();
+    tables.projectors.resize(count);
+    std::vector<cv::Mat> maps_x(count), maps_y(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        const projector_calibration& projector = calibration.projectors[i];
+        if (!projector.map_x.empty())
+        {
+            maps_x[i] = projector.map_x;
+            maps_y[i] = projector.map_y;
+        }
+        else if (!projector.H2.empty())
+        {
+            homography_maps(projector.H2, frame_size, maps_x[i], maps_y[i]);
+        }
+        if (!maps_x[i].empty())
+            cv::convertMaps(maps_x[i], maps_y[i], tables.projectors[i].map1, tables.projectors[i].map2, CV_16SC2);
+    }
+
+    if (count > 1)
+        build_blend(maps_x, maps_y, frame_size, tables.projectors);
+    return tables;
+}
+
+cv::Mat unwrap_box(const cv::Mat& input, const calibration_tables& tables)
+{
+    if (tables.h1_map1.empty())
+        return input;
+    cv::Mat output;
+    cv::remap(input, output, tables.h1_map1, tables.h1_map2, cv::INTER_LINEAR, cv::BORDER_CONSTANT);
+    return output;
+}
+
+cv::Mat unwrap_projector(const cv::Mat& input, const calibration_tables& tables, int projector)
+{
+    if (projector >= (int)tables.projectors.size() || tables.projectors[projector].map1.empty())
+        return input;
+    cv::Mat output;
+    unwrap_projector(input, tables, projector, output);
+    return output;
+}
+
+void unwrap_projector(const cv::Mat& input, const calibration_tables& tables, int projector, cv::Mat& output)
+{
+    if (projector >= (int)tables.projectors.size() || tables.projectors[projector].map1.empty())
+    {
+        input.copyTo(output);
+        return;
+    }
+
+    const projector_tables& p = tables.projectors[projector];
+    cv::remap(input, output, p.map1, p.map2, cv::INTER_LINEAR, cv::BORDER_CONSTANT);
+    if (!p.blend.empty() && p.blend.type() == output.type())
+        cv::multiply(output, p.blend, output, 1. / 255);
+}
+
+void unwrap_projectors(const cv::Mat& input, const calibration_tables& tables, FanoutExecutor& fanout, cv::Mat& tiled)
+{
+    // Columns of each projector in the tiled output
+    int count = std::max<int>(1, (int)tables.projectors.size());
+    std::vector<cv::Rect> tiles(count);
+    int width = 0, height = 0;
+    for (int i = 0; i < count; ++i)
+    {
+        bool mapped = i < (int)tables.projectors.size() && !tables.projectors[i].map1.empty();
+        cv::Size size = mapped ? tables.projectors[i].map1.size() : input.size();
+        tiles[i] = cv::Rect(width, 0, size.width, size.height);
+        width += size.width;
+        height = std::max(height, size.height);
+    }
+
+    if (tiled.size() != cv::Size(width, height) || tiled.type() != input.type())
+    {
+        tiled.create(height, width, input.type());
+        // Below the shorter projectors
+        tiled.setTo(cv::Scalar::all(0));
+    }
+
+    fanout.run(count, [&](int i) {
+        // Same size and type as the tile: written in place
+        cv::Mat tile = tiled(tiles[i]);
+        unwrap_projector(input, tables, i, tile);
+    });
+}
+
+
+static void write_cache(const std::string& path, uint64_t key, const calibration_data& calibration, const calibration_tables& tables)
+{
+    if (tables.projectors.size() != calibration.projectors.size())
+        throw std::logic_error("Calibration cache: tables of another calibration");
+
+    const std::string& palette = calibration.style.palette;
+    cv::Mat palette_name;
+    if (!palette.empty())
+        palette_name = cv::Mat(1, (int)palette.size(), CV_8UC1, const_cast<char*>(palette.data()));
+
+    std::vector<const cv::Mat*> mats = {
+        &calibration.H1, &calibration.points_box, &calibration.points_depth, &tables.h1_map1, &tables.h1_map2,
+        &palette_name,
+    };
+    for (size_t i = 0; i < calibration.projectors.size(); ++i)
+    {
+        const projector_calibration& projector = calibration.projectors[i];
+        const projector_tables& projector_maps = tables.projectors[i];
+        mats.insert(mats.end(), {
+            &projector.H2, &projector.map_x, &projector.map_y, &projector.points_mire,
+            &projector_maps.map1, &projector_maps.map2, &projector_maps.blend,
+        });
+    }
+
+    cache_header header = {};
+    std::memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header.version = CACHE_VERSION;
+    header.key = key;
+    header.width = tables.frame_size.width;
+    header.height = tables.frame_size.height;
+    header.min_depth = calibration.min_depth;
+    header.max_depth = calibration.max_depth;
+    header.contour_step = calibration.style.contour_step;
+    header.shading_strength = calibration.style.shading_strength;
+    header.hole_mode = (int32_t)calibration.style.holes;
+    header.smoothing_radius = calibration.style.smoothing_radius;
+    header.smoothing_range = calibration.style.smoothing_range;
+    header.water_rain = calibration.style.water_rain;
+    header.water_evaporation = calibration.style.water_evaporation;
+    header.occlusion_height = calibration.style.occlusion_height;
+    header.occlusion_motion = calibration.style.occlusion_motion;
+    header.entries = (uint32_t)mats.size();
+    header.projectors = (uint32_t)calibration.projectors.size();
+
+    std::vector<cache_mat> descriptors(mats.size());
+    uint64_t offset = sizeof(header) + descriptors.size() * sizeof(cache_mat);
+    for (size_t i = 0; i < mats.size(); ++i)
+    {
+        if (mats[i]->empty())
+            continue;
+        offset = (offset + CACHE_ALIGNMENT - 1) / CACHE_ALIGNMENT * CACHE_ALIGNMENT;
+        descriptors[i] = {mats[i]->type(), mats[i]->rows, mats[i]->cols, 0, offset};
+        offset += mats[i]->total() * mats[i]->elemSize();
+    }
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(descriptors.data()), descriptors.size() * sizeof(cache_mat));
+    for (size_t i = 0; i < mats.size(); ++i)
+    {
+        if (mats[i]->empty())
+            continue;
+        // Padding up to the aligned offset
+        static const char zeros[CACHE_ALIGNMENT] = {};
+        file.write(zeros, descriptors[i].offset - (uint64_t)file.tellp());
+
+        cv::Mat mat = mats[i]->isContinuous() ? *mats[i] : mats[i]->clone();
+        file.write(reinterpret_cast<const char*>(mat.data), mat.total() * mat.elemSize());
+    }
+    if (!file)
+        throw std::runtime_error("Failed to write calibration cache " + path);
+}
+
+// Written next to it then renamed: a concurrent reader never maps a partial file
+static bool replace_cache(const std::string& filename, uint64_t key, const calibration_data& calibration, const calibration_tables& tables)
+{
+    std::string path = cache_filename(filename);
+    std::string tmp_path = path + ".tmp";
+    try
+    {
+        write_cache(tmp_path, key, calibration, tables);
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+        std::remove(tmp_path.c_str());
+        return false;
+    }
+    return std::rename(tmp_path.c_str(), path.c_str()) == 0;
+}
+
+bool write_calibration_cache(const std::string& filename, const calibration_data& calibration, const calibration_tables& tables)
+{
+    try
+    {
+        return replace_cache(filename, hash_file(filename), calibration, tables);
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+        return false;
+    }
+}
+
+
+// Map the cache, false if it is missing or does not match the preset file
+static bool read_cache(const std::string& path, uint64_t key, cv::Size frame_size, cached_calibration& result)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    void* data = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(cache_header))
+        data = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return false;
+
+    size_t size = st.st_size;
+    std::shared_ptr<void> mapping(data, [size](void* p) { munmap(p, size); });
+
+    const auto& header = *static_cast<const cache_header*>(data);
+    if (std::memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 || header.version != CACHE_VERSION
+        || header.key != key || header.width != frame_size.width || header.height != frame_size.height
+        || header.projectors == 0 || header.projectors > CACHE_MAX_PROJECTORS
+        || header.hole_mode < (int32_t)hole_filling::NONE || header.hole_mode > (int32_t)hole_filling::TEMPORAL
+        || !(header.smoothing_radius >= 0) || !(header.smoothing_range > 0)
+        || !(header.water_rain >= 0) || !(header.water_evaporation >= 0)
+        || header.occlusion_height < 0 || header.occlusion_motion < 1
+        || header.entries != BASE_ENTRIES + header.projectors * PROJECTOR_ENTRIES
+        || size < sizeof(header) + header.entries * sizeof(cache_mat))
+        return false;
+
+    const auto* descriptors = reinterpret_cast<const cache_mat*>(static_cast<const char*>(data) + sizeof(header));
+    std::vector<cv::Mat> mats(header.entries);
+    for (size_t i = 0; i < mats.size(); ++i)
+    {
+        const cache_mat& d = descriptors[i];
+        if (d.offset == 0)
+            continue;
+        if (d.rows <= 0 || d.cols <= 0 || d.type != CV_MAT_TYPE(d.type))
+            return false;
+        uint64_t bytes = (uint64_t)d.rows * d.cols * CV_ELEM_SIZE(d.type);
+        if (d.offset > size || bytes > size - d.offset)
+            return false;
+        mats[i] = cv::Mat(d.rows, d.cols, d.type, static_cast<char*>(data) + d.offset);
+    }
+
+    // The calibration is copied (it may outlive the mapping), the tables stay mapped
+    calibration_data& calibration = result.calibration;
+    calibration.H1 = mats[ENTRY_H1].clone();
+    calibration.points_box = mats[ENTRY_POINTS_BOX].clone();
+    calibration.points_depth = mats[ENTRY_POINTS_DEPTH].clone();
+    calibration.min_depth = header.min_depth;
+    calibration.max_depth = header.max_depth;
+    calibration.style.contour_step = header.contour_step;
+    calibration.style.shading_strength = header.shading_strength;
+    calibration.style.holes = (hole_filling)header.hole_mode;
+    calibration.style.smoothing_radius = header.smoothing_radius;
+    calibration.style.smoothing_range = header.smoothing_range;
+    calibration.style.water_rain = header.water_rain;
+    calibration.style.water_evaporation = header.water_evaporation;
+    calibration.style.occlusion_height = header.occlusion_height;
+    calibration.style.occlusion_motion = header.occlusion_motion;
+    const cv::Mat& palette_name = mats[ENTRY_PALETTE];
+    if (!palette_name.empty())
+        calibration.style.palette.assign(palette_name.ptr<char>(), palette_name.total() * palette_name.elemSize());
+
+    calibration_tables& tables = result.tables;
+    tables.frame_size = frame_size;
+    tables.h1_map1 = mats[ENTRY_H1_MAP1];
+    tables.h1_map2 = mats[ENTRY_H1_MAP2];
+
+    calibration.projectors.resize(header.projectors);
+    tables.projectors.resize(header.projectors);
+    for (uint32_t i = 0; i < header.projectors; ++i)
+    {
+        const cv::Mat* entries = &mats[BASE_ENTRIES + i * PROJECTOR_ENTRIES];
+        projector_calibration& projector = calibration.projectors[i];
+        projector.H2 = entries[ENTRY_H2].clone();
+        projector.map_x = entries[ENTRY_MAP_X].clone();
+        projector.map_y = entries[ENTRY_MAP_Y].clone();
+        projector.points_mire = entries[ENTRY_POINTS_MIRE].clone();
+
+        projector_tables& projector_maps = tables.projectors[i];
+        projector_maps.map1 = entries[ENTRY_OUTPUT_MAP1];
+        projector_maps.map2 = entries[ENTRY_OUTPUT_MAP2];
+        projector_maps.blend = entries[ENTRY_BLEND];
+    }
+    tables.mapping = std::move(mapping);
+    result.from_cache = true;
+    return true;
+}
+
+cached_calibration load_calibration_cached(const std::string& filename, cv::Size frame_size)
+{
+    uint64_t key = hash_file(filename);
+
+    cached_calibration result;
+    if (read_cache(cache_filename(filename), key, frame_size, result))
+        return result;
+
+    result = cached_calibration();
+    result.calibration = load_calibration(filename);
+    result.tables = build_calibration_tables(result.calibration, frame_size);
+    replace_cache(filename, key, result.calibration, result.tables);
+    return result;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include <opencv2/core.hpp>
+
+#include "calibration-utils.hpp"
+
+class FanoutExecutor;
+
+
+/// \brief Remap tables of one projector
+struct projector_tables
+{
+    cv::Mat map1, map2;     // Dense map or H2, table -> projector (empty without both)
+    cv::Mat blend;          // Edge-blend weights in projector space (CV_8UC3, 255 = full), empty with one projector
+};
+
+/// \brief Remap tables derived from a calibration, for one camera frame size
+///
+/// cv::remap() with these fixed-point tables gives the same image as unwrap() / unwrap_output(),
+/// without recomputing the coordinates of every pixel at each frame.
+struct calibration_tables
+{
+    cv::Size frame_size;                // Camera frames the tables apply to (empty: no tables)
+    cv::Mat h1_map1, h1_map2;           // H1, camera -> table (empty without H1)
+    std::vector<projector_tables> projectors;  // Same order as calibration_data::projectors
+    std::shared_ptr<void> mapping;      // Memory-mapped cache file the tables point into, if any
+
+    bool valid_for(const cv::Size& size) const { return !frame_size.empty() && frame_size == size; }
+};
+
+/// \brief Compute the tables of a calibration for frames of \p frame_size
+///
+/// With several projectors, the edge-blend weights cross-fade the overlapping parts of their
+/// quads: in table space, the weight of a projector grows with the distance to the border of
+/// the area it covers, normalized by the sum over the projectors covering the same point.
+calibration_tables build_calibration_tables(const calibration_data& calibration, cv::Size frame_size);
+
+/// \brief Same as unwrap(input, H1) (returns \p input without H1)
+cv::Mat unwrap_box(const cv::Mat& input, const calibration_tables& tables);
+/// \brief Same as unwrap_output(input, H2, map_x, map_y) of a projector, then its edge blending
+/// (returns \p input without both)
+cv::Mat unwrap_projector(const cv::Mat& input, const calibration_tables& tables, int projector = 0);
+/// \brief Same as above, into a (reused) output buffer
+void unwrap_projector(const cv::Mat& input, const calibration_tables& tables, int projector, cv::Mat& output);
+
+/// \brief Warp an image in table space into all the projectors, side by side in \p tiled
+///
+/// The image is rendered once and each projector only costs its warp: they run concurrently
+/// on \p fanout, each one writing directly in its columns of \p tiled (reused).
+void unwrap_projectors(const cv::Mat& input, const calibration_tables& tables, FanoutExecutor& fanout, cv::Mat& tiled);
+
+
+/// \brief Calibration of a preset file and its tables
+struct cached_calibration
+{
+    calibration_data calibration;
+    calibration_tables tables;
+    bool from_cache = false;
+};
+
+/// \brief Load a preset file through its binary cache "<filename>.cache"
+///
+/// The cache (versioned) stores the calibration and its tables, keyed by a hash of the preset
+/// file content and the frame size. When it matches, it is memory-mapped and the YAML is not
+/// parsed. Otherwise the preset file is parsed, the tables are built and the cache is rewritten.
+/// \throw std::runtime_error if the preset file cannot be read
+cached_calibration load_calibration_cached(const std::string& filename, cv::Size frame_size);
+
+/// \brief Write the cache of a preset file (done by load_calibration_cached() when needed)
+/// \return false if the cache cannot be written
+bool write_calibration_cache(const std::string& filename, const calibration_data& calibration, const calibration_tables& tables);
@@ -1,9 +1,124 @@
 #include "calibration-utils.hpp"
+#include "structured-light.hpp"
 
 #include <opencv2/calib3d.hpp>
 #include <opencv2/imgproc.hpp>
+#include <stdexcept>
 #include <vector>
 
+calibration_data load_calibration(const std::string& filename)
+{
+    cv::FileStorage fs(filename, cv::FileStorage::READ);
+    if (!fs.isOpened())
+        throw std::runtime_error("Failed to open calibration " + filename);
+
+    calibration_data calibration;
+    fs["H1"] >> calibration.H1;
+    fs["min_depth"] >> calibration.min_depth;
+    fs["max_depth"] >> calibration.max_depth;
+    fs["points_box"] >> calibration.points_box;
+    fs["points_depth"] >> calibration.points_depth;
+
+    auto read_projector = [](const cv::FileNode& node) {
+        projector_calibration projector;
+        node["H2"] >> projector.H2;
+        node["map_x"] >> projector.map_x;
+        node["map_y"] >> projector.map_y;
+        node["points_mire"] >> projector.points_mire;
+        return projector;
+    };
+    cv::FileNode projectors = fs["projectors"];
+    if (projectors.isSeq())
+    {
+        for (const auto& node : projectors)
+            calibration.projectors.push_back(read_projector(node));
+    }
+    else
+    {
+        calibration.projectors.push_back(read_projector(fs.root()));
+    }
+    if (calibration.projectors.empty())
+        throw std::runtime_error(filename + ": no projector");
+
+    if (!fs["contour_step"].empty())
+        fs["contour_step"] >> calibration.style.contour_step;
+    if (!fs["shading_strength"].empty())
+        fs["shading_strength"] >> calibration.style.shading_strength;
+    if (!fs["smoothing_radius"].empty())
+        fs["smoothing_radius"] >> calibration.style.smoothing_radius;
+    if (!fs["smoothing_range"].empty())
+        fs["smoothing_range"] >> calibration.style.smoothing_range;
+    if (!fs["water_rain"].empty())
+        fs["water_rain"] >> calibration.style.water_rain;
+    if (!fs["water_evaporation"].empty())
+        fs["water_evaporation"] >> calibration.style.water_evaporation;
+    if (!fs["occlusion_height"].empty())
+        fs["occlusion_height"] >> calibration.style.occlusion_height;
+    if (!fs["occlusion_motion"].empty())
+        fs["occlusion_motion"] >> calibration.style.occlusion_motion;
+    if (!fs["palette"].empty())
+        fs["palette"] >> calibration.style.palette;
+    if (!fs["hole_filling"].empty())
+    {
+        try
+        {
+            calibration.style.holes = parse_hole_filling((std::string)fs["hole_filling"]);
+        }
+        catch (const std::invalid_argument& e)
+        {
+            throw std::runtime_error(filename + ": " + e.what());
+        }
+    }
+
+    if (calibration.style.contour_step < 1)
+        throw std::runtime_error(filename + ": invalid contour_step");
+    if (!(calibration.style.smoothing_radius >= 0) || !(calibration.style.smoothing_range > 0))
+        throw std::runtime_error(filename + ": invalid smoothing_radius or smoothing_range");
+    if (!(calibration.style.water_rain >= 0) || !(calibration.style.water_evaporation >= 0))
+        throw std::runtime_error(filename + ": invalid water_rain or water_evaporation");
+    if (calibration.style.occlusion_height < 0 || calibration.style.occlusion_motion < 1)
+        throw std::runtime_error(filename + ": invalid occlusion_height or occlusion_motion");
+    return calibration;
+}
+
+void save_calibration(const std::string& filename, const calibration_data& calibration)
+{
+    cv::FileStorage fs(filename, cv::FileStorage::WRITE);
+    if (!fs.isOpened())
+        throw std::runtime_error("Failed to write calibration " + filename);
+
+    fs.write("H1", calibration.H1);
+    fs.write("min_depth", calibration.min_depth);
+    fs.write("max_depth", calibration.max_depth);
+    fs.write("contour_step", calibration.style.contour_step);
+    fs.write("shading_strength", calibration.style.shading_strength);
+    fs.write("hole_filling", std::string(hole_filling_name(calibration.style.holes)));
+    fs.write("smoothing_radius", calibration.style.smoothing_radius);
+    fs.write("smoothing_range", calibration.style.smoothing_range);
+    fs.write("water_rain", calibration.style.water_rain);
+    fs.write("water_evaporation", calibration.style.water_evaporation);
+    fs.write("occlusion_height", calibration.style.occlusion_height);
+    fs.write("occlusion_motion", calibration.style.occlusion_motion);
+    fs.write("palette", calibration.style.palette);
+    fs.write("points_box", calibration.points_box);
+    fs.write("points_depth", calibration.points_depth);
+
+    fs << "projectors" << "[";
+    for (const auto& projector : calibration.projectors)
+    {
+        fs << "{";
+        fs.write("H2", projector.H2);
+        fs.write("points_mire", projector.points_mire);
+        if (!projector.map_x.empty())
+        {
+            fs.write("map_x", projector.map_x);
+            fs.write("map_y", projector.map_y);
+        }
+        fs << "}";
+    }
+    fs << "]";
+}
+
 cv::Mat unwrap_estimate(std::vector<cv::Point2f> input_points, int width, int height, bool mirror)
 {
     std::vector<cv::Point2f> output_points = {
@@ -25,11 +140,35 @@ cv::Mat unwrap_estimate(std::vector<cv::Point2f> input_points, int width, int he
 cv::Mat unwrap(const cv::Mat& wrapped, const cv::Mat& H)
 {
     cv::Mat im_out;
-    // Warp source image to destination based on homography
-    cv::warpPerspective(wrapped, im_out, H, wrapped.size());
+    unwrap(wrapped, H, im_out);
     return im_out;
 }
 
+void unwrap(const cv::Mat& wrapped, const cv::Mat& H, cv::Mat& output)
+{
+    // Warp source image to destination based on homography
+    cv::warpPerspective(wrapped, output, H, wrapped.size());
+}
+
+cv::Mat unwrap_output(const cv::Mat& input, const cv::Mat& H2, const cv::Mat& map_x, const cv::Mat& map_y)
+{
+    if (!map_x.empty())
+        return unwrap_dense(input, map_x, map_y);
+    if (!H2.empty())
+        return unwrap(input, H2);
+    return input;
+}
+
+void unwrap_output(const cv::Mat& input, const cv::Mat& H2, const cv::Mat& map_x, const cv::Mat& map_y, cv::Mat& output)
+{
+    if (!map_x.empty())
+        cv::remap(input, output, map_x, map_y, cv::INTER_LINEAR, cv::BORDER_CONSTANT);
+    else if (!H2.empty())
+        unwrap(input, H2, output);
+    else
+        input.copyTo(output);
+}
+
 QImage get_calibration_image(int width, int height)
 {
     QImage img(width, height, QImage::Format_RGB32);
@@ -2,9 +2,41 @@
 
 
 #include <cstdint>
+#include <string>
+#include <vector>
 #include <opencv2/core.hpp>
 #include <QtGui/QImage>
 
+#include "utils.hpp"
+
+
+/// \brief Calibration of one projector of the output
+struct projector_calibration
+{
+    cv::Mat H2;             // Projector homography (table -> projector)
+    cv::Mat map_x, map_y;   // Dense projector map (structured light), replaces H2 when set
+    cv::Mat points_mire;    // Handle positions of the projector quad (CV_32F, one point per row)
+};
+
+/// \brief Calibration saved by QCalibrationApp::savePresets()
+struct calibration_data
+{
+    cv::Mat H1;             // Box homography (camera -> table)
+    std::vector<projector_calibration> projectors;  // Projectors side by side, at least one once loaded
+    int min_depth = 0;
+    int max_depth = 2047;
+    terrain_style style;    // Rendering parameters (optional in the preset file)
+    cv::Mat points_box, points_depth;  // Handle positions (CV_32F, one point per row)
+};
+
+/// \brief Load the calibration part of a preset file
+///
+/// Preset files written before the multi-projector output (H2, map_x, map_y and points_mire at
+/// the top level) are read as a single projector.
+calibration_data load_calibration(const std::string& filename);
+/// \brief Write a preset file, read back by load_calibration()
+void save_calibration(const std::string& filename, const calibration_data& calibration);
+
 
 
 /// @brief \brief Estimate the homography parameters from the coordinates of the corners of the wrapped image
@@ -19,6 +51,13 @@ cv::Mat unwrap_estimate(std::vector<cv::Point2f> coordinates, int width, int hei
 /// \param wrapped The image to unwrap
 /// \param H The homography matrix 
 cv::Mat unwrap(const cv::Mat& wrapped, const cv::Mat& H);
+/// \brief Same as above, into a (reused) output buffer
+void unwrap(const cv::Mat& wrapped, const cv::Mat& H, cv::Mat& output);
+
+
+/// \brief Return a new image warped to the projector (dense map if any, else H2)
+cv::Mat unwrap_output(const cv::Mat& input, const cv::Mat& H2, const cv::Mat& map_x, const cv::Mat& map_y);
+void unwrap_output(const cv::Mat& input, const cv::Mat& H2, const cv::Mat& map_x, const cv::Mat& map_y, cv::Mat& output);
 
 
 QImage get_calibration_image(int width, int height);
\ No newline at end of file
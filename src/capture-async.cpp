@@ -0,0 +1,115 @@
+#include "capture-async.hpp"
+#include "metrics.hpp"
+#include "profiling.hpp"
+#include "thread-policy.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+// Backoff between two connection attempts
+constexpr static int RECONNECT_MIN_DELAY_MS = 500;
+constexpr static int RECONNECT_MAX_DELAY_MS = 8000;
+// Timeout of a USB event loop iteration (bounds the reaction time to stop())
+constexpr static int EVENT_TIMEOUT_MS = 100;
+// A sensor without depth frame for this long is considered disconnected
+constexpr static uint64_t STALL_TIMEOUT_MS = 3000;
+
+
+AsyncKinectCapture::AsyncKinectCapture(CVKinectCapture::resolution video_res, CVKinectCapture::resolution depth_res,
+                                       CVKinectCapture::video_format video_format)
+    : m_video_res(video_res), m_depth_res(depth_res), m_video_format(video_format)
+{
+}
+
+AsyncKinectCapture::~AsyncKinectCapture()
+{
+    stop();
+}
+
+void AsyncKinectCapture::start()
+{
+    if (m_thread.joinable())
+        return;
+    m_stop = false;
+    m_thread = std::thread(&AsyncKinectCapture::run, this);
+}
+
+void AsyncKinectCapture::stop()
+{
+    if (!m_thread.joinable())
+        return;
+    {
+        std::lock_guard lock(m_mutex);
+        m_stop = true;
+    }
+    m_wake.notify_all();
+    m_thread.join();
+}
+
+void AsyncKinectCapture::set_state(state s)
+{
+    if (m_state.exchange(s) != s && m_state_cb)
+        m_state_cb(s);
+}
+
+void AsyncKinectCapture::wait_for(int delay_ms)
+{
+    std::unique_lock lock(m_mutex);
+    m_wake.wait_for(lock, std::chrono::milliseconds(delay_ms), [this]() { return m_stop.load(); });
+}
+
+void AsyncKinectCapture::run()
+{
+    static MetricGauge& connected = get_metric_gauge("kinect_sensor_connected", "1 while the Kinect is streaming");
+    static MetricCounter& reconnects = get_metric_counter("kinect_sensor_reconnects_total", "Reconnections after a sensor loss");
+
+    trace_thread_name("capture");
+    apply_thread_policy(thread_role::CAPTURE, "capture");
+
+    int delay_ms = RECONNECT_MIN_DELAY_MS;
+    bool was_connected = false;
+    while (!m_stop)
+    {
+        try
+        {
+            // Device enumeration and mode setting: blocking USB I/O, only on this thread
+            CVKinectCapture capture(m_video_res, m_depth_res, m_video_format);
+            capture.set_rgb_callback(m_rgb_cb);
+            capture.set_depth_callback([this](cv::Mat& depth, uint32_t timestamp) {
+                m_last_frame_ns = profiling_now();
+                if (m_depth_cb)
+                    m_depth_cb(depth, timestamp);
+            });
+            capture.start();
+
+            m_last_frame_ns = profiling_now();
+            if (was_connected)
+                reconnects.add();
+            was_connected = true;
+            delay_ms = RECONNECT_MIN_DELAY_MS;
+            connected.set(1);
+            set_state(RUNNING);
+            std::cout << "Kinect: streaming" << std::endl;
+
+            while (!m_stop)
+            {
+                capture.next_loop_event(EVENT_TIMEOUT_MS);
+                if (profiling_now() - m_last_frame_ns > STALL_TIMEOUT_MS * 1000000)
+                    throw std::runtime_error("no depth frame for " + std::to_string(STALL_TIMEOUT_MS) + " ms");
+            }
+        }
+        catch (const std::exception& e)
+        {
+            if (!m_stop)
+                std::cerr << "Kinect: " << e.what() << ", retrying in " << delay_ms << " ms" << std::endl;
+        }
+
+        connected.set(0);
+        if (m_stop)
+            break;
+        set_state(WAITING);
+        wait_for(delay_ms);
+        delay_ms = std::min(delay_ms * 2, RECONNECT_MAX_DELAY_MS);
+    }
+}
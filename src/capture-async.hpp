@@ -0,0 +1,65 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#include "capture-cv.hpp"
+
+
+/// \brief Kinect capture on its own thread, with automatic (re)connection
+///
+/// start() returns immediately: the device is opened on the capture thread, which retries with
+/// an exponential backoff while no sensor is plugged in. When the USB events fail or no depth
+/// frame arrives for a while (the sensor was unplugged), the device is closed and reopened the
+/// same way. The callbacks run on the capture thread: the caller must not block it.
+class AsyncKinectCapture
+{
+    public:
+        enum state
+        {
+            WAITING = 0,    // No sensor, or (re)connecting
+            RUNNING = 1,    // Streaming
+        };
+
+        using frame_callback = std::function<void(cv::Mat&, uint32_t timestamp)>;
+        using state_callback = std::function<void(state)>;
+
+        explicit AsyncKinectCapture(CVKinectCapture::resolution video_res = CVKinectCapture::MEDIUM,
+                                    CVKinectCapture::resolution depth_res = CVKinectCapture::MEDIUM,
+                                    CVKinectCapture::video_format video_format = CVKinectCapture::VIDEO_RGB);
+        ~AsyncKinectCapture();
+
+        // Callbacks are set before start(), they run on the capture thread
+        void set_rgb_callback(frame_callback cb) { m_rgb_cb = std::move(cb); }
+        void set_depth_callback(frame_callback cb) { m_depth_cb = std::move(cb); }
+        void set_state_callback(state_callback cb) { m_state_cb = std::move(cb); }
+
+        void start();
+        void stop();
+
+        state current_state() const { return m_state.load(); }
+
+    private:
+        void run();
+        void set_state(state s);
+        // Interruptible by stop()
+        void wait_for(int delay_ms);
+
+        CVKinectCapture::resolution m_video_res;
+        CVKinectCapture::resolution m_depth_res;
+        CVKinectCapture::video_format m_video_format;
+        frame_callback m_rgb_cb;
+        frame_callback m_depth_cb;
+        state_callback m_state_cb;
+
+        std::thread m_thread;
+        std::atomic<state> m_state = {WAITING};
+        std::atomic<uint64_t> m_last_frame_ns = {0};
+        std::atomic<bool> m_stop = {false};
+        std::mutex m_mutex;
+        std::condition_variable m_wake;
+};
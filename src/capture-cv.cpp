@@ -1,7 +1,10 @@
 #include "capture-cv.hpp"
+#include "metrics.hpp"
+#include "profiling.hpp"
 
 #include <opencv2/imgproc.hpp>
 #include <libfreenect/libfreenect.h>
+#include <sys/time.h>
 
 struct CVKinectCapture::FreenectContext
 {
@@ -30,7 +33,7 @@ struct CVKinectCapture::FreenectContext
 
 
 
-CVKinectCapture::CVKinectCapture(resolution video_res, resolution depth_res)
+CVKinectCapture::CVKinectCapture(resolution video_res, resolution depth_res, video_format format)
 {
     ctx = std::make_unique<FreenectContext>();
     auto fn_ctx = ctx->fn_ctx;
@@ -52,7 +55,8 @@ CVKinectCapture::CVKinectCapture(resolution video_res, resolution depth_res)
         throw std::runtime_error("Failed to set depth mode");
 
 
-    auto mode_rgb = freenect_find_video_mode((freenect_resolution) video_res, FREENECT_VIDEO_RGB);
+    auto fn_format = (format == VIDEO_BAYER) ? FREENECT_VIDEO_BAYER : FREENECT_VIDEO_RGB;
+    auto mode_rgb = freenect_find_video_mode((freenect_resolution) video_res, fn_format);
     if (freenect_set_video_mode(ctx->fn_dev, mode_rgb) < 0)
         throw std::runtime_error("Failed to set video mode");
 
@@ -63,8 +67,17 @@ CVKinectCapture::CVKinectCapture(resolution video_res, resolution depth_res)
 
 CVKinectCapture::~CVKinectCapture()
 {
+    // The device may be gone (unplugged)
     if (running)
-        stop();
+    {
+        try
+        {
+            stop();
+        }
+        catch (const std::exception&)
+        {
+        }
+    }
 }
 
 void CVKinectCapture::set_rgb_callback(std::function<void(cv::Mat&, uint32_t)> cb)
@@ -79,6 +92,12 @@ void CVKinectCapture::set_depth_callback(std::function<void(cv::Mat&, uint32_t)>
 
 void CVKinectCapture::depth_cb_wrapper(void* _dev, void* data, uint32_t timestamp)
 {
+    depth_frame_arrived(timestamp);
+    metrics_depth_frame(timestamp);
+    trace_new_frame();
+    PROFILE_SCOPE("capture.depth_cb");
+    trace_frame_flow(trace_phase::FLOW_START);
+
     auto dev = static_cast<freenect_device*>(_dev);
     auto mode = freenect_get_current_depth_mode(dev);
     auto depthmap = cv::Mat(mode.height, mode.width, CV_16UC1, data);
@@ -89,9 +108,15 @@ void CVKinectCapture::depth_cb_wrapper(void* _dev, void* data, uint32_t timestam
 
 void CVKinectCapture::rgb_cb_wrapper(void* _dev, void* data, uint32_t timestamp)
 {
+    metrics_rgb_frame();
+    trace_new_frame();
+    PROFILE_SCOPE("capture.rgb_cb");
+    trace_frame_flow(trace_phase::FLOW_START);
+
     auto dev = static_cast<freenect_device*>(_dev);
     auto mode = freenect_get_current_video_mode(dev);
-    auto rgbmap = cv::Mat(mode.height, mode.width, CV_8UC3, data);
+    int type = (mode.video_format == FREENECT_VIDEO_BAYER) ? CV_8UC1 : CV_8UC3;
+    auto rgbmap = cv::Mat(mode.height, mode.width, type, data);
     if (rgb_cb) {
         // Convert RGB to BGR
         //cv::cvtColor(rgbmap, rgbmap, cv::COLOR_RGB2BGR);
@@ -111,12 +136,20 @@ void CVKinectCapture::start()
     running = true;
 }
 
-void CVKinectCapture::next_loop_event()
+void CVKinectCapture::next_loop_event(int timeout_ms)
 {
-    //struct timeval timeout = {0, 0};
-    //freenect_process_events_timeout(ctx->fn_ctx, &timeout);
+    int ret;
+    if (timeout_ms < 0)
+    {
+        ret = freenect_process_events(ctx->fn_ctx);
+    }
+    else
+    {
+        struct timeval timeout = {timeout_ms / 1000, (timeout_ms % 1000) * 1000};
+        ret = freenect_process_events_timeout(ctx->fn_ctx, &timeout);
+    }
 
-    if (freenect_process_events(ctx->fn_ctx) < 0)
+    if (ret < 0)
         throw std::runtime_error("Failed to process events");
 }
 
@@ -12,16 +12,23 @@ class CVKinectCapture
             HIGH = 2
         };
 
+        // Format of the frames passed to the RGB callback
+        enum video_format {
+            VIDEO_RGB = 0,      // CV_8UC3, demosaiced by libfreenect on the USB event thread
+            VIDEO_BAYER = 1,    // CV_8UC1 raw GRBG mosaic, to demosaic() by the consumer
+        };
 
-        CVKinectCapture(resolution video_res = MEDIUM, resolution depth_res = MEDIUM);
+        CVKinectCapture(resolution video_res = MEDIUM, resolution depth_res = MEDIUM, video_format format = VIDEO_RGB);
         ~CVKinectCapture();
 
         void set_rgb_callback(std::function<void(cv::Mat&, uint32_t)> cb);
         void set_depth_callback(std::function<void(cv::Mat&, uint32_t)> cb);
 
-        // Must be called from the main thread
+        // Must be called from the thread that owns the capture (see AsyncKinectCapture)
         void start();
-        void next_loop_event();
+        // Process the USB events, the callbacks run on the calling thread
+        // timeout_ms < 0: wait for the next event
+        void next_loop_event(int timeout_ms = -1);
         void stop();
 
     private:
@@ -0,0 +1,194 @@
+#include "demosaic.hpp"
+
+#include <stdexcept>
+
+#include <opencv2/imgproc.hpp>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define KINECT_AVX2_KERNELS
+#endif
+
+
+// Output pixels [begin, end) of a HALF row, from the rows 2y (G R) and 2y + 1 (B G)
+static void demosaic_half_row(const uint8_t* gr, const uint8_t* bg, uint8_t* output, int begin, int end)
+{
+    for (int x = begin; x < end; ++x)
+    {
+        output[3 * x] = gr[2 * x + 1];
+        output[3 * x + 1] = (uint8_t)((gr[2 * x] + bg[2 * x + 1] + 1) >> 1);
+        output[3 * x + 2] = bg[2 * x];
+    }
+}
+
+// Output pixels [begin, end) of a QUARTER row, from the rows 4y to 4y + 3
+static void demosaic_quarter_row(const uint8_t* const rows[4], uint8_t* output, int begin, int end)
+{
+    for (int x = begin; x < end; ++x)
+    {
+        int r = 0, g = 0, b = 0;
+        for (int i = 0; i < 4; i += 2)
+        {
+            const uint8_t* gr = rows[i] + 4 * x;
+            const uint8_t* bg = rows[i + 1] + 4 * x;
+            r += gr[1] + gr[3];
+            g += gr[0] + gr[2] + bg[1] + bg[3];
+            b += bg[0] + bg[2];
+        }
+        output[3 * x] = (uint8_t)((r + 2) >> 2);
+        output[3 * x + 1] = (uint8_t)((g + 4) >> 3);
+        output[3 * x + 2] = (uint8_t)((b + 2) >> 2);
+    }
+}
+
+#ifdef KINECT_AVX2_KERNELS
+// pshufb masks placing 16 pixels of one channel in the 3 blocks of 16 bytes of RGB output
+struct interleave_masks
+{
+    __m128i channel[3][3];  // [block][channel]
+};
+
+static interleave_masks make_interleave_masks()
+{
+    interleave_masks masks;
+    for (int block = 0; block < 3; ++block)
+    {
+        for (int channel = 0; channel < 3; ++channel)
+        {
+            alignas(16) int8_t mask[16];
+            for (int j = 0; j < 16; ++j)
+            {
+                int i = 16 * block + j;
+                mask[j] = (i % 3 == channel) ? (int8_t)(i / 3) : (int8_t)0x80;
+            }
+            masks.channel[block][channel] = _mm_load_si128((const __m128i*)mask);
+        }
+    }
+    return masks;
+}
+
+__attribute__((target("avx2")))
+static inline void store_rgb16(__m128i r, __m128i g, __m128i b, uint8_t* output, const interleave_masks& masks)
+{
+    for (int block = 0; block < 3; ++block)
+    {
+        const __m128i* mask = masks.channel[block];
+        __m128i rgb = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(r, mask[0]), _mm_shuffle_epi8(g, mask[1])), _mm_shuffle_epi8(b, mask[2]));
+        _mm_storeu_si128((__m128i*)(output + 16 * block), rgb);
+    }
+}
+
+// 16 unsigned 16-bit lanes to 16 bytes, in order
+__attribute__((target("avx2")))
+static inline __m128i pack16(__m256i x)
+{
+    return _mm_packus_epi16(_mm256_castsi256_si128(x), _mm256_extracti128_si256(x, 1));
+}
+
+__attribute__((target("avx2")))
+static void demosaic_half_row_avx2(const uint8_t* gr, const uint8_t* bg, uint8_t* output, int count, const interleave_masks& masks)
+{
+    const __m256i low = _mm256_set1_epi16(0xff);
+    int x = 0;
+    for (; x + 16 <= count; x += 16)
+    {
+        // 16-bit lanes: even bytes in the low half, odd bytes in the high half
+        __m256i a = _mm256_loadu_si256((const __m256i*)(gr + 2 * x));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(bg + 2 * x));
+        __m256i red = _mm256_srli_epi16(a, 8);
+        __m256i green = _mm256_avg_epu16(_mm256_and_si256(a, low), _mm256_srli_epi16(b, 8));
+        __m256i blue = _mm256_and_si256(b, low);
+        store_rgb16(pack16(red), pack16(green), pack16(blue), output + 3 * x, masks);
+    }
+    demosaic_half_row(gr, bg, output, x, count);
+}
+
+__attribute__((target("avx2")))
+static void demosaic_quarter_row_avx2(const uint8_t* const rows[4], uint8_t* output, int count, const interleave_masks& masks)
+{
+    const __m256i low = _mm256_set1_epi16(0xff);
+    int x = 0;
+    for (; x + 16 <= count; x += 16)
+    {
+        // Vertical sums of the 2x2 cells 2x to 2x + 31, in two halves of 16 cells
+        __m256i sums[3][2];
+        for (int half = 0; half < 2; ++half)
+        {
+            __m256i r = _mm256_setzero_si256(), g = _mm256_setzero_si256(), b = _mm256_setzero_si256();
+            for (int i = 0; i < 4; i += 2)
+            {
+                __m256i gr = _mm256_loadu_si256((const __m256i*)(rows[i] + 4 * x + 32 * half));
+                __m256i bg = _mm256_loadu_si256((const __m256i*)(rows[i + 1] + 4 * x + 32 * half));
+                r = _mm256_add_epi16(r, _mm256_srli_epi16(gr, 8));
+                g = _mm256_add_epi16(g, _mm256_add_epi16(_mm256_and_si256(gr, low), _mm256_srli_epi16(bg, 8)));
+                b = _mm256_add_epi16(b, _mm256_and_si256(bg, low));
+            }
+            sums[0][half] = r;
+            sums[1][half] = g;
+            sums[2][half] = b;
+        }
+
+        // Horizontal pairs of cells; hadd works in 128-bit lanes, permute restores the order
+        __m256i channels[3];
+        for (int c = 0; c < 3; ++c)
+            channels[c] = _mm256_permute4x64_epi64(_mm256_hadd_epi16(sums[c][0], sums[c][1]), 0xd8);
+        __m256i red = _mm256_srli_epi16(_mm256_add_epi16(channels[0], _mm256_set1_epi16(2)), 2);
+        __m256i green = _mm256_srli_epi16(_mm256_add_epi16(channels[1], _mm256_set1_epi16(4)), 3);
+        __m256i blue = _mm256_srli_epi16(_mm256_add_epi16(channels[2], _mm256_set1_epi16(2)), 2);
+        store_rgb16(pack16(red), pack16(green), pack16(blue), output + 3 * x, masks);
+    }
+    demosaic_quarter_row(rows, output, x, count);
+}
+
+static const bool demosaic_avx2 = __builtin_cpu_supports("avx2");
+#endif
+
+void demosaic(const cv::Mat& bayer, cv::Mat& rgb, demosaic_scale scale)
+{
+    if (bayer.type() != CV_8UC1 || bayer.cols % 2 != 0 || bayer.rows % 2 != 0)
+        throw std::invalid_argument("demosaic: expected a CV_8UC1 frame of even size");
+
+    if (scale == demosaic_scale::FULL)
+    {
+        // Vectorized bilinear interpolation of OpenCV (its pattern names follow the second row)
+        cv::cvtColor(bayer, rgb, cv::COLOR_BayerGB2RGB);
+        return;
+    }
+
+    int factor = (int)scale;
+    rgb.create(bayer.rows / factor, bayer.cols / factor, CV_8UC3);
+#ifdef KINECT_AVX2_KERNELS
+    static const interleave_masks masks = make_interleave_masks();
+#endif
+    for (int y = 0; y < rgb.rows; ++y)
+    {
+        uint8_t* output = rgb.ptr<uint8_t>(y);
+        if (scale == demosaic_scale::HALF)
+        {
+            const uint8_t* gr = bayer.ptr<uint8_t>(2 * y);
+            const uint8_t* bg = bayer.ptr<uint8_t>(2 * y + 1);
+#ifdef KINECT_AVX2_KERNELS
+            if (demosaic_avx2)
+            {
+                demosaic_half_row_avx2(gr, bg, output, rgb.cols, masks);
+                continue;
+            }
+#endif
+            demosaic_half_row(gr, bg, output, 0, rgb.cols);
+        }
+        else
+        {
+            const uint8_t* rows[4];
+            for (int i = 0; i < 4; ++i)
+                rows[i] = bayer.ptr<uint8_t>(4 * y + i);
+#ifdef KINECT_AVX2_KERNELS
+            if (demosaic_avx2)
+            {
+                demosaic_quarter_row_avx2(rows, output, rgb.cols, masks);
+                continue;
+            }
+#endif
+            demosaic_quarter_row(rows, output, 0, rgb.cols);
+        }
+    }
+}
@@ -0,0 +1,480 @@
+#include "depth-filters.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define KINECT_AVX2_KERNELS
+#endif
+
+
+const char* hole_filling_name(hole_filling mode)
+{
+    switch (mode)
+    {
+        case hole_filling::NONE:
+            return "none";
+        case hole_filling::PUSH_PULL:
+            return "push_pull";
+        case hole_filling::TEMPORAL:
+            return "temporal";
+    }
+    return "";
+}
+
+hole_filling parse_hole_filling(const std::string& name)
+{
+    for (auto mode : {hole_filling::NONE, hole_filling::PUSH_PULL, hole_filling::TEMPORAL})
+        if (name == hole_filling_name(mode))
+            return mode;
+    throw std::invalid_argument("unknown hole filling " + name);
+}
+
+
+// 1 for a valid depth, 0 for a hole (same as is_depth_hole(), without branch)
+static inline float depth_weight(uint16_t depth)
+{
+    return (uint16_t)(depth - 1) < DEPTH_NO_READING - 1 ? 1.f : 0.f;
+}
+
+void DepthHoleFiller::set_mode(hole_filling mode)
+{
+    if (mode != m_mode)
+        reset();
+    m_mode = mode;
+}
+
+void DepthHoleFiller::reset()
+{
+    m_last.release();
+}
+
+void DepthHoleFiller::fill(const cv::Mat& depth, cv::Mat& output)
+{
+    if (depth.type() != CV_16UC1)
+        throw std::invalid_argument("DepthHoleFiller: expected a CV_16UC1 frame");
+    if (depth.data == output.data)
+        throw std::invalid_argument("DepthHoleFiller: the output must not be the input");
+
+    output.create(depth.size(), CV_16UC1);
+    if (m_mode == hole_filling::NONE)
+    {
+        depth.copyTo(output);
+        return;
+    }
+
+    // The holes first take the last reading of the pixel, the pyramid fills the others in place
+    cv::Mat input = depth;
+    if (m_mode == hole_filling::TEMPORAL)
+    {
+        if (m_last.size() != depth.size())
+            m_last = cv::Mat::zeros(depth.size(), CV_16UC1);
+        for (int y = 0; y < depth.rows; ++y)
+        {
+            const uint16_t* d = depth.ptr<uint16_t>(y);
+            uint16_t* last = m_last.ptr<uint16_t>(y);
+            uint16_t* out = output.ptr<uint16_t>(y);
+            for (int x = 0; x < depth.cols; ++x)
+            {
+                last[x] = is_depth_hole(d[x]) ? last[x] : d[x];
+                out[x] = last[x];
+            }
+        }
+        input = output;
+    }
+
+    bool holes = false;
+    for (int y = 0; y < input.rows && !holes; ++y)
+    {
+        const uint16_t* d = input.ptr<uint16_t>(y);
+        float valid = 1.f;
+        for (int x = 0; x < input.cols; ++x)
+            valid = std::min(valid, depth_weight(d[x]));
+        holes = (valid == 0.f);
+    }
+    if (!holes)
+    {
+        if (input.data != output.data)
+            input.copyTo(output);
+        return;
+    }
+
+    // Pull until every pixel of a level has some valid data (or it is a single pixel), then push back down
+    int levels = 0;
+    cv::Size size = input.size();
+    while (holes && (size.width > 1 || size.height > 1))
+    {
+        holes = pull(levels, input);
+        size = m_values[levels].size();
+        ++levels;
+    }
+    for (int level = levels - 1; level >= 0; --level)
+        push(level, input, output);
+}
+
+bool DepthHoleFiller::pull(int level, const cv::Mat& input)
+{
+    if ((int)m_values.size() <= level)
+    {
+        m_values.resize(level + 1);
+        m_weights.resize(level + 1);
+    }
+
+    cv::Size fine = (level == 0) ? input.size() : m_values[level - 1].size();
+    cv::Size coarse((fine.width + 1) / 2, (fine.height + 1) / 2);
+    cv::Mat& values = m_values[level];
+    cv::Mat& weights = m_weights[level];
+    values.create(coarse, CV_32FC1);
+    weights.create(coarse, CV_32FC1);
+
+    // Pairs of columns, the last one is repeated for an odd width
+    int pairs = fine.width / 2;
+    float min_weight = 1.f;
+    for (int y = 0; y < coarse.height; ++y)
+    {
+        int y0 = 2 * y;
+        int y1 = std::min(2 * y + 1, fine.height - 1);
+        float* p = values.ptr<float>(y);
+        float* w = weights.ptr<float>(y);
+
+        if (level == 0)
+        {
+            const uint16_t* d0 = input.ptr<uint16_t>(y0);
+            const uint16_t* d1 = input.ptr<uint16_t>(y1);
+            for (int x = 0; x < pairs; ++x)
+            {
+                float w00 = depth_weight(d0[2 * x]), w01 = depth_weight(d0[2 * x + 1]);
+                float w10 = depth_weight(d1[2 * x]), w11 = depth_weight(d1[2 * x + 1]);
+                p[x] = w00 * d0[2 * x] + w01 * d0[2 * x + 1] + w10 * d1[2 * x] + w11 * d1[2 * x + 1];
+                w[x] = w00 + w01 + w10 + w11;
+            }
+            if (pairs < coarse.width)
+            {
+                int x = pairs;
+                float w00 = depth_weight(d0[2 * x]), w10 = depth_weight(d1[2 * x]);
+                p[x] = 2 * (w00 * d0[2 * x] + w10 * d1[2 * x]);
+                w[x] = 2 * (w00 + w10);
+            }
+        }
+        else
+        {
+            const float* p0 = m_values[level - 1].ptr<float>(y0);
+            const float* p1 = m_values[level - 1].ptr<float>(y1);
+            const float* w0 = m_weights[level - 1].ptr<float>(y0);
+            const float* w1 = m_weights[level - 1].ptr<float>(y1);
+            for (int x = 0; x < pairs; ++x)
+            {
+                p[x] = p0[2 * x] + p0[2 * x + 1] + p1[2 * x] + p1[2 * x + 1];
+                w[x] = w0[2 * x] + w0[2 * x + 1] + w1[2 * x] + w1[2 * x + 1];
+            }
+            if (pairs < coarse.width)
+            {
+                int x = pairs;
+                p[x] = 2 * (p0[2 * x] + p1[2 * x]);
+                w[x] = 2 * (w0[2 * x] + w1[2 * x]);
+            }
+        }
+
+        // Normalized once the weight reaches 1: (sum p / sum w, 1), else kept premultiplied
+        for (int x = 0; x < coarse.width; ++x)
+        {
+            float scale = 1.f / std::max(w[x], 1.f);
+            p[x] *= scale;
+            w[x] = std::min(w[x], 1.f);
+            min_weight = std::min(min_weight, w[x]);
+        }
+    }
+    return min_weight == 0.f;
+}
+
+void DepthHoleFiller::push(int level, const cv::Mat& input, cv::Mat& output)
+{
+    const cv::Mat& coarse_values = m_values[level];
+    const cv::Mat& coarse_weights = m_weights[level];
+    cv::Size coarse = coarse_values.size();
+    cv::Size fine = (level == 0) ? input.size() : m_values[level - 1].size();
+
+    m_row_values.resize(coarse.width + 2);
+    m_row_weights.resize(coarse.width + 2);
+    float* row_p = m_row_values.data() + 1;
+    float* row_w = m_row_weights.data() + 1;
+    int pairs = fine.width / 2;
+
+    for (int y = 0; y < fine.height; ++y)
+    {
+        // Bilinear upsampling by 2: 3/4 of the nearest coarse pixel, 1/4 of the next nearest
+        int i = y / 2;
+        int j = (y % 2 != 0) ? std::min(i + 1, coarse.height - 1) : std::max(i - 1, 0);
+        const float* pi = coarse_values.ptr<float>(i);
+        const float* pj = coarse_values.ptr<float>(j);
+        const float* wi = coarse_weights.ptr<float>(i);
+        const float* wj = coarse_weights.ptr<float>(j);
+        for (int x = 0; x < coarse.width; ++x)
+        {
+            row_p[x] = 0.75f * pi[x] + 0.25f * pj[x];
+            row_w[x] = 0.75f * wi[x] + 0.25f * wj[x];
+        }
+        row_p[-1] = row_p[0];
+        row_w[-1] = row_w[0];
+        row_p[coarse.width] = row_p[coarse.width - 1];
+        row_w[coarse.width] = row_w[coarse.width - 1];
+
+        if (level == 0)
+        {
+            // Valid pixels are copied, holes take the interpolation when there is one
+            const uint16_t* d = input.ptr<uint16_t>(y);
+            uint16_t* out = output.ptr<uint16_t>(y);
+            auto fill_pixel = [&](int x, float up_p, float up_w) {
+                float value = (up_w > 0.f) ? up_p / up_w + 0.5f : (float)d[x];
+                out[x] = (depth_weight(d[x]) != 0.f) ? d[x] : (uint16_t)value;
+            };
+            for (int x = 0; x < pairs; ++x)
+            {
+                fill_pixel(2 * x, 0.75f * row_p[x] + 0.25f * row_p[x - 1], 0.75f * row_w[x] + 0.25f * row_w[x - 1]);
+                fill_pixel(2 * x + 1, 0.75f * row_p[x] + 0.25f * row_p[x + 1], 0.75f * row_w[x] + 0.25f * row_w[x + 1]);
+            }
+            if (pairs < coarse.width)
+                fill_pixel(2 * pairs, 0.75f * row_p[pairs] + 0.25f * row_p[pairs - 1], 0.75f * row_w[pairs] + 0.25f * row_w[pairs - 1]);
+        }
+        else
+        {
+            // Each pixel is completed up to a weight of 1
+            float* p = m_values[level - 1].ptr<float>(y);
+            float* w = m_weights[level - 1].ptr<float>(y);
+            auto fill_pixel = [&](int x, float up_p, float up_w) {
+                float missing = 1.f - w[x];
+                p[x] += missing * up_p;
+                w[x] += missing * up_w;
+            };
+            for (int x = 0; x < pairs; ++x)
+            {
+                fill_pixel(2 * x, 0.75f * row_p[x] + 0.25f * row_p[x - 1], 0.75f * row_w[x] + 0.25f * row_w[x - 1]);
+                fill_pixel(2 * x + 1, 0.75f * row_p[x] + 0.25f * row_p[x + 1], 0.75f * row_w[x] + 0.25f * row_w[x + 1]);
+            }
+            if (pairs < coarse.width)
+                fill_pixel(2 * pairs, 0.75f * row_p[pairs] + 0.25f * row_p[pairs - 1], 0.75f * row_w[pairs] + 0.25f * row_w[pairs - 1]);
+        }
+    }
+}
+
+
+// Columns filtered by each task of the parallel passes
+constexpr static int SMOOTHING_STRIP = 64;
+
+void DepthSmoother::set_parameters(float radius, float range)
+{
+    if (radius < 0 || range <= 0)
+        throw std::invalid_argument("DepthSmoother: invalid radius or range");
+    m_radius = radius;
+    m_range = range;
+    if (radius == 0)
+        return;
+
+    // Spatial extent of the first iteration, halved at each next one (the variances of the
+    // iterations sum to radius^2)
+    double sigma = m_radius * std::sqrt(3.) * std::pow(2., ITERATIONS - 1) / std::sqrt(std::pow(4., ITERATIONS) - 1);
+    double base = std::exp(-std::sqrt(2.) / sigma);
+    m_lut.resize(DEPTH_NO_READING + 1);
+    for (size_t d = 0; d < m_lut.size(); ++d)
+        m_lut[d] = (float)std::pow(base, 1. + m_radius / m_range * d);
+}
+
+// Feedback of the pixels [begin, end) of a row from the previous row, full across a hole
+// (the weights handle them)
+static void feedback_row(const uint16_t* previous, const uint16_t* current, const float* lut, float* feedback, int begin, int end)
+{
+    for (int x = begin; x < end; ++x)
+    {
+        int valid = depth_weight(current[x]) * depth_weight(previous[x]) != 0.f;
+        feedback[x] = lut[valid * std::abs((int)current[x] - (int)previous[x])];
+    }
+}
+
+// Recursive filter step of the pixels [begin, end) of a row from the neighbor row
+template<bool WEIGHTED>
+static void filter_row(float* values, const float* neighbor_values, float* weights, const float* neighbor_weights, const float* feedback, int begin, int end)
+{
+    for (int x = begin; x < end; ++x)
+    {
+        values[x] += feedback[x] * (neighbor_values[x] - values[x]);
+        if constexpr (WEIGHTED)
+            weights[x] += feedback[x] * (neighbor_weights[x] - weights[x]);
+    }
+}
+
+#ifdef KINECT_AVX2_KERNELS
+__attribute__((target("avx2")))
+static void feedback_row_avx2(const uint16_t* previous, const uint16_t* current, const float* lut, float* feedback, int count)
+{
+    // Valid depths are in [1, DEPTH_NO_READING - 1]: depth - 1 in [0, DEPTH_NO_READING - 2]
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256i limit = _mm256_set1_epi32(DEPTH_NO_READING - 1);
+    const __m256i minus_one = _mm256_set1_epi32(-1);
+    int x = 0;
+    for (; x + 8 <= count; x += 8)
+    {
+        __m256i p = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(previous + x)));
+        __m256i c = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(current + x)));
+        __m256i p1 = _mm256_sub_epi32(p, one), c1 = _mm256_sub_epi32(c, one);
+        __m256i valid = _mm256_and_si256(_mm256_and_si256(_mm256_cmpgt_epi32(limit, p1), _mm256_cmpgt_epi32(p1, minus_one)),
+                                         _mm256_and_si256(_mm256_cmpgt_epi32(limit, c1), _mm256_cmpgt_epi32(c1, minus_one)));
+        __m256i index = _mm256_and_si256(_mm256_abs_epi32(_mm256_sub_epi32(c, p)), valid);
+        _mm256_storeu_ps(feedback + x, _mm256_i32gather_ps(lut, index, 4));
+    }
+    feedback_row(previous, current, lut, feedback, x, count);
+}
+
+template<bool WEIGHTED>
+__attribute__((target("avx2")))
+static void filter_row_avx2(float* values, const float* neighbor_values, float* weights, const float* neighbor_weights, const float* feedback, int begin, int end)
+{
+    int x = begin;
+    for (; x + 8 <= end; x += 8)
+    {
+        __m256 a = _mm256_loadu_ps(feedback + x);
+        __m256 p = _mm256_loadu_ps(values + x);
+        p = _mm256_add_ps(p, _mm256_mul_ps(a, _mm256_sub_ps(_mm256_loadu_ps(neighbor_values + x), p)));
+        _mm256_storeu_ps(values + x, p);
+        if constexpr (WEIGHTED)
+        {
+            __m256 w = _mm256_loadu_ps(weights + x);
+            w = _mm256_add_ps(w, _mm256_mul_ps(a, _mm256_sub_ps(_mm256_loadu_ps(neighbor_weights + x), w)));
+            _mm256_storeu_ps(weights + x, w);
+        }
+    }
+    filter_row<WEIGHTED>(values, neighbor_values, weights, neighbor_weights, feedback, x, end);
+}
+
+static const bool smoothing_avx2 = __builtin_cpu_supports("avx2");
+#endif
+
+// Feedback of each pixel from the previous one of its column
+static void column_feedback(const cv::Mat& depth, const float* lut, cv::Mat& feedback)
+{
+    feedback.create(depth.size(), CV_32FC1);
+    std::fill_n(feedback.ptr<float>(0), depth.cols, 0.f);
+    for (int y = 1; y < depth.rows; ++y)
+    {
+#ifdef KINECT_AVX2_KERNELS
+        if (smoothing_avx2)
+        {
+            feedback_row_avx2(depth.ptr<uint16_t>(y - 1), depth.ptr<uint16_t>(y), lut, feedback.ptr<float>(y), depth.cols);
+            continue;
+        }
+#endif
+        feedback_row(depth.ptr<uint16_t>(y - 1), depth.ptr<uint16_t>(y), lut, feedback.ptr<float>(y), 0, depth.cols);
+    }
+}
+
+// Recursive filter down then up the columns [x0, x1)
+template<bool WEIGHTED>
+static void filter_columns(cv::Mat& values, cv::Mat& weights, const cv::Mat& feedback, int x0, int x1)
+{
+    auto step = [&](int y, int neighbor, int feedback_row) {
+        float* w = WEIGHTED ? weights.ptr<float>(y) : nullptr;
+        const float* w_neighbor = WEIGHTED ? weights.ptr<float>(neighbor) : nullptr;
+#ifdef KINECT_AVX2_KERNELS
+        if (smoothing_avx2)
+            return filter_row_avx2<WEIGHTED>(values.ptr<float>(y), values.ptr<float>(neighbor), w, w_neighbor, feedback.ptr<float>(feedback_row), x0, x1);
+#endif
+        filter_row<WEIGHTED>(values.ptr<float>(y), values.ptr<float>(neighbor), w, w_neighbor, feedback.ptr<float>(feedback_row), x0, x1);
+    };
+    for (int y = 1; y < values.rows; ++y)
+        step(y, y - 1, y);
+    for (int y = values.rows - 2; y >= 0; --y)
+        step(y, y + 1, y + 1);
+}
+
+void DepthSmoother::smooth(const cv::Mat& depth, cv::Mat& output)
+{
+    if (depth.type() != CV_16UC1)
+        throw std::invalid_argument("DepthSmoother: expected a CV_16UC1 frame");
+    if (depth.data == output.data)
+        throw std::invalid_argument("DepthSmoother: the output must not be the input");
+
+    output.create(depth.size(), CV_16UC1);
+    if (m_radius <= 0 || depth.empty())
+    {
+        depth.copyTo(output);
+        return;
+    }
+
+    column_feedback(depth, m_lut.data(), m_feedback[0]);
+    cv::transpose(depth, m_transposed);
+    column_feedback(m_transposed, m_lut.data(), m_feedback[1]);
+
+    // Premultiplied values; the weights are only filtered when there are holes
+    bool holes = false;
+    m_values[0].create(depth.size(), CV_32FC1);
+    m_weights[0].create(depth.size(), CV_32FC1);
+    for (int y = 0; y < depth.rows; ++y)
+    {
+        const uint16_t* d = depth.ptr<uint16_t>(y);
+        float* p = m_values[0].ptr<float>(y);
+        float* w = m_weights[0].ptr<float>(y);
+        float valid = 1.f;
+        for (int x = 0; x < depth.cols; ++x)
+        {
+            w[x] = depth_weight(d[x]);
+            p[x] = w[x] * d[x];
+            valid = std::min(valid, w[x]);
+        }
+        holes = holes || (valid == 0.f);
+    }
+
+    int layout = 0;
+    for (int i = 0; i < ITERATIONS; ++i)
+    {
+        // Half the extent of the previous iteration: the feedback is squared
+        if (i > 0)
+            for (cv::Mat& feedback : m_feedback)
+                cv::multiply(feedback, feedback, feedback);
+
+        // Columns of the current layout, then of the transposed one (the rows of the previous)
+        for (int pass = 0; pass < 2; ++pass)
+        {
+            if (pass == 1)
+            {
+                cv::transpose(m_values[layout], m_values[1 - layout]);
+                if (holes)
+                    cv::transpose(m_weights[layout], m_weights[1 - layout]);
+                layout = 1 - layout;
+            }
+
+            cv::Mat& values = m_values[layout];
+            cv::Mat& weights = m_weights[layout];
+            const cv::Mat& feedback = m_feedback[layout];
+            int strips = (values.cols + SMOOTHING_STRIP - 1) / SMOOTHING_STRIP;
+            cv::parallel_for_(cv::Range(0, strips), [&](const cv::Range& range) {
+                int x0 = range.start * SMOOTHING_STRIP;
+                int x1 = std::min(range.end * SMOOTHING_STRIP, values.cols);
+                if (holes)
+                    filter_columns<true>(values, weights, feedback, x0, x1);
+                else
+                    filter_columns<false>(values, weights, feedback, x0, x1);
+            });
+        }
+    }
+    if (layout != 0)
+    {
+        cv::transpose(m_values[layout], m_values[0]);
+        if (holes)
+            cv::transpose(m_weights[layout], m_weights[0]);
+    }
+
+    // Holes keep their value
+    for (int y = 0; y < depth.rows; ++y)
+    {
+        const uint16_t* d = depth.ptr<uint16_t>(y);
+        const float* p = m_values[0].ptr<float>(y);
+        const float* w = m_weights[0].ptr<float>(y);
+        uint16_t* out = output.ptr<uint16_t>(y);
+        for (int x = 0; x < depth.cols; ++x)
+        {
+            float value = holes ? p[x] / std::max(w[x], 1e-6f) : p[x];
+            out[x] = (depth_weight(d[x]) != 0.f) ? (uint16_t)(value + 0.5f) : d[x];
+        }
+    }
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+
+/// \brief Raw depth of the pixels without reading (Kinect shadows, specular spots)
+constexpr uint16_t DEPTH_NO_READING = 2047;
+
+/// \brief Pixels without depth: no reading, or outside the camera frame after H1 (0)
+inline bool is_depth_hole(uint16_t depth)
+{
+    return depth == 0 || depth >= DEPTH_NO_READING;
+}
+
+
+/// \brief How the holes of the depth frames are filled before the rendering
+enum class hole_filling
+{
+    NONE,       // Holes rendered as they are (deepest band)
+    PUSH_PULL,  // Interpolated from the valid pixels around them
+    TEMPORAL,   // Last valid reading of the pixel, interpolated when it never had one
+};
+
+/// \return "none", "push_pull" or "temporal"
+const char* hole_filling_name(hole_filling mode);
+/// \throw std::invalid_argument for an unknown name
+hole_filling parse_hole_filling(const std::string& name);
+
+
+/// \brief Fill the holes of depth frames by push-pull interpolation
+///
+/// Pull: the valid pixels are averaged 2x2 into a pyramid of (premultiplied value, weight)
+/// levels, until every pixel of a level has some valid data. Push: from the coarsest level
+/// down, each level is completed with the bilinear upsampling of the next one, weighted by
+/// its missing weight.
+/// Valid pixels keep their exact value; a hole takes a smooth blend of the nearest valid
+/// pixels, at the scale of its size. The pyramid holds a third of the pixels: the cost is
+/// O(pixels), in float loops the compiler vectorizes, and the buffers are reused.
+class DepthHoleFiller
+{
+    public:
+        void set_mode(hole_filling mode);
+        hole_filling mode() const { return m_mode; }
+
+        /// \brief Fill the holes of a CV_16UC1 frame into \p output (reused, must not be \p depth)
+        ///
+        /// Pixels stay holes only when the whole frame has no valid pixel (and no last reading).
+        void fill(const cv::Mat& depth, cv::Mat& output);
+
+        /// \brief Forget the last readings (TEMPORAL)
+        void reset();
+
+    private:
+        // Compute level + 1 from level (0: the input frame), return true if it has pixels without any valid data
+        bool pull(int level, const cv::Mat& input);
+        // Complete level with level + 1 (0: write the output frame)
+        void push(int level, const cv::Mat& input, cv::Mat& output);
+
+        hole_filling m_mode = hole_filling::PUSH_PULL;
+        // Level l + 1 of the pyramid: premultiplied values and weights (CV_32FC1)
+        std::vector<cv::Mat> m_values;
+        std::vector<cv::Mat> m_weights;
+        // Vertically upsampled row of the coarser level, padded by one pixel on each side
+        std::vector<float> m_row_values;
+        std::vector<float> m_row_weights;
+        cv::Mat m_last;  // Last valid reading of each pixel (TEMPORAL)
+};
+
+
+/// \brief Edge-preserving smoothing of depth frames (domain transform, recursive filter)
+///
+/// Gastal and Oliveira's domain transform: a first-order recursive filter runs down and up
+/// each column, then along each row, for ITERATIONS iterations of decreasing strength. The
+/// feedback between two neighbors decays with their depth difference, so the noise of flat
+/// sand is averaged over about \p radius pixels while ridges sharper than \p range keep
+/// their edge. Holes do not contribute (normalized by the valid weight) and keep their value.
+///
+/// The rows are filtered as columns of the transposed frame: every pass runs over whole rows,
+/// vectorized along x, on strips of columns processed in parallel (cv::parallel_for_).
+class DepthSmoother
+{
+    public:
+        static constexpr int ITERATIONS = 2;
+
+        /// \param radius Spatial extent in pixels (sigma_s), 0 disables the smoothing
+        /// \param range Depth difference preserved as an edge, in raw depth units (sigma_r)
+        void set_parameters(float radius, float range);
+        float radius() const { return m_radius; }
+        float range() const { return m_range; }
+
+        /// \brief Smooth a CV_16UC1 frame into \p output (reused, must not be \p depth)
+        void smooth(const cv::Mat& depth, cv::Mat& output);
+
+    private:
+        float m_radius = 0;
+        float m_range = 10;
+        // Frame and its transposition: values (premultiplied), valid weights, and the feedback
+        // of each pixel from the previous one in its column, for the first iteration
+        cv::Mat m_values[2];
+        cv::Mat m_weights[2];
+        cv::Mat m_feedback[2];
+        cv::Mat m_transposed;
+        std::vector<float> m_lut;  // Feedback of the first iteration for each depth difference
+};
@@ -0,0 +1,115 @@
+#include "depth-kernels.hpp"
+
+#include <algorithm>
+
+
+// WIDTH == 0: generic instantiation, the dimensions are read at runtime
+template <int WIDTH, int HEIGHT>
+static void colorize_lut_kernel(const uint16_t* depth, cv::Vec3b* output, int width, int height, int min_depth, int max_depth)
+{
+    if constexpr (WIDTH > 0)
+    {
+        width = WIDTH;
+        height = HEIGHT;
+    }
+
+    const palette_lut& lut = active_palette_lut(min_depth, max_depth);
+    for (int y = 0; y < height; ++y)
+    {
+        // Phases of the even and odd columns of the row (the same table without dithering)
+        const cv::Vec3b* even = lut.phase(dither_phase(0, y));
+        const cv::Vec3b* odd = lut.phase(dither_phase(1, y));
+        const uint16_t* row = depth + y * width;
+        cv::Vec3b* out = output + y * width;
+
+        int x = 0;
+        for (; x + 2 <= width; x += 2)
+        {
+            out[x] = even[std::min<int>(row[x], PALETTE_DEPTHS - 1)];
+            out[x + 1] = odd[std::min<int>(row[x + 1], PALETTE_DEPTHS - 1)];
+        }
+        if (x < width)
+            out[x] = even[std::min<int>(row[x], PALETTE_DEPTHS - 1)];
+    }
+}
+
+template <int WIDTH, int HEIGHT>
+static void colorize_kernel(const uint16_t* depth, cv::Vec3b* output, int width, int height, int min_depth, int max_depth)
+{
+    if constexpr (WIDTH > 0)
+    {
+        width = WIDTH;
+        height = HEIGHT;
+    }
+
+    std::shared_ptr<const palette> colors = active_palette();
+    for (int y = 0; y < height; ++y)
+    {
+        for (int x = 0; x < width; ++x)
+        {
+            int i = y * width + x;
+            output[i] = palette_color(*colors, palette_height(depth[i], min_depth, max_depth), dither_phase(x, y));
+        }
+    }
+}
+
+// STEP == 0: the step is read at runtime
+template <int WIDTH, int HEIGHT, int STEP>
+static void contour_levels_kernel(const uint16_t* depth, uint8_t* output, int width, int height, int step)
+{
+    if constexpr (STEP > 0)
+    {
+        if (step != STEP)
+            return contour_levels_kernel<WIDTH, HEIGHT, 0>(depth, output, width, height, step);
+        step = STEP;
+    }
+    if constexpr (WIDTH > 0)
+    {
+        width = WIDTH;
+        height = HEIGHT;
+    }
+
+    for (int y = 0; y < height; ++y)
+    {
+        for (int x = 0; x < width; ++x)
+        {
+            int i = y * width + x;
+            output[i] = static_cast<uint8_t>((depth[i] % step) * 255 / step);
+        }
+    }
+}
+
+template <int WIDTH, int HEIGHT>
+static constexpr depth_kernels specialised_kernels(const char* name)
+{
+    return {name, colorize_lut_kernel<WIDTH, HEIGHT>, colorize_kernel<WIDTH, HEIGHT>, contour_levels_kernel<WIDTH, HEIGHT, TerrainRenderer::CONTOUR_STEP>};
+}
+
+static const depth_kernels generic_kernels = {"generic", colorize_lut_kernel<0, 0>, colorize_kernel<0, 0>, contour_levels_kernel<0, 0, 0>};
+
+// Frame sizes of CVKinectCapture::resolution (LOW is also MEDIUM at half resolution)
+static const struct
+{
+    int width;
+    int height;
+    depth_kernels kernels;
+} kinect_kernels[] = {
+    {320, 240, specialised_kernels<320, 240>("320x240")},
+    {640, 480, specialised_kernels<640, 480>("640x480")},
+    {1280, 1024, specialised_kernels<1280, 1024>("1280x1024")},
+};
+
+const depth_kernels& get_depth_kernels(int width, int height)
+{
+    for (auto& k : kinect_kernels)
+    {
+        if (k.width == width && k.height == height)
+            return k.kernels;
+    }
+    return generic_kernels;
+}
+
+const depth_kernels& get_generic_depth_kernels()
+{
+    return generic_kernels;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+
+#include <opencv2/core.hpp>
+
+#include "palette.hpp"
+#include "utils.hpp"
+
+
+/// \brief Per-pixel kernels of the terrain rendering, on contiguous 11-bit depth frames
+///
+/// The kernels are instantiated for the frame size of each Kinect mode (320x240, 640x480 and
+/// 1280x1024, see CVKinectCapture::resolution) and for the contour step of TerrainRenderer:
+/// with constant trip counts, strides and divisors the compiler unrolls and vectorizes the
+/// loops. Any other size (or step) runs the generic instantiation.
+struct depth_kernels
+{
+    const char* name;  // "640x480" or "generic"
+
+    /// \brief Color of each pixel in the active palette, for the calibrated range
+    ///
+    /// One load per pixel from the tables of the palette compiled for the range (see
+    /// active_palette_lut()), alternating the dithering phases along the rows.
+    void (*colorize)(const uint16_t* depth, cv::Vec3b* output, int width, int height, int min_depth, int max_depth);
+
+    /// \brief Reference of colorize(): the palette evaluated for each pixel
+    void (*colorize_float)(const uint16_t* depth, cv::Vec3b* output, int width, int height, int min_depth, int max_depth);
+
+    /// \brief Gray level of each pixel inside its contour band, (depth % step) * 255 / step
+    void (*contour_levels)(const uint16_t* depth, uint8_t* output, int width, int height, int step);
+};
+
+/// \brief Kernels specialised for the frame size, or the generic ones
+const depth_kernels& get_depth_kernels(int width, int height);
+const depth_kernels& get_generic_depth_kernels();
+
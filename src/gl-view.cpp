@@ -0,0 +1,310 @@
+#include "gl-view.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <utility>
+#include "palette.hpp"
+#include "utils.hpp"
+
+// Pas des lignes de niveau (même valeur que process_depth)
+constexpr static float CONTOUR_STEP = 25.f;
+// Le CPU normalise le gradient par son maximum ; ici on utilise une échelle fixe
+constexpr static float SHADING_SCALE = 1.f / 256.f;
+
+
+static const char* vertex_shader = R"(
+#version 330 core
+out vec2 v_uv;
+void main()
+{
+    // Fullscreen triangle
+    vec2 pos = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    v_uv = pos;
+    gl_Position = vec4(pos * 2.0 - 1.0, 0.0, 1.0);
+}
+)";
+
+static const char* fragment_shader = R"(
+#version 330 core
+in vec2 v_uv;
+out vec4 frag_color;
+
+uniform usampler2D u_depth;   // raw depth (11 bits)
+uniform sampler2D u_lut;      // 2048 x 4, raw depth -> color, one row per dithering phase
+uniform sampler2D u_map;      // dense projector map (table coordinates)
+uniform bool u_use_map;
+uniform mat3 u_Hinv;          // projector (or table when u_use_map) -> raw depth
+uniform vec2 u_output_size;
+uniform float u_contour_step;
+uniform float u_shading_scale;
+
+float depth_at(ivec2 p)
+{
+    p = clamp(p, ivec2(0), textureSize(u_depth, 0) - 1);
+    return float(texelFetch(u_depth, p, 0).r);
+}
+
+void main()
+{
+    vec2 p = vec2(v_uv.x, 1.0 - v_uv.y) * u_output_size;
+    vec2 q = u_use_map ? texelFetch(u_map, ivec2(p), 0).rg : p;
+    vec3 s = u_Hinv * vec3(q, 1.0);
+    vec2 src = s.xy / s.z;
+
+    if (any(lessThan(src, vec2(0.0))) || any(greaterThanEqual(src, vec2(textureSize(u_depth, 0)))))
+    {
+        frag_color = vec4(0.0, 0.0, 0.0, 1.0);
+        return;
+    }
+
+    ivec2 c = ivec2(src);
+    float d = depth_at(c);
+    ivec2 f = ivec2(gl_FragCoord.xy);
+    vec3 color = texelFetch(u_lut, ivec2(int(d), (f.y & 1) * 2 + (f.x & 1)), 0).rgb;
+
+    // Contour lines: the band index changes with the right or bottom neighbour
+    float band = floor(d / u_contour_step);
+    if (band != floor(depth_at(c + ivec2(1, 0)) / u_contour_step) ||
+        band != floor(depth_at(c + ivec2(0, 1)) / u_contour_step))
+        color = vec3(0.0);
+
+    // Shading: Sobel gradient magnitude through an approximation of COLORMAP_BONE
+    float tl = depth_at(c + ivec2(-1, -1)), t = depth_at(c + ivec2(0, -1)), tr = depth_at(c + ivec2(1, -1));
+    float l = depth_at(c + ivec2(-1, 0)), r = depth_at(c + ivec2(1, 0));
+    float bl = depth_at(c + ivec2(-1, 1)), b = depth_at(c + ivec2(0, 1)), br = depth_at(c + ivec2(1, 1));
+    float gx = (tr + 2.0 * r + br) - (tl + 2.0 * l + bl);
+    float gy = (bl + 2.0 * b + br) - (tl + 2.0 * t + tr);
+    float g = clamp(length(vec2(gx, gy)) * u_shading_scale, 0.0, 1.0);
+    vec3 bone = vec3(0.875 * g, 0.875 * g, 0.875 * g + 0.125 * g);
+
+    frag_color = vec4(0.7 * color + 0.3 * bone, 1.0);
+}
+)";
+
+
+QGLDepthView::QGLDepthView(QWidget* parent) : QOpenGLWidget(parent)
+{
+    this->setWindowFlags(Qt::Window);
+    this->setWindowState(Qt::WindowFullScreen);
+}
+
+QGLDepthView::~QGLDepthView()
+{
+    if (!m_initialized)
+        return;
+
+    makeCurrent();
+    glDeleteTextures(1, &m_depth_tex);
+    glDeleteTextures(1, &m_lut_tex);
+    glDeleteTextures(1, &m_map_tex);
+    glDeleteBuffers(2, m_pbo);
+    m_vao.destroy();
+    doneCurrent();
+}
+
+void QGLDepthView::initializeGL()
+{
+    initializeOpenGLFunctions();
+    std::cout << "QGLDepthView: " << glGetString(GL_RENDERER) << " (OpenGL " << glGetString(GL_VERSION) << ")" << std::endl;
+
+    if (!m_program.addShaderFromSourceCode(QOpenGLShader::Vertex, vertex_shader) ||
+        !m_program.addShaderFromSourceCode(QOpenGLShader::Fragment, fragment_shader) ||
+        !m_program.link())
+    {
+        std::cerr << m_program.log().toStdString() << std::endl;
+        return;
+    }
+    m_vao.create();
+
+    glGenTextures(1, &m_depth_tex);
+    glGenTextures(1, &m_lut_tex);
+    glGenTextures(1, &m_map_tex);
+    glGenBuffers(2, m_pbo);
+
+    for (GLuint tex : {m_depth_tex, m_lut_tex, m_map_tex})
+    {
+        glBindTexture(GL_TEXTURE_2D, tex);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    m_initialized = true;
+}
+
+void QGLDepthView::allocateDepth(cv::Size size)
+{
+    m_depth_size = size;
+    size_t bytes = size.area() * sizeof(uint16_t);
+    std::vector<uint16_t> zeros(size.area(), 0);
+
+    glBindTexture(GL_TEXTURE_2D, m_depth_tex);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R16UI, size.width, size.height, 0, GL_RED_INTEGER, GL_UNSIGNED_SHORT, zeros.data());
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    for (GLuint pbo : m_pbo)
+    {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, zeros.data(), GL_STREAM_DRAW);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    // The buffers no longer hold a frame
+    std::fill(std::begin(m_pbo_arrival_ns), std::end(m_pbo_arrival_ns), 0);
+}
+
+void QGLDepthView::uploadLut()
+{
+    // Same tables as the CPU colorization, the rows shared without dithering
+    const palette_lut& lut = active_palette_lut(m_min_depth, m_max_depth);
+    std::vector<cv::Vec3b> rows(DITHER_PHASES * PALETTE_DEPTHS);
+    for (int p = 0; p < DITHER_PHASES; ++p)
+        std::copy(lut.phase(p), lut.phase(p) + PALETTE_DEPTHS, rows.begin() + p * PALETTE_DEPTHS);
+
+    glBindTexture(GL_TEXTURE_2D, m_lut_tex);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, PALETTE_DEPTHS, DITHER_PHASES, 0, GL_RGB, GL_UNSIGNED_BYTE, rows.data());
+    glBindTexture(GL_TEXTURE_2D, 0);
+    m_palette_version = lut.version;
+    m_lut_dirty = false;
+}
+
+void QGLDepthView::setCalibration(const cv::Mat& H1, const cv::Mat& H2, const cv::Mat& map_x, const cv::Mat& map_y,
+                                  int min_depth, int max_depth)
+{
+    if (!m_initialized)
+        return;
+
+    if (min_depth != m_min_depth || max_depth != m_max_depth)
+    {
+        m_min_depth = min_depth;
+        m_max_depth = max_depth;
+        m_lut_dirty = true;
+    }
+
+    cv::Mat H = cv::Mat::eye(3, 3, CV_64F);
+    if (!H1.empty())
+        H = H1 * H;
+    m_use_map = !map_x.empty();
+    if (!m_use_map && !H2.empty())
+        H = H2 * H;
+
+    cv::Mat Hinv = H.inv();
+    float values[9];
+    for (int i = 0; i < 9; ++i)
+        values[i] = (float)Hinv.at<double>(i / 3, i % 3);
+    m_Hinv = QMatrix3x3(values);
+
+    if (m_use_map && map_x.data != m_map_data)
+    {
+        cv::Mat map;
+        cv::merge(std::vector<cv::Mat>{map_x, map_y}, map);
+
+        makeCurrent();
+        glBindTexture(GL_TEXTURE_2D, m_map_tex);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32F, map.cols, map.rows, 0, GL_RG, GL_FLOAT, map.data);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        doneCurrent();
+
+        m_map_data = map_x.data;
+        m_output_size = map.size();
+    }
+}
+
+void QGLDepthView::setDepth(const cv::Mat& depth, uint64_t arrival_ns)
+{
+    if (!m_initialized)
+        return;
+
+    m_upload_timer.start();
+    cv::Mat input = depth.isContinuous() ? depth : depth.clone();
+    size_t bytes = input.total() * input.elemSize();
+
+    makeCurrent();
+    if (input.size() != m_depth_size)
+        allocateDepth(input.size());
+
+    int upload = m_pbo_index;
+    int write = m_pbo_index = (m_pbo_index + 1) % 2;
+
+    // Update the texture from the buffer filled at the previous frame (asynchronous copy)
+    glBindTexture(GL_TEXTURE_2D, m_depth_tex);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_pbo[upload]);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_depth_size.width, m_depth_size.height, GL_RED_INTEGER, GL_UNSIGNED_SHORT, nullptr);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    m_frame_id = m_pbo_frame_id[upload];
+    m_arrival_ns = m_pbo_arrival_ns[upload];
+
+    // Copy the new frame in the other buffer (orphaned to avoid waiting for the GPU)
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_pbo[write]);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, nullptr, GL_STREAM_DRAW);
+    void* ptr = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    if (ptr != nullptr)
+    {
+        std::memcpy(ptr, input.data, bytes);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    doneCurrent();
+    m_upload_timer.stop();
+    m_pbo_frame_id[write] = trace_current_frame();
+    m_pbo_arrival_ns[write] = arrival_ns;
+
+    this->update();
+}
+
+void QGLDepthView::paintGL()
+{
+    glClearColor(0.f, 0.f, 0.f, 1.f);
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    if (!m_initialized || m_depth_size.empty())
+        return;
+
+    TraceFrameScope frame(m_frame_id);
+    m_paint_timer.start();
+    trace_frame_flow(trace_phase::FLOW_END);
+    if (m_lut_dirty || m_palette_version != active_palette_version())
+        uploadLut();
+
+    cv::Size output_size = m_use_map ? m_output_size : m_depth_size;
+
+    // Keep aspect ratio and center the frame
+    qreal dpr = this->devicePixelRatio();
+    QSize widget_size = this->size() * dpr;
+    QSize scaled = QSize(output_size.width, output_size.height).scaled(widget_size, Qt::KeepAspectRatio);
+    glViewport((widget_size.width() - scaled.width()) / 2, (widget_size.height() - scaled.height()) / 2,
+               scaled.width(), scaled.height());
+
+    m_program.bind();
+    m_program.setUniformValue("u_depth", 0);
+    m_program.setUniformValue("u_lut", 1);
+    m_program.setUniformValue("u_map", 2);
+    m_program.setUniformValue("u_use_map", (GLint) m_use_map);
+    m_program.setUniformValue("u_Hinv", m_Hinv);
+    m_program.setUniformValue("u_output_size", QVector2D(output_size.width, output_size.height));
+    m_program.setUniformValue("u_contour_step", CONTOUR_STEP);
+    m_program.setUniformValue("u_shading_scale", SHADING_SCALE);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, m_depth_tex);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, m_lut_tex);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D, m_map_tex);
+
+    m_vao.bind();
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    m_vao.release();
+    m_program.release();
+
+    // Wait for the rasterizer so that the timer measures the real frame cost
+    glFinish();
+    m_paint_timer.stop();
+
+    // Only the first paint of a frame presents it (not the repaints of the window)
+    if (m_arrival_ns != 0)
+        depth_frame_presented(std::exchange(m_arrival_ns, 0));
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <QtGui>
+#include <QtWidgets>
+#include <QOpenGLWidget>
+#include <QOpenGLExtraFunctions>
+#include <QOpenGLShaderProgram>
+#include <QOpenGLVertexArrayObject>
+
+#include <opencv2/core.hpp>
+
+#include "raster-view.hpp"
+
+
+/// \brief Fullscreen OpenGL output: colormap, contours, shading and warp in a fragment shader
+///
+/// The CPU only uploads the raw 16-bit depth, through two pixel buffer objects used
+/// alternately: the texture is updated from the buffer filled at the previous frame
+/// while the new frame is copied in the other one (one frame of latency, no stall).
+/// Requires OpenGL 3.3 core, which Mesa's llvmpipe provides on machines without GPU.
+class QGLDepthView : public QOpenGLWidget, protected QOpenGLExtraFunctions
+{
+    public:
+        QGLDepthView(QWidget* parent = nullptr);
+        ~QGLDepthView();
+
+        /// \brief Set the calibration used by the shader
+        /// \param H1 Box homography (raw depth -> table)
+        /// \param H2 Projector homography (table -> projector)
+        /// \param map_x, map_y Optional dense projector map (replaces H2 when set)
+        void setCalibration(const cv::Mat& H1, const cv::Mat& H2, const cv::Mat& map_x, const cv::Mat& map_y,
+                            int min_depth, int max_depth);
+
+        /// \brief Upload a raw depth frame (CV_16UC1) and schedule a repaint
+        /// \param arrival_ns Arrival time of the frame (depth_frame_arrival()), its end-to-end
+        /// latency is recorded once it is drawn (0: not recorded)
+        void setDepth(const cv::Mat& depth, uint64_t arrival_ns = 0);
+
+    protected:
+        void initializeGL() override;
+        void paintGL() override;
+
+    private:
+        void allocateDepth(cv::Size size);
+        void uploadLut();
+
+        bool m_initialized = false;
+        QOpenGLShaderProgram m_program;
+        QOpenGLVertexArrayObject m_vao;
+
+        GLuint m_depth_tex = 0;
+        GLuint m_lut_tex = 0;
+        GLuint m_map_tex = 0;
+        GLuint m_pbo[2] = {0, 0};
+        int m_pbo_index = 0;
+        uint64_t m_pbo_frame_id[2] = {0, 0};    // Frame copied in each buffer
+        uint64_t m_pbo_arrival_ns[2] = {0, 0};
+        cv::Size m_depth_size;
+        uint64_t m_frame_id = 0;  // Frame in the depth texture (trace)
+        uint64_t m_arrival_ns = 0;  // Of the frame in the depth texture, until it is drawn
+
+        // Calibration state
+        QMatrix3x3 m_Hinv;
+        cv::Size m_output_size;
+        bool m_use_map = false;
+        const uchar* m_map_data = nullptr;
+        int m_min_depth = -1, m_max_depth = -1;
+        bool m_lut_dirty = true;
+        uint64_t m_palette_version = 0;     // Active palette of the lookup texture
+
+        FrameTimer m_upload_timer{"gl.upload"};
+        FrameTimer m_paint_timer{"gl.paint"};
+};
@@ -0,0 +1,104 @@
+// Read the metrics of a running sandbox from its Unix-domain socket
+//
+//   metrics-client [--check] [socket]
+//
+// Prints the report. With --check, also verifies that every sample line is `name{labels} value`
+// with a numeric value and that the frame counters are present; the exit code is 1 otherwise.
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+constexpr static const char* DEFAULT_SOCKET = "/tmp/kinect-sandbox.sock";
+
+static bool read_report(const std::string& path, std::string& report)
+{
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path))
+        return false;
+    std::strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return false;
+    if (connect(fd, (sockaddr*)&address, sizeof(address)) < 0)
+    {
+        close(fd);
+        return false;
+    }
+
+    char buffer[4096];
+    ssize_t n;
+    while ((n = read(fd, buffer, sizeof(buffer))) > 0)
+        report.append(buffer, n);
+    close(fd);
+    return n == 0;
+}
+
+static bool check_report(const std::string& report)
+{
+    std::istringstream lines(report);
+    std::string line;
+    int samples = 0;
+    bool ok = true;
+    bool has_depth_frames = false;
+
+    while (std::getline(lines, line))
+    {
+        if (line.empty() || line[0] == '#')
+            continue;
+
+        auto space = line.rfind(' ');
+        std::string name = line.substr(0, std::min(line.find('{'), space));
+        char* end = nullptr;
+        std::string value = (space == std::string::npos) ? "" : line.substr(space + 1);
+        std::strtod(value.c_str(), &end);
+        if (name.empty() || value.empty() || *end != '\0')
+        {
+            std::cerr << "Invalid sample: " << line << std::endl;
+            ok = false;
+        }
+        has_depth_frames |= (name == "kinect_depth_frames_total");
+        ++samples;
+    }
+
+    if (!has_depth_frames)
+    {
+        std::cerr << "Missing kinect_depth_frames_total" << std::endl;
+        ok = false;
+    }
+    std::cerr << samples << " samples" << (ok ? ", OK" : "") << std::endl;
+    return ok;
+}
+
+int main(int argc, char** argv)
+{
+    bool check = false;
+    std::string path = DEFAULT_SOCKET;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::strcmp(argv[i], "--check") == 0)
+            check = true;
+        else
+            path = argv[i];
+    }
+
+    std::string report;
+    if (!read_report(path, report))
+    {
+        std::cerr << "Failed to read the metrics from " << path << ": " << std::strerror(errno) << std::endl;
+        return 1;
+    }
+
+    std::cout << report;
+    if (check && !check_report(report))
+        return 1;
+    return 0;
+}
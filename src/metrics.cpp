@@ -0,0 +1,311 @@
+#include "metrics.hpp"
+#include "profiling.hpp"
+
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+template <class T>
+struct named_metric
+{
+    std::string name;
+    std::string help;
+    T metric;
+};
+
+// std::deque keeps the addresses stable when growing
+static std::mutex registry_mutex;
+static std::deque<named_metric<MetricCounter>> counters;
+static std::deque<named_metric<MetricGauge>> gauges;
+
+static MetricCounter& depth_frames = get_metric_counter("kinect_depth_frames_total", "Depth frames received");
+static MetricCounter& depth_dropped = get_metric_counter("kinect_depth_dropped_frames_total", "Depth frames lost before the capture callback");
+static MetricCounter& rgb_frames = get_metric_counter("kinect_rgb_frames_total", "RGB frames received");
+static MetricGauge& depth_fps = get_metric_gauge("kinect_depth_fps", "Depth frames per second (last second)");
+static MetricGauge& rgb_fps = get_metric_gauge("kinect_rgb_fps", "RGB frames per second (last second)");
+
+
+template <class T>
+static T& get_metric(std::deque<named_metric<T>>& registry, const std::string& name, const std::string& help)
+{
+    std::lock_guard lock(registry_mutex);
+    for (auto& m : registry)
+        if (m.name == name)
+            return m.metric;
+
+    registry.emplace_back();
+    registry.back().name = name;
+    registry.back().help = help;
+    return registry.back().metric;
+}
+
+MetricCounter& get_metric_counter(const std::string& name, const std::string& help)
+{
+    return get_metric(counters, name, help);
+}
+
+MetricGauge& get_metric_gauge(const std::string& name, const std::string& help)
+{
+    return get_metric(gauges, name, help);
+}
+
+
+void metrics_depth_frame(uint32_t device_timestamp)
+{
+    // Only called from the capture callback
+    static uint32_t last_timestamp = 0;
+    static double period = 0;
+
+    if (depth_frames.value() > 0)
+    {
+        uint32_t delta = device_timestamp - last_timestamp;
+        if (period == 0)
+            period = delta;
+        else if (delta > 1.5 * period)
+            depth_dropped.add((uint64_t)(delta / period + 0.5) - 1);
+        else
+            period = 0.9 * period + 0.1 * delta;
+    }
+    last_timestamp = device_timestamp;
+    depth_frames.add();
+}
+
+void metrics_rgb_frame()
+{
+    rgb_frames.add();
+}
+
+
+// Per thread CPU time from /proc/self/task/<tid>/stat
+static void write_thread_cpu(std::ostream& out)
+{
+    out << "# HELP kinect_thread_cpu_seconds_total CPU time (user + system) of the threads\n"
+        << "# TYPE kinect_thread_cpu_seconds_total counter\n";
+
+    const double ticks = (double)sysconf(_SC_CLK_TCK);
+    std::error_code ec;
+    for (auto& task : std::filesystem::directory_iterator("/proc/self/task", ec))
+    {
+        std::ifstream stat(task.path() / "stat");
+        std::string line;
+        if (!std::getline(stat, line))
+            continue;
+
+        // pid (comm) state ppid ... utime stime: the name may contain spaces
+        auto open = line.find('(');
+        auto close = line.rfind(')');
+        if (open == std::string::npos || close == std::string::npos)
+            continue;
+
+        std::string name = line.substr(open + 1, close - open - 1);
+        std::istringstream fields(line.substr(close + 2));
+        std::string field;
+        uint64_t utime = 0, stime = 0;
+        for (int i = 3; i <= 15 && fields >> field; ++i)
+        {
+            if (i == 14)
+                utime = std::stoull(field);
+            else if (i == 15)
+                stime = std::stoull(field);
+        }
+
+        for (auto& c : name)
+            if (c == '"' || c == '\\')
+                c = '_';
+        out << "kinect_thread_cpu_seconds_total{thread=\"" << name << "\",tid=\"" << task.path().filename().string()
+            << "\"} " << (utime + stime) / ticks << '\n';
+    }
+}
+
+static void write_stage_latencies(std::ostream& out)
+{
+    out << "# HELP kinect_stage_latency_seconds Latency of the pipeline stages\n"
+        << "# TYPE kinect_stage_latency_seconds summary\n";
+
+    auto histograms = get_latency_histograms();
+    for (auto& [name, histogram] : histograms)
+    {
+        auto s = histogram->summarize();
+        const std::pair<const char*, uint64_t> quantiles[] = {{"0.5", s.p50}, {"0.95", s.p95}, {"0.99", s.p99}, {"1", s.max}};
+        for (auto& [q, value] : quantiles)
+            out << "kinect_stage_latency_seconds{stage=\"" << name << "\",quantile=\"" << q << "\"} " << value / 1e9 << '\n';
+        out << "kinect_stage_latency_seconds_count{stage=\"" << name << "\"} " << s.count << '\n';
+    }
+}
+
+std::string metrics_report()
+{
+    std::ostringstream out;
+    out << std::setprecision(9);
+
+    {
+        std::lock_guard lock(registry_mutex);
+        for (auto& c : counters)
+            out << "# HELP " << c.name << ' ' << c.help << "\n# TYPE " << c.name << " counter\n"
+                << c.name << ' ' << c.metric.value() << '\n';
+        for (auto& g : gauges)
+            out << "# HELP " << g.name << ' ' << g.help << "\n# TYPE " << g.name << " gauge\n"
+                << g.name << ' ' << g.metric.value() << '\n';
+    }
+
+    write_stage_latencies(out);
+    write_thread_cpu(out);
+    return out.str();
+}
+
+
+struct MetricsServer::impl
+{
+    std::string path;
+    int listen_fd = -1;
+    int wake_pipe[2] = {-1, -1};
+    std::thread thread;
+
+    void run();
+    void serve(int fd);
+    void update_rates(double seconds);
+
+    uint64_t last_depth_frames = 0;
+    uint64_t last_rgb_frames = 0;
+};
+
+void MetricsServer::impl::serve(int fd)
+{
+    // A slow client must not block the updates of the rates
+    timeval timeout = {1, 0};
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    std::string report = metrics_report();
+    size_t sent = 0;
+    while (sent < report.size())
+    {
+        ssize_t n = send(fd, report.data() + sent, report.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0)
+            break;
+        sent += n;
+    }
+    close(fd);
+}
+
+void MetricsServer::impl::update_rates(double seconds)
+{
+    uint64_t depth = depth_frames.value();
+    uint64_t rgb = rgb_frames.value();
+    depth_fps.set((depth - last_depth_frames) / seconds);
+    rgb_fps.set((rgb - last_rgb_frames) / seconds);
+    last_depth_frames = depth;
+    last_rgb_frames = rgb;
+}
+
+void MetricsServer::impl::run()
+{
+    pthread_setname_np(pthread_self(), "kinect-metrics");
+
+    using clock = std::chrono::steady_clock;
+    auto last_update = clock::now();
+    last_depth_frames = depth_frames.value();
+    last_rgb_frames = rgb_frames.value();
+
+    while (true)
+    {
+        pollfd fds[2] = {{listen_fd, POLLIN, 0}, {wake_pipe[0], POLLIN, 0}};
+        int ready = poll(fds, 2, 1000);
+
+        if (fds[1].revents != 0)
+            return;
+
+        auto now = clock::now();
+        double elapsed = std::chrono::duration<double>(now - last_update).count();
+        if (elapsed >= 1.0)
+        {
+            update_rates(elapsed);
+            last_update = now;
+        }
+
+        if (ready > 0 && (fds[0].revents & POLLIN))
+        {
+            int fd = accept(listen_fd, nullptr, nullptr);
+            if (fd >= 0)
+                serve(fd);
+        }
+    }
+}
+
+
+MetricsServer::MetricsServer() : m_impl(std::make_unique<impl>())
+{
+}
+
+MetricsServer::~MetricsServer()
+{
+    stop();
+}
+
+bool MetricsServer::is_running() const
+{
+    return m_impl->thread.joinable();
+}
+
+void MetricsServer::start(const std::string& path)
+{
+    stop();
+
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path))
+        throw std::runtime_error("Metrics socket path too long: " + path);
+    std::strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        throw std::runtime_error("Failed to create the metrics socket");
+
+    unlink(path.c_str());
+    if (bind(fd, (sockaddr*)&address, sizeof(address)) < 0 || listen(fd, 4) < 0)
+    {
+        close(fd);
+        throw std::runtime_error("Failed to listen on " + path + ": " + std::strerror(errno));
+    }
+
+    if (pipe(m_impl->wake_pipe) < 0)
+    {
+        close(fd);
+        unlink(path.c_str());
+        throw std::runtime_error("Failed to create the metrics server pipe");
+    }
+
+    m_impl->path = path;
+    m_impl->listen_fd = fd;
+    m_impl->thread = std::thread([impl = m_impl.get()]() { impl->run(); });
+}
+
+void MetricsServer::stop()
+{
+    if (!m_impl->thread.joinable())
+        return;
+
+    char c = 0;
+    ssize_t written = write(m_impl->wake_pipe[1], &c, 1);
+    (void)written;
+    m_impl->thread.join();
+
+    close(m_impl->listen_fd);
+    close(m_impl->wake_pipe[0]);
+    close(m_impl->wake_pipe[1]);
+    unlink(m_impl->path.c_str());
+    m_impl->listen_fd = -1;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+
+/// \brief Monotonic counter, incremented from any thread without lock
+class MetricCounter
+{
+    public:
+        void add(uint64_t n = 1) { m_value.fetch_add(n, std::memory_order_relaxed); }
+        uint64_t value() const { return m_value.load(std::memory_order_relaxed); }
+
+    private:
+        std::atomic<uint64_t> m_value = {0};
+};
+
+/// \brief Value that can go up and down, set from any thread without lock
+class MetricGauge
+{
+    public:
+        void set(double value) { m_value.store(value, std::memory_order_relaxed); }
+        double value() const { return m_value.load(std::memory_order_relaxed); }
+
+    private:
+        std::atomic<double> m_value = {0};
+};
+
+
+/// \brief Return the metric registered under \p name (created on first use, never destroyed)
+///
+/// Keep the reference: the registration takes a lock, the updates do not.
+MetricCounter& get_metric_counter(const std::string& name, const std::string& help);
+MetricGauge& get_metric_gauge(const std::string& name, const std::string& help);
+
+/// \brief Format all the metrics in the Prometheus text exposition format
+///
+/// Besides the registered counters and gauges, it exports the frame rates, the stage latency
+/// histograms (as summaries, in seconds) and the CPU time of every thread of the process.
+std::string metrics_report();
+
+/// \brief Count a depth frame and the frames dropped before it (from the gaps in the device timestamps)
+void metrics_depth_frame(uint32_t device_timestamp);
+/// \brief Count an RGB frame
+void metrics_rgb_frame();
+
+
+/// \brief Serve metrics_report() on a Unix-domain socket, from a background thread
+///
+/// Every connection receives the current report, then the socket is closed:
+///
+///     socat - UNIX-CONNECT:/tmp/kinect-sandbox.sock
+///
+/// The thread also updates the frame rate gauges every second.
+class MetricsServer
+{
+    public:
+        MetricsServer();
+        ~MetricsServer();
+
+        /// \brief Listen on \p path (an existing socket file is replaced)
+        /// \throw std::runtime_error if the socket cannot be created
+        void start(const std::string& path);
+        void stop();
+
+        bool is_running() const;
+
+    private:
+        struct impl;
+        std::unique_ptr<impl> m_impl;
+};
@@ -0,0 +1,156 @@
+#include "occlusion.hpp"
+#include "depth-filters.hpp"
+#include "profiling.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+#include <opencv2/imgproc.hpp>
+
+
+// Pixels [0, count) of a row: frames left of each occluder, and the previous frame
+static void classify_row(const uint16_t* depth, uint16_t* previous, uint8_t* hold, int count, int limit, int motion)
+{
+    for (int x = 0; x < count; ++x)
+    {
+        int d = depth[x];
+        int p = previous[x];
+        // Holes are never occluders, and a reading after a hole is not a move
+        bool above = d != 0 && d < limit;
+        bool moving = p != 0 && p < DEPTH_NO_READING && std::abs(d - p) > motion;
+        int h = hold[x];
+        h = moving ? OcclusionFilter::HOLD_FRAMES : h - (h > 0);
+        hold[x] = (uint8_t)(above ? h : 0);
+        previous[x] = (uint16_t)d;
+    }
+}
+
+void OcclusionFilter::set_parameters(int height, int motion)
+{
+    if (height < 0 || motion < 1)
+        throw std::invalid_argument("OcclusionFilter: invalid height or motion");
+    m_height = height;
+    m_motion = motion;
+}
+
+void OcclusionFilter::classify(const cv::Mat& depth, int ty0, int ty1, int limit)
+{
+    int width = depth.cols;
+    for (int ty = ty0; ty < ty1; ++ty)
+    {
+        uint8_t* occluded = m_occluded.ptr<uint8_t>(ty);
+        std::fill(occluded, occluded + m_occluded.cols, 0);
+        int y1 = std::min((ty + 1) * TILE_SIZE, depth.rows);
+        for (int y = ty * TILE_SIZE; y < y1; ++y)
+        {
+            uint8_t* hold = m_hold.ptr<uint8_t>(y);
+            classify_row(depth.ptr<uint16_t>(y), m_previous.ptr<uint16_t>(y), hold, width, limit, m_motion);
+            for (int tx = 0; tx < m_occluded.cols; ++tx)
+            {
+                uint8_t any = 0;
+                for (int x = tx * TILE_SIZE, x1 = std::min(x + TILE_SIZE, width); x < x1; ++x)
+                    any |= hold[x];
+                occluded[tx] |= any;
+            }
+        }
+    }
+}
+
+void OcclusionFilter::update(const cv::Mat& depth, int ty0, int ty1)
+{
+    int width = depth.cols;
+    for (int ty = ty0; ty < ty1; ++ty)
+    {
+        const uint8_t* held = m_held.ptr<uint8_t>(ty);
+        int y1 = std::min((ty + 1) * TILE_SIZE, depth.rows);
+        for (int y = ty * TILE_SIZE; y < y1; ++y)
+        {
+            const uint16_t* input = depth.ptr<uint16_t>(y);
+            uint16_t* stable = m_stable.ptr<uint16_t>(y);
+            uint8_t* live = m_live.ptr<uint8_t>(y);
+            for (int tx = 0; tx < m_held.cols; ++tx)
+            {
+                int x = tx * TILE_SIZE;
+                int count = std::min(TILE_SIZE, width - x);
+                if (!held[tx])
+                    std::memcpy(stable + x, input + x, count * sizeof(uint16_t));
+                std::memset(live + x, held[tx] ? 0 : 255, count);
+            }
+        }
+    }
+}
+
+const cv::Mat& OcclusionFilter::filter(const cv::Mat& depth, int surface_depth)
+{
+    PROFILE_SCOPE("occlusion");
+    if (depth.type() != CV_16UC1)
+        throw std::invalid_argument("OcclusionFilter: expected a CV_16UC1 frame");
+
+    cv::Size tiles((depth.cols + TILE_SIZE - 1) / TILE_SIZE, (depth.rows + TILE_SIZE - 1) / TILE_SIZE);
+    if (m_previous.size() != depth.size())
+    {
+        // First frame: nothing moved yet
+        depth.copyTo(m_previous);
+        depth.copyTo(m_stable);
+        m_hold = cv::Mat::zeros(depth.size(), CV_8UC1);
+        m_occluded = cv::Mat::zeros(tiles, CV_8UC1);
+        m_held = cv::Mat::zeros(tiles, CV_8UC1);
+        m_live = cv::Mat(depth.size(), CV_8UC1, cv::Scalar(255));
+        m_held_count = 0;
+        return m_stable;
+    }
+
+    // Above the sand: closer to the camera than its top (no pixel when height is 0)
+    int limit = (m_height > 0) ? surface_depth - m_height : 0;
+    cv::parallel_for_(cv::Range(0, tiles.height), [&](const cv::Range& range) {
+        classify(depth, range.start, range.end, limit);
+    });
+
+    // The 3x3 dilation of the tile grid adds the edges of the arm and its shadow
+    cv::dilate(m_occluded, m_held, cv::Mat());
+    m_held_count = cv::countNonZero(m_held);
+
+    cv::parallel_for_(cv::Range(0, tiles.height), [&](const cv::Range& range) {
+        update(depth, range.start, range.end);
+    });
+    return m_stable;
+}
+
+cv::Rect OcclusionFilter::live_bounds() const
+{
+    if (m_held.empty())
+        return cv::Rect();
+    if (m_held_count == 0)
+        return cv::Rect(0, 0, m_stable.cols, m_stable.rows);
+
+    int x0 = m_held.cols, y0 = m_held.rows, x1 = -1, y1 = -1;
+    for (int ty = 0; ty < m_held.rows; ++ty)
+    {
+        const uint8_t* held = m_held.ptr<uint8_t>(ty);
+        for (int tx = 0; tx < m_held.cols; ++tx)
+        {
+            if (held[tx])
+                continue;
+            x0 = std::min(x0, tx);
+            x1 = std::max(x1, tx);
+            y0 = std::min(y0, ty);
+            y1 = std::max(y1, ty);
+        }
+    }
+    if (x1 < 0)
+        return cv::Rect();
+
+    cv::Rect tiles(x0 - 1, y0 - 1, x1 - x0 + 3, y1 - y0 + 3);
+    cv::Rect bounds(tiles.x * TILE_SIZE, tiles.y * TILE_SIZE, tiles.width * TILE_SIZE, tiles.height * TILE_SIZE);
+    return bounds & cv::Rect(0, 0, m_stable.cols, m_stable.rows);
+}
+
+void OcclusionFilter::reset()
+{
+    m_previous.release();
+    m_held.release();
+    m_live.release();
+    m_held_count = 0;
+}
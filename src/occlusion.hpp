@@ -0,0 +1,64 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+
+
+/// \brief Hold the terrain under the hands and arms reaching into the sandbox
+///
+/// A pixel is an occluder when its depth is more than \p height raw units above the top of
+/// the sand (calibrated min_depth) and it moved by more than \p motion raw units since the
+/// previous frame; it stays one for HOLD_FRAMES frames after its last move, as long as it is
+/// above the sand. The frame is cut in tiles of TILE_SIZE pixels: the tiles with an occluder,
+/// dilated by one tile (the edges and the shadow of the arm), keep their last stable depth.
+/// Their terrain and contour lines stay as they were, and the renderer does not recompute
+/// their contours (see live_bounds()).
+///
+/// The classification is one branchless pass over the rows, on tiles of rows processed in
+/// parallel (cv::parallel_for_); the dilation runs on the tile grid (40x30 at 640x480).
+class OcclusionFilter
+{
+    public:
+        static constexpr int TILE_SIZE = 16;
+        /// \brief Frames an occluder stays one without moving (1 s at 30 fps)
+        static constexpr int HOLD_FRAMES = 30;
+
+        /// \param height Raw depth above the sand of an occluder, 0 disables the filter
+        /// \param motion Raw depth change between two frames of an occluder
+        /// \throw std::invalid_argument for a negative height or a motion below 1
+        void set_parameters(int height, int motion);
+        int height() const { return m_height; }
+        int motion() const { return m_motion; }
+
+        /// \brief Hold the occluded tiles of a CV_16UC1 frame
+        /// \param surface_depth Raw depth of the top of the sand
+        /// \return The frame with the held tiles (buffer of the filter, valid until the next call)
+        const cv::Mat& filter(const cv::Mat& depth, int surface_depth);
+
+        /// \brief Number of tiles held by the last filter()
+        int held_tiles() const { return m_held_count; }
+        /// \brief CV_8UC1 mask of the last filtered frame, 255 on the pixels of tiles not held
+        const cv::Mat& live_mask() const { return m_live; }
+        /// \brief Tiles not held, grown by one tile and clipped to the frame (empty if all held)
+        ///
+        /// Neighborhood filters (Canny) run on this rectangle, the held tiles keep their result.
+        cv::Rect live_bounds() const;
+
+        /// \brief Forget the previous frame and the held depth
+        void reset();
+
+    private:
+        // Classify the pixels of the tile rows [ty0, ty1), mark the tiles with an occluder
+        void classify(const cv::Mat& depth, int ty0, int ty1, int limit);
+        // Copy the tiles not held of the tile rows [ty0, ty1) into the stable frame
+        void update(const cv::Mat& depth, int ty0, int ty1);
+
+        int m_height = 0;
+        int m_motion = 6;
+        cv::Mat m_previous;     // Last raw frame
+        cv::Mat m_hold;         // Frames left of each occluder pixel (CV_8UC1)
+        cv::Mat m_occluded;     // Tiles with an occluder (CV_8UC1, one pixel per tile)
+        cv::Mat m_held;         // m_occluded dilated by one tile
+        cv::Mat m_stable;       // Output: last depth of the held tiles, input elsewhere
+        cv::Mat m_live;
+        int m_held_count = 0;
+};
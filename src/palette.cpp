@@ -0,0 +1,215 @@
+#include "palette.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <mutex>
+#include <stdexcept>
+
+
+const char* palette_interpolation_name(palette_interpolation interpolation)
+{
+    switch (interpolation)
+    {
+        case palette_interpolation::STEP:
+            return "step";
+        case palette_interpolation::LINEAR:
+            return "linear";
+    }
+    return "";
+}
+
+palette_interpolation parse_palette_interpolation(const std::string& name)
+{
+    for (auto interpolation : {palette_interpolation::STEP, palette_interpolation::LINEAR})
+        if (name == palette_interpolation_name(interpolation))
+            return interpolation;
+    throw std::invalid_argument("unknown palette interpolation " + name);
+}
+
+
+// Former hardcoded ladder: each color up to the height of its stop, black beyond 200
+const palette& default_palette()
+{
+    static const palette ladder = {{
+        {-220.0f, {80, 0, 0}},          // Noir
+        {-200.0f, {80, 0, 0}},          // Marron foncé
+        {-150.0f, {102, 50, 0}},        // Marron
+        {-125.0f, {160, 108, 19}},      // Ocre foncé
+        {-100.5f, {205, 140, 24}},      // Ocre clair
+        {-90.5f, {250, 206, 135}},      // Beige clair
+        {-88.5f, {255, 226, 176}},      // Sable
+        {-80.0f, {71, 97, 0}},          // Vert foncé
+        {5.0f, {47, 122, 16}},          // Vert herbe foncé
+        {15.0f, {60, 180, 40}},         // Vert vif
+        {25.0f, {90, 220, 80}},         // Vert clair
+        {30.0f, {240, 240, 60}},        // Jaune clair
+        {35.0f, {255, 255, 160}},       // Jaune sable
+        {40.0f, {255, 255, 255}},       // Blanc
+        {170.0f, {0, 67, 161}},         // Bleu profond
+        {200.0f, {30, 30, 130}},        // Bleu foncé
+        {220.0f, {0, 0, 0}},            // Au-delà
+    }};
+    return ladder;
+}
+
+
+static bool read_color(const cv::FileNode& node, cv::Vec3b& color)
+{
+    std::vector<int> rgb;
+    node >> rgb;
+    if (rgb.size() != 3)
+        return false;
+    for (int c = 0; c < 3; ++c)
+    {
+        if (rgb[c] < 0 || rgb[c] > 255)
+            return false;
+        color[c] = (uint8_t)rgb[c];
+    }
+    return true;
+}
+
+palette load_palette(const std::string& filename)
+{
+    cv::FileStorage fs(filename, cv::FileStorage::READ);
+    if (!fs.isOpened())
+        throw std::runtime_error("Failed to open palette " + filename);
+
+    palette colors;
+    if (!fs["interpolation"].empty())
+    {
+        try
+        {
+            colors.interpolation = parse_palette_interpolation((std::string)fs["interpolation"]);
+        }
+        catch (const std::invalid_argument& e)
+        {
+            throw std::runtime_error(filename + ": " + e.what());
+        }
+    }
+    if (!fs["dither"].empty())
+        fs["dither"] >> colors.dither;
+    if (!fs["water_level"].empty())
+        fs["water_level"] >> colors.water_level;
+    if (!fs["water_color"].empty() && !read_color(fs["water_color"], colors.water_color))
+        throw std::runtime_error(filename + ": invalid water_color");
+    if (!fs["water_opacity"].empty())
+        fs["water_opacity"] >> colors.water_opacity;
+
+    cv::FileNode stops = fs["stops"];
+    if (!stops.isSeq() || stops.empty())
+        throw std::runtime_error(filename + ": invalid stops");
+    for (const auto& node : stops)
+    {
+        palette_stop stop;
+        if (node["height"].empty() || !read_color(node["color"], stop.color))
+            throw std::runtime_error(filename + ": invalid stops");
+        node["height"] >> stop.height;
+        if (!std::isfinite(stop.height) || (!colors.stops.empty() && !(stop.height > colors.stops.back().height)))
+            throw std::runtime_error(filename + ": invalid stops (heights must increase)");
+        colors.stops.push_back(stop);
+    }
+
+    if (!(colors.dither >= 0))
+        throw std::runtime_error(filename + ": invalid dither");
+    if (std::isnan(colors.water_level) || !(colors.water_opacity >= 0 && colors.water_opacity <= 1))
+        throw std::runtime_error(filename + ": invalid water_level or water_opacity");
+    return colors;
+}
+
+
+float palette_height(int depth, int min_depth, int max_depth)
+{
+    int nb = std::clamp(depth, min_depth, max_depth);
+    return static_cast<float>(nb - min_depth) / std::max(max_depth - min_depth, 1) * (220.0f - -220.0f) + -220.0f;
+}
+
+// 2x2 Bayer matrix: offsets in units of the dither amplitude, centered on 0
+static const float dither_offsets[DITHER_PHASES] = {-0.375f, 0.125f, 0.375f, -0.125f};
+
+cv::Vec3b palette_color(const palette& colors, float height, int phase)
+{
+    const auto& stops = colors.stops;
+    height += dither_offsets[phase] * colors.dither;
+
+    // First stop at or above the height (the last one beyond)
+    size_t k = 0;
+    while (k + 1 < stops.size() && !(height <= stops[k].height))
+        ++k;
+
+    cv::Vec3f color = stops[k].color;
+    if (colors.interpolation == palette_interpolation::LINEAR && k > 0 && height < stops[k].height)
+    {
+        const palette_stop& below = stops[k - 1];
+        float t = std::max(height - below.height, 0.f) / (stops[k].height - below.height);
+        color = cv::Vec3f(below.color) * (1.f - t) + cv::Vec3f(stops[k].color) * t;
+    }
+    if (height > colors.water_level)
+        color = color * (1.f - colors.water_opacity) + cv::Vec3f(colors.water_color) * colors.water_opacity;
+    return cv::Vec3b(cv::saturate_cast<uint8_t>(color[0]), cv::saturate_cast<uint8_t>(color[1]),
+                     cv::saturate_cast<uint8_t>(color[2]));
+}
+
+palette_lut compile_palette(const palette& colors, int min_depth, int max_depth)
+{
+    if (colors.stops.empty())
+        throw std::invalid_argument("compile_palette: palette without stops");
+
+    palette_lut lut;
+    lut.min_depth = min_depth;
+    lut.max_depth = max_depth;
+    lut.dithered = colors.dither > 0;
+    int phases = lut.dithered ? DITHER_PHASES : 1;
+    lut.colors.resize(phases * PALETTE_DEPTHS);
+    for (int p = 0; p < phases; ++p)
+    {
+        for (int depth = 0; depth < PALETTE_DEPTHS; ++depth)
+            lut.colors[p * PALETTE_DEPTHS + depth] = palette_color(colors, palette_height(depth, min_depth, max_depth), p);
+    }
+    return lut;
+}
+
+
+static std::mutex active_mutex;
+static std::shared_ptr<const palette> active;  // nullptr: default palette
+static std::atomic<uint64_t> active_version = {0};
+
+void set_active_palette(std::shared_ptr<const palette> colors)
+{
+    if (colors != nullptr && colors->stops.empty())
+        throw std::invalid_argument("set_active_palette: palette without stops");
+    std::lock_guard lock(active_mutex);
+    active = std::move(colors);
+    ++active_version;
+}
+
+std::shared_ptr<const palette> active_palette()
+{
+    std::lock_guard lock(active_mutex);
+    if (active == nullptr)
+        return std::shared_ptr<const palette>(&default_palette(), [](const palette*) {});
+    return active;
+}
+
+uint64_t active_palette_version()
+{
+    return active_version.load();
+}
+
+const palette_lut& active_palette_lut(int min_depth, int max_depth)
+{
+    thread_local palette_lut lut;
+    if (lut.version == active_version.load() && lut.min_depth == min_depth && lut.max_depth == max_depth)
+        return lut;
+
+    std::shared_ptr<const palette> colors;
+    uint64_t version;
+    {
+        std::lock_guard lock(active_mutex);
+        colors = active;
+        version = active_version.load();
+    }
+    lut = compile_palette(colors != nullptr ? *colors : default_palette(), min_depth, max_depth);
+    lut.version = version;
+    return lut;
+}
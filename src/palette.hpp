@@ -0,0 +1,118 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+
+/// \brief Interpolation of the colors between the stops of a palette
+enum class palette_interpolation
+{
+    STEP,       // Color of the first stop at or above the height: flat bands
+    LINEAR,     // Linear between the two stops around the height
+};
+
+/// \brief Name of an interpolation in the palette files ("step" or "linear")
+const char* palette_interpolation_name(palette_interpolation interpolation);
+/// \throw std::invalid_argument for an unknown name
+palette_interpolation parse_palette_interpolation(const std::string& name);
+
+/// \brief Color of a palette at a normalized height
+struct palette_stop
+{
+    float height;
+    cv::Vec3b color;    // RGB
+};
+
+/// \brief Elevation palette, on the normalized height of the depth: -220 at the calibrated
+/// min_depth (top of the sand) to 220 at max_depth (bottom of the box)
+///
+/// Palette files are read by load_palette(), for example (palettes/ladder.yml is the default
+/// palette):
+///
+///     %YAML:1.0
+///     ---
+///     interpolation: linear       # step (default) or linear
+///     dither: 4.                  # optional, amplitude in normalized height
+///     water_level: 150.           # optional, with water_color and water_opacity (0 to 1)
+///     water_color: [ 20, 60, 160 ]
+///     water_opacity: 0.6
+///     stops:
+///        - { height: -220., color: [ 255, 255, 255 ] }
+///        - { height: 220., color: [ 0, 40, 0 ] }
+///
+/// With dithering, the height of a pixel is offset by less than dither / 2 after a 2x2 ordered
+/// (Bayer) pattern, which breaks the band edges (step) or the 8-bit quantization (linear)
+/// into a stipple instead of a hard line. The pixels deeper than the water level (normalized
+/// height above water_level) are blended with the water color.
+struct palette
+{
+    std::vector<palette_stop> stops;    // Increasing heights, at least one
+    palette_interpolation interpolation = palette_interpolation::STEP;
+    float dither = 0.f;
+    float water_level = std::numeric_limits<float>::infinity();  // No water by default
+    cv::Vec3b water_color = {0, 67, 161};
+    float water_opacity = 0.5f;
+};
+
+/// \brief Built-in palette, same as palettes/ladder.yml
+const palette& default_palette();
+
+/// \brief Read a palette file
+/// \throw std::runtime_error if it cannot be read or is invalid ("<filename>: invalid <key>")
+palette load_palette(const std::string& filename);
+
+
+/// \brief Raw depths of the Kinect (11 bits), entries of a lookup table
+constexpr int PALETTE_DEPTHS = 2048;
+/// \brief Phases of the 2x2 ordered dithering
+constexpr int DITHER_PHASES = 4;
+
+/// \brief Dithering phase of a pixel
+inline int dither_phase(int x, int y)
+{
+    return (y & 1) * 2 + (x & 1);
+}
+
+/// \brief Normalized height of a raw depth for a calibrated range (-220 to 220)
+float palette_height(int depth, int min_depth, int max_depth);
+
+/// \brief Color of a normalized height, evaluated from the stops (reference of the tables)
+cv::Vec3b palette_color(const palette& colors, float height, int phase = 0);
+
+/// \brief Palette compiled for a calibrated range: the color of each raw depth
+///
+/// One table of PALETTE_DEPTHS colors per dithering phase (a single one without dithering,
+/// shared by the phases). Coloring a pixel is one load, whatever the stops and the mode.
+struct palette_lut
+{
+    int min_depth = -1;
+    int max_depth = -1;
+    uint64_t version = 0;       // Of the active palette it was compiled from
+    bool dithered = false;
+    std::vector<cv::Vec3b> colors;
+
+    /// \brief Table of a dithering phase, indexed by the raw depth (0..PALETTE_DEPTHS-1)
+    const cv::Vec3b* phase(int p) const { return colors.data() + (dithered ? p * PALETTE_DEPTHS : 0); }
+};
+
+palette_lut compile_palette(const palette& colors, int min_depth, int max_depth);
+
+
+/// \brief Palette used by the renderers (default_palette() until set)
+///
+/// Swapping it is one pointer exchange: each rendering thread compiles it again for its
+/// range at its next frame (see active_palette_lut()), the frames never evaluate the stops.
+void set_active_palette(std::shared_ptr<const palette> colors);
+std::shared_ptr<const palette> active_palette();
+/// \brief Incremented by each set_active_palette()
+uint64_t active_palette_version();
+
+/// \brief Active palette compiled for a range, cached per thread
+///
+/// Compiled again only when the active palette or the range changes.
+const palette_lut& active_palette_lut(int min_depth, int max_depth);
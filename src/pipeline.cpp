@@ -0,0 +1,98 @@
+#include "pipeline.hpp"
+
+#include <stdexcept>
+
+
+FramePipeline::FramePipeline(std::string name) : m_name(std::move(name))
+{
+    m_nodes.push_back(node{"source", -1, nullptr, nullptr});
+}
+
+int FramePipeline::add_node(node n)
+{
+    if (n.input < 0 || n.input >= size())
+        throw std::invalid_argument("FramePipeline: invalid input for " + n.name);
+
+#ifdef KINECT_PROFILING
+    n.histogram = &get_latency_histogram(m_name + "." + n.name);
+    n.trace_name = trace_intern(m_name + "." + n.name);
+#endif
+    m_nodes.push_back(std::move(n));
+    m_dirty = true;
+    return size() - 1;
+}
+
+int FramePipeline::add_stage(std::string name, int input, stage_fn fn)
+{
+    return add_node(node{std::move(name), input, std::move(fn), nullptr});
+}
+
+int FramePipeline::add_sink(std::string name, int input, sink_fn fn, bool enabled)
+{
+    return add_node(node{std::move(name), input, nullptr, std::move(fn), enabled});
+}
+
+void FramePipeline::set_enabled(int sink, bool enabled)
+{
+    if (m_nodes[sink].enabled == enabled)
+        return;
+
+    m_nodes[sink].enabled = enabled;
+    m_dirty = true;
+}
+
+bool FramePipeline::is_enabled(int sink) const
+{
+    return m_nodes[sink].enabled;
+}
+
+bool FramePipeline::is_needed(int node) const
+{
+    return m_nodes[node].needed;
+}
+
+const std::string& FramePipeline::name(int node) const
+{
+    return m_nodes[node].name;
+}
+
+void FramePipeline::update_needed()
+{
+    for (auto& n : m_nodes)
+        n.needed = n.sink && n.enabled;
+
+    // Nodes only depend on previous nodes: one backward pass propagates the needs
+    for (int i = size() - 1; i > 0; --i)
+        if (m_nodes[i].needed)
+            m_nodes[m_nodes[i].input].needed = true;
+
+    m_dirty = false;
+}
+
+void FramePipeline::run(const cv::Mat& input)
+{
+    if (m_dirty)
+        update_needed();
+
+    m_outputs.resize(m_nodes.size());
+    m_outputs[SOURCE] = input;
+
+    for (int i = 1; i < size(); ++i)
+    {
+        const node& n = m_nodes[i];
+        if (!n.needed)
+            continue;
+
+#ifdef KINECT_PROFILING
+        ScopedTimer timer(*n.histogram, n.trace_name);
+#endif
+        if (n.stage)
+            m_outputs[i] = n.stage(m_outputs[n.input]);
+        else
+            n.sink(m_outputs[n.input]);
+    }
+
+    // Do not keep references on the frame buffers
+    for (auto& m : m_outputs)
+        m.release();
+}
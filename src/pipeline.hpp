@@ -0,0 +1,68 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+#include <opencv2/core.hpp>
+
+#include "profiling.hpp"
+
+
+/// \brief Small dataflow graph of frame processing stages
+///
+/// Node 0 is the source frame. Stages compute a new frame from the output of one node,
+/// sinks consume the output of one node. A stage only runs when an enabled sink consumes
+/// its output (directly or through other stages), so toggling sinks switches the
+/// corresponding branches on and off. Each node is timed in the histogram "<pipeline>.<node>".
+class FramePipeline
+{
+    public:
+        using stage_fn = std::function<cv::Mat(const cv::Mat&)>;
+        using sink_fn = std::function<void(const cv::Mat&)>;
+
+        static constexpr int SOURCE = 0;
+
+        FramePipeline(std::string name = "pipeline");
+
+        /// \brief Add a stage computing its output from the output of \p input
+        /// \return The id of the stage
+        int add_stage(std::string name, int input, stage_fn fn);
+
+        /// \brief Add a sink consuming the output of \p input
+        /// \return The id of the sink
+        int add_sink(std::string name, int input, sink_fn fn, bool enabled = true);
+
+        /// \brief Enable or disable a sink (effective from the next frame)
+        void set_enabled(int sink, bool enabled);
+        bool is_enabled(int sink) const;
+
+        /// \brief Return true if the output of a node is consumed by an enabled sink
+        bool is_needed(int node) const;
+
+        const std::string& name(int node) const;
+        int size() const { return (int)m_nodes.size(); }
+
+        /// \brief Process a new frame: run the needed stages and the enabled sinks in order
+        void run(const cv::Mat& input);
+
+    private:
+        struct node
+        {
+            std::string name;
+            int input;
+            stage_fn stage;
+            sink_fn sink;
+            bool enabled = true;
+            bool needed = false;
+            LatencyHistogram* histogram = nullptr;
+            const char* trace_name = nullptr;
+        };
+
+        void update_needed();
+        int add_node(node n);
+
+        std::string m_name;
+        std::vector<node> m_nodes;
+        std::vector<cv::Mat> m_outputs;
+        bool m_dirty = true;
+};
@@ -0,0 +1,360 @@
+#include "pipelined-executor.hpp"
+#include "thread-policy.hpp"
+
+#include <stdexcept>
+#include <utility>
+
+
+FrameRing::FrameRing(int capacity) : m_slots(capacity)
+{
+    if (capacity < 1)
+        throw std::invalid_argument("FrameRing: invalid capacity");
+}
+
+FrameRing::slot* FrameRing::begin_write(bool block)
+{
+    std::unique_lock lock(m_mutex);
+    if (!block && m_head - m_tail == m_slots.size())
+        return nullptr;
+
+    m_not_full.wait(lock, [this]() { return m_head - m_tail < m_slots.size(); });
+    return &m_slots[m_head % m_slots.size()];
+}
+
+void FrameRing::end_write()
+{
+    {
+        std::lock_guard lock(m_mutex);
+        ++m_head;
+    }
+    m_not_empty.notify_one();
+}
+
+FrameRing::slot* FrameRing::begin_read()
+{
+    std::unique_lock lock(m_mutex);
+    m_not_empty.wait(lock, [this]() { return m_head != m_tail || m_closed; });
+    if (m_head == m_tail)
+        return nullptr;
+    return &m_slots[m_tail % m_slots.size()];
+}
+
+void FrameRing::end_read()
+{
+    {
+        std::lock_guard lock(m_mutex);
+        ++m_tail;
+    }
+    m_not_full.notify_one();
+}
+
+void FrameRing::close()
+{
+    {
+        std::lock_guard lock(m_mutex);
+        m_closed = true;
+    }
+    m_not_empty.notify_one();
+}
+
+void FrameRing::reopen()
+{
+    std::lock_guard lock(m_mutex);
+    m_closed = false;
+}
+
+
+PipelinedExecutor::PipelinedExecutor(std::string name, int capacity) : m_name(std::move(name)), m_capacity(capacity)
+{
+#ifdef KINECT_PROFILING
+    m_latency = &get_latency_histogram(m_name + ".latency");
+#endif
+}
+
+PipelinedExecutor::~PipelinedExecutor()
+{
+    // The error of a worker is dropped: a destructor does not throw
+    join_workers();
+}
+
+void PipelinedExecutor::add_stage(std::string name, stage_fn fn)
+{
+    if (!m_workers.empty())
+        throw std::logic_error("PipelinedExecutor: add_stage() after start()");
+
+    stage s{std::move(name), std::move(fn)};
+#ifdef KINECT_PROFILING
+    s.histogram = &get_latency_histogram(m_name + "." + s.name);
+    s.trace_name = trace_intern(m_name + "." + s.name);
+#endif
+    m_stages.push_back(std::move(s));
+}
+
+void PipelinedExecutor::set_sink(sink_fn fn)
+{
+    m_sink = std::move(fn);
+}
+
+void PipelinedExecutor::start()
+{
+    if (!m_workers.empty())
+        return;
+
+    // One ring in front of each stage and one in front of the sink
+    if (m_rings.size() != m_stages.size() + 1)
+    {
+        m_rings.clear();
+        for (size_t i = 0; i <= m_stages.size(); ++i)
+            m_rings.push_back(std::make_unique<FrameRing>(m_capacity));
+    }
+    for (auto& ring : m_rings)
+        ring->reopen();
+    m_failed = false;
+
+    for (int i = 0; i < stage_count(); ++i)
+        m_workers.emplace_back(&PipelinedExecutor::run_stage, this, i);
+    m_workers.emplace_back(&PipelinedExecutor::run_sink, this);
+}
+
+void PipelinedExecutor::stop()
+{
+    join_workers();
+    rethrow_error();
+}
+
+void PipelinedExecutor::join_workers()
+{
+    if (m_workers.empty())
+        return;
+
+    // Each worker closes its output ring once its input ring is drained
+    m_rings.front()->close();
+    for (auto& t : m_workers)
+        t.join();
+    m_workers.clear();
+}
+
+void PipelinedExecutor::set_error(std::exception_ptr error)
+{
+    {
+        std::lock_guard lock(m_done_mutex);
+        if (!m_error)
+            m_error = std::move(error);
+    }
+    m_failed = true;
+}
+
+void PipelinedExecutor::rethrow_error()
+{
+    std::lock_guard lock(m_done_mutex);
+    if (m_error)
+        std::rethrow_exception(std::exchange(m_error, nullptr));
+}
+
+void PipelinedExecutor::frame_done()
+{
+    {
+        std::lock_guard lock(m_done_mutex);
+        ++m_done;
+    }
+    m_done_changed.notify_all();
+}
+
+bool PipelinedExecutor::push(const cv::Mat& input, bool block)
+{
+    rethrow_error();
+    FrameRing::slot* slot = m_rings.front()->begin_write(block);
+    if (slot == nullptr)
+        return false;
+
+    slot->frame_id = trace_current_frame();
+    slot->start_ns = profiling_now();
+    input.copyTo(slot->frame);
+    {
+        std::lock_guard lock(m_done_mutex);
+        ++m_pushed;
+    }
+    m_rings.front()->end_write();
+    return true;
+}
+
+void PipelinedExecutor::flush()
+{
+    std::unique_lock lock(m_done_mutex);
+    m_done_changed.wait(lock, [this]() { return m_done == m_pushed; });
+    lock.unlock();
+    rethrow_error();
+}
+
+void PipelinedExecutor::run_stage(int index)
+{
+    const stage& s = m_stages[index];
+    FrameRing& input = *m_rings[index];
+    FrameRing& output = *m_rings[index + 1];
+    std::string thread_name = m_name + " " + s.name;
+    trace_thread_name(trace_intern(thread_name));
+    apply_thread_policy(thread_role::WORKER, thread_name);
+
+    while (FrameRing::slot* in = input.begin_read())
+    {
+        if (!m_failed)
+        {
+            FrameRing::slot* out = output.begin_write();
+            trace_set_current_frame(in->frame_id);
+            try
+            {
+#ifdef KINECT_PROFILING
+                ScopedTimer timer(*s.histogram, s.trace_name);
+#endif
+                trace_frame_flow(trace_phase::FLOW_STEP);
+                s.fn(in->frame, out->frame);
+                out->frame_id = in->frame_id;
+                out->start_ns = in->start_ns;
+                input.end_read();
+                output.end_write();
+                continue;
+            }
+            catch (...)
+            {
+                set_error(std::current_exception());
+            }
+        }
+        // After an error: the frame is dropped, the ring is drained
+        input.end_read();
+        frame_done();
+    }
+    output.close();
+}
+
+void PipelinedExecutor::run_sink()
+{
+    FrameRing& input = *m_rings.back();
+    trace_thread_name(trace_intern(m_name + " sink"));
+    apply_thread_policy(thread_role::WORKER, m_name + " sink");
+
+    while (FrameRing::slot* in = input.begin_read())
+    {
+        trace_set_current_frame(in->frame_id);
+        uint64_t latency = profiling_now() - in->start_ns;
+        try
+        {
+            if (m_sink && !m_failed)
+                m_sink(in->frame, in->frame_id, latency);
+        }
+        catch (...)
+        {
+            set_error(std::current_exception());
+        }
+        if (m_latency != nullptr && is_profiling_enabled() && !m_failed)
+            m_latency->record(latency);
+        input.end_read();
+        frame_done();
+    }
+}
+
+
+FanoutExecutor::FanoutExecutor(std::string name) : m_name(std::move(name))
+{
+#ifdef KINECT_PROFILING
+    m_histogram = &get_latency_histogram(m_name + ".task");
+    m_trace_name = trace_intern(m_name + ".task");
+#endif
+}
+
+FanoutExecutor::~FanoutExecutor()
+{
+    {
+        std::lock_guard lock(m_mutex);
+        m_stopping = true;
+    }
+    m_started.notify_all();
+    for (auto& t : m_workers)
+        t.join();
+}
+
+void FanoutExecutor::run(int count, const task_fn& fn)
+{
+    if (count <= 0)
+        return;
+
+    while ((int)m_workers.size() < count - 1)
+        m_workers.emplace_back(&FanoutExecutor::run_worker, this, (int)m_workers.size() + 1);
+
+    {
+        std::lock_guard lock(m_mutex);
+        m_task = &fn;
+        m_count = count;
+        m_frame_id = trace_current_frame();
+        m_pending = count - 1;
+        m_error = nullptr;
+        ++m_batch;
+    }
+    if (count > 1)
+        m_started.notify_all();
+
+    try
+    {
+        run_task(0);
+    }
+    catch (...)
+    {
+        std::lock_guard lock(m_mutex);
+        if (!m_error)
+            m_error = std::current_exception();
+    }
+
+    std::unique_lock lock(m_mutex);
+    m_finished.wait(lock, [this]() { return m_pending == 0; });
+    m_task = nullptr;
+    if (m_error)
+        std::rethrow_exception(std::exchange(m_error, nullptr));
+}
+
+void FanoutExecutor::run_task(int index)
+{
+#ifdef KINECT_PROFILING
+    ScopedTimer timer(*m_histogram, m_trace_name);
+#endif
+    (*m_task)(index);
+}
+
+void FanoutExecutor::run_worker(int index)
+{
+    std::string thread_name = m_name + " " + std::to_string(index);
+    trace_thread_name(trace_intern(thread_name));
+    apply_thread_policy(thread_role::WORKER, thread_name);
+
+    uint64_t batch = 0;
+    while (true)
+    {
+        {
+            std::unique_lock lock(m_mutex);
+            m_started.wait(lock, [&]() { return m_stopping || m_batch != batch; });
+            if (m_stopping)
+                return;
+            batch = m_batch;
+            // Workers beyond the count of this batch have nothing to do
+            if (index >= m_count)
+                continue;
+            trace_set_current_frame(m_frame_id);
+        }
+
+        try
+        {
+            trace_frame_flow(trace_phase::FLOW_STEP);
+            run_task(index);
+        }
+        catch (...)
+        {
+            std::lock_guard lock(m_mutex);
+            if (!m_error)
+                m_error = std::current_exception();
+        }
+
+        {
+            std::lock_guard lock(m_mutex);
+            --m_pending;
+        }
+        m_finished.notify_one();
+    }
+}
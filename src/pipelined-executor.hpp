@@ -0,0 +1,174 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+#include "profiling.hpp"
+
+
+/// \brief Bounded ring of preallocated frames between two threads (single producer, single consumer)
+///
+/// The frame buffers of the slots are reused: a stage writing into a slot with cv::Mat::create()
+/// (or any OpenCV function with an output array) does not allocate once the sizes are stable.
+class FrameRing
+{
+    public:
+        struct slot
+        {
+            cv::Mat frame;
+            uint64_t frame_id = 0;
+            uint64_t start_ns = 0;  // Time at which the frame entered the executor
+        };
+
+        explicit FrameRing(int capacity);
+
+        /// \brief Return the next slot to fill, nullptr if the ring is full and \p block is false
+        slot* begin_write(bool block = true);
+        void end_write();
+
+        /// \brief Return the next slot to consume, nullptr once the ring is closed and empty
+        slot* begin_read();
+        void end_read();
+
+        /// \brief Wake up the consumer: no more frames will be written
+        void close();
+        void reopen();
+
+    private:
+        std::vector<slot> m_slots;
+        uint64_t m_head = 0;  // Next slot written
+        uint64_t m_tail = 0;  // Next slot read
+        bool m_closed = false;
+        std::mutex m_mutex;
+        std::condition_variable m_not_full;
+        std::condition_variable m_not_empty;
+};
+
+
+/// \brief Run a chain of stages on one worker thread per stage
+///
+/// The stages are connected by FrameRings: while frame N is processed by a stage, frame N+1
+/// is processed by the previous one. The throughput is limited by the slowest stage instead
+/// of the sum of the stages, at the cost of up to `capacity` frames of latency per ring.
+/// The sink receives the frames in order on its own thread.
+///
+/// Each stage is timed in the histogram "<name>.<stage>" and the latency from push() to
+/// the sink in "<name>.latency".
+///
+/// When a stage or the sink throws, the workers drop the frames still in flight (they drain
+/// their rings, so none of them blocks) and the first exception is rethrown by the next call
+/// of push(), flush() or stop().
+class PipelinedExecutor
+{
+    public:
+        using stage_fn = std::function<void(const cv::Mat& input, cv::Mat& output)>;
+        using sink_fn = std::function<void(const cv::Mat& output, uint64_t frame_id, uint64_t latency_ns)>;
+
+        explicit PipelinedExecutor(std::string name = "pipelined", int capacity = 2);
+        ~PipelinedExecutor();
+
+        /// \brief Append a stage (before start())
+        void add_stage(std::string name, stage_fn fn);
+        void set_sink(sink_fn fn);
+
+        void start();
+        /// \brief Process the frames already pushed, then stop the workers
+        /// \throw The first exception thrown by a stage or the sink
+        void stop();
+
+        /// \brief Copy a frame at the entry of the pipeline
+        /// \return false if the first ring is full and \p block is false (the frame is dropped)
+        /// \throw The first exception thrown by a stage or the sink (the frame is not pushed)
+        bool push(const cv::Mat& input, bool block = true);
+
+        /// \brief Wait until all the pushed frames went through the sink (or were dropped after an error)
+        /// \throw The first exception thrown by a stage or the sink
+        void flush();
+
+        int stage_count() const { return (int)m_stages.size(); }
+
+    private:
+        struct stage
+        {
+            std::string name;
+            stage_fn fn;
+            LatencyHistogram* histogram = nullptr;
+            const char* trace_name = nullptr;
+        };
+
+        void run_stage(int index);
+        void run_sink();
+        void join_workers();
+        // Keep the first exception of a worker, the others drop their frames from then on
+        void set_error(std::exception_ptr error);
+        void rethrow_error();
+        // A frame went through the sink or was dropped
+        void frame_done();
+
+        std::string m_name;
+        int m_capacity;
+        std::vector<stage> m_stages;
+        sink_fn m_sink;
+        LatencyHistogram* m_latency = nullptr;
+
+        std::vector<std::unique_ptr<FrameRing>> m_rings;  // m_rings[i] is the input of stage i
+        std::vector<std::thread> m_workers;
+
+        uint64_t m_pushed = 0;
+        uint64_t m_done = 0;
+        std::exception_ptr m_error;
+        std::atomic<bool> m_failed = {false};
+        std::mutex m_done_mutex;    // Protects m_pushed, m_done and m_error
+        std::condition_variable m_done_changed;
+};
+
+
+/// \brief Run the same task for several indices concurrently, on persistent worker threads
+///
+/// run(count, fn) calls fn(0) on the calling thread and fn(i) on worker i for the others
+/// (created on first use), then waits for all of them: used to warp one rendered frame into
+/// several projectors. The frame id of the caller is carried to the workers, and each call
+/// of fn is timed in the histogram "<name>.task".
+class FanoutExecutor
+{
+    public:
+        using task_fn = std::function<void(int index)>;
+
+        explicit FanoutExecutor(std::string name = "fanout");
+        ~FanoutExecutor();
+
+        /// \brief Run fn(0), ..., fn(count - 1) and wait for them
+        /// \throw The first exception thrown by a task, once all of them are done
+        void run(int count, const task_fn& fn);
+
+    private:
+        void run_task(int index);
+        void run_worker(int index);
+
+        std::string m_name;
+        LatencyHistogram* m_histogram = nullptr;
+        const char* m_trace_name = nullptr;
+        std::vector<std::thread> m_workers;  // m_workers[i - 1] runs index i
+
+        // Current batch, protected by m_mutex
+        const task_fn* m_task = nullptr;
+        int m_count = 0;
+        uint64_t m_batch = 0;
+        uint64_t m_frame_id = 0;
+        int m_pending = 0;
+        bool m_stopping = false;
+        std::exception_ptr m_error;
+        std::mutex m_mutex;
+        std::condition_variable m_started;
+        std::condition_variable m_finished;
+};
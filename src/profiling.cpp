@@ -0,0 +1,190 @@
+#include "profiling.hpp"
+
+#include <algorithm>
+#include <deque>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+
+struct named_histogram
+{
+    std::string name;
+    LatencyHistogram histogram;
+};
+
+// std::deque keeps the addresses stable when growing
+static std::mutex registry_mutex;
+static std::deque<named_histogram> registry;
+
+static std::atomic<bool> profiling_enabled = {true};
+// Arrival of the depth frame being delivered, on the capture thread
+static thread_local uint64_t depth_arrival_ns = 0;
+static std::atomic<uint32_t> depth_device_timestamp = {0};
+
+
+int LatencyHistogram::bucket_index(uint64_t ns)
+{
+    if (ns < 4)
+        return (int)ns;
+
+    int e = 63 - __builtin_clzll(ns);        // floor(log2(ns)) >= 2
+    int m = (int)((ns >> (e - 2)) & 3);      // 2 bits of mantissa
+    int index = 4 * (e - 1) + m;
+    return index < BUCKETS ? index : BUCKETS - 1;
+}
+
+uint64_t LatencyHistogram::bucket_upper_bound(int index)
+{
+    if (index < 4)
+        return index;
+
+    int e = index / 4 + 1;
+    int m = index % 4;
+    return ((uint64_t)(5 + m) << (e - 2)) - 1;
+}
+
+void LatencyHistogram::record(uint64_t ns)
+{
+    m_buckets[bucket_index(ns)].fetch_add(1, std::memory_order_relaxed);
+    m_count.fetch_add(1, std::memory_order_relaxed);
+
+    uint64_t max = m_max.load(std::memory_order_relaxed);
+    while (ns > max && !m_max.compare_exchange_weak(max, ns, std::memory_order_relaxed))
+        ;
+}
+
+LatencyHistogram::summary LatencyHistogram::summarize() const
+{
+    // Buckets are read one by one: the result is consistent up to the concurrent records
+    uint64_t counts[BUCKETS];
+    uint64_t total = 0;
+    for (int i = 0; i < BUCKETS; ++i)
+        total += counts[i] = m_buckets[i].load(std::memory_order_relaxed);
+
+    summary s;
+    s.count = total;
+    s.max = m_max.load(std::memory_order_relaxed);
+    if (total == 0)
+        return s;
+
+    uint64_t* targets[3] = {&s.p50, &s.p95, &s.p99};
+    const double quantiles[3] = {0.50, 0.95, 0.99};
+    int q = 0;
+    uint64_t cumulated = 0;
+    for (int i = 0; i < BUCKETS && q < 3; ++i)
+    {
+        cumulated += counts[i];
+        while (q < 3 && cumulated >= quantiles[q] * total)
+            *targets[q++] = std::min(bucket_upper_bound(i), s.max);
+    }
+    return s;
+}
+
+void LatencyHistogram::reset()
+{
+    for (auto& b : m_buckets)
+        b.store(0, std::memory_order_relaxed);
+    m_count.store(0, std::memory_order_relaxed);
+    m_max.store(0, std::memory_order_relaxed);
+}
+
+
+LatencyHistogram& get_latency_histogram(const std::string& name)
+{
+    std::lock_guard lock(registry_mutex);
+    for (auto& h : registry)
+        if (h.name == name)
+            return h.histogram;
+
+    registry.emplace_back();
+    registry.back().name = name;
+    return registry.back().histogram;
+}
+
+std::vector<std::pair<std::string, const LatencyHistogram*>> get_latency_histograms()
+{
+    std::lock_guard lock(registry_mutex);
+    std::vector<std::pair<std::string, const LatencyHistogram*>> result;
+    for (auto& h : registry)
+        result.emplace_back(h.name, &h.histogram);
+    return result;
+}
+
+std::string profiling_report()
+{
+    std::ostringstream out;
+    out << std::left << std::setw(24) << "stage" << std::right
+        << std::setw(10) << "count" << std::setw(10) << "p50" << std::setw(10) << "p95"
+        << std::setw(10) << "p99" << std::setw(10) << "max" << "  (us)\n";
+
+    for (auto& [name, histogram] : get_latency_histograms())
+    {
+        auto s = histogram->summarize();
+        out << std::left << std::setw(24) << name << std::right << std::setw(10) << s.count << std::fixed << std::setprecision(1)
+            << std::setw(10) << s.p50 / 1000. << std::setw(10) << s.p95 / 1000.
+            << std::setw(10) << s.p99 / 1000. << std::setw(10) << s.max / 1000. << '\n';
+    }
+    return out.str();
+}
+
+void set_profiling_enabled(bool enabled)
+{
+    profiling_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+bool is_profiling_enabled()
+{
+#ifdef KINECT_PROFILING
+    return profiling_enabled.load(std::memory_order_relaxed);
+#else
+    return false;
+#endif
+}
+
+
+void depth_frame_arrived(uint32_t device_timestamp)
+{
+#ifdef KINECT_PROFILING
+    depth_device_timestamp.store(device_timestamp, std::memory_order_relaxed);
+    depth_arrival_ns = profiling_now();
+#endif
+}
+
+uint64_t depth_frame_arrival()
+{
+    return depth_arrival_ns;
+}
+
+void depth_frame_presented(uint64_t arrival_ns)
+{
+#ifdef KINECT_PROFILING
+    static LatencyHistogram& histogram = get_latency_histogram("end_to_end");
+    if (arrival_ns != 0 && is_profiling_enabled())
+        histogram.record(profiling_now() - arrival_ns);
+    trace_frame_flow(trace_phase::FLOW_STEP);
+#endif
+}
+
+
+FrameTimer::FrameTimer(const char* name) : m_name(name)
+{
+#ifdef KINECT_PROFILING
+    m_histogram = &get_latency_histogram(name);
+#endif
+}
+
+void FrameTimer::start()
+{
+    m_start = is_profiling_enabled() ? profiling_now() : 0;
+}
+
+void FrameTimer::stop()
+{
+    if (m_start != 0 && m_histogram != nullptr)
+    {
+        uint64_t end = profiling_now();
+        m_histogram->record(end - m_start);
+        trace_slice(m_name, m_start, end);
+    }
+    m_start = 0;
+}
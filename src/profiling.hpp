@@ -0,0 +1,130 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "tracing.hpp"
+
+
+/// \brief Lock-free latency histogram with fixed log-linear buckets
+///
+/// Each power of two is split in 4 buckets (relative error below 25%), from 1ns to ~18 minutes.
+/// record() is wait-free apart from the max update, and can be called from any thread.
+class LatencyHistogram
+{
+    public:
+        static constexpr int BUCKETS = 160;
+
+        struct summary
+        {
+            uint64_t count = 0;
+            uint64_t p50 = 0;
+            uint64_t p95 = 0;
+            uint64_t p99 = 0;
+            uint64_t max = 0;
+        };
+
+        void record(uint64_t ns);
+        summary summarize() const;
+        void reset();
+
+        /// \brief Upper bound (in ns) of the values stored in a bucket
+        static uint64_t bucket_upper_bound(int index);
+        static int bucket_index(uint64_t ns);
+
+    private:
+        std::atomic<uint64_t> m_buckets[BUCKETS] = {};
+        std::atomic<uint64_t> m_count = {0};
+        std::atomic<uint64_t> m_max = {0};
+};
+
+
+/// \brief Return the histogram registered under \p name (created on first use, never destroyed)
+LatencyHistogram& get_latency_histogram(const std::string& name);
+
+/// \brief Return all the registered histograms, in registration order
+std::vector<std::pair<std::string, const LatencyHistogram*>> get_latency_histograms();
+
+/// \brief Format the percentiles of all the histograms as a table (in µs)
+std::string profiling_report();
+
+/// \brief Enable or disable the timers at runtime (enabled by default)
+void set_profiling_enabled(bool enabled);
+bool is_profiling_enabled();
+
+/// \brief Monotonic time in nanoseconds
+inline uint64_t profiling_now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+/// \brief End-to-end latency of the depth frames
+///
+/// libfreenect timestamps come from the Kinect clock, which is not synchronized with the
+/// host: the latency is measured from the arrival of the frame in the capture callback. The
+/// arrival time travels with the frame, so the time it waits in a queue is counted.
+void depth_frame_arrived(uint32_t device_timestamp);
+/// \brief Arrival time of the depth frame being delivered (in the capture callback), 0 if not profiled
+uint64_t depth_frame_arrival();
+/// \brief Record the time elapsed since \p arrival_ns (from depth_frame_arrival()) in "end_to_end"
+void depth_frame_presented(uint64_t arrival_ns);
+
+
+/// \brief Record the time elapsed in a scope in a histogram (and as a slice \p trace_name in the trace)
+class ScopedTimer
+{
+    public:
+        explicit ScopedTimer(LatencyHistogram& histogram, const char* trace_name = nullptr)
+            : m_histogram(histogram), m_trace_name(trace_name), m_start(is_profiling_enabled() ? profiling_now() : 0)
+        {
+        }
+
+        ~ScopedTimer()
+        {
+            if (m_start == 0)
+                return;
+
+            uint64_t end = profiling_now();
+            m_histogram.record(end - m_start);
+            if (m_trace_name != nullptr)
+                trace_slice(m_trace_name, m_start, end);
+        }
+
+    private:
+        LatencyHistogram& m_histogram;
+        const char* m_trace_name;
+        uint64_t m_start;
+};
+
+
+/// \brief Record the time between start() and stop() calls (possibly in different functions)
+class FrameTimer
+{
+    public:
+        explicit FrameTimer(const char* name);
+
+        void start();
+        void stop();
+
+    private:
+        LatencyHistogram* m_histogram = nullptr;
+        const char* m_name;
+        uint64_t m_start = 0;
+};
+
+
+#define KINECT_PROFILE_CONCAT_(a, b) a##b
+#define KINECT_PROFILE_CONCAT(a, b) KINECT_PROFILE_CONCAT_(a, b)
+
+#ifdef KINECT_PROFILING
+/// \brief Time the enclosing scope in the histogram \p name (compiled out without KINECT_PROFILING)
+#define PROFILE_SCOPE(name)                                                                                   \
+    static LatencyHistogram& KINECT_PROFILE_CONCAT(_profile_histogram_, __LINE__) = get_latency_histogram(name); \
+    ScopedTimer KINECT_PROFILE_CONCAT(_profile_timer_, __LINE__)(KINECT_PROFILE_CONCAT(_profile_histogram_, __LINE__), name)
+#else
+#define PROFILE_SCOPE(name) do {} while (0)
+#endif
@@ -0,0 +1,77 @@
+#include "quality.hpp"
+#include "metrics.hpp"
+
+#include <algorithm>
+
+// Exponential moving average of the frame time
+constexpr static double AVERAGE_WEIGHT = 0.1;
+
+static const char* level_names[QUALITY_LEVELS] = {
+    "full",
+    "no shading",
+    "contours 1/2",
+    "half resolution",
+    "reduced previews",
+};
+
+
+render_quality get_render_quality(int level)
+{
+    render_quality quality;
+    quality.shading = level < QUALITY_NO_SHADING;
+    quality.contour_period = (level >= QUALITY_HALF_RATE_CONTOURS) ? 2 : 1;
+    quality.scale = (level >= QUALITY_HALF_RESOLUTION) ? 2 : 1;
+    quality.reduced_previews = level >= QUALITY_REDUCED_PREVIEWS;
+    return quality;
+}
+
+const char* quality_level_name(int level)
+{
+    return level_names[std::clamp(level, 0, QUALITY_LEVELS - 1)];
+}
+
+
+QualityGovernor::QualityGovernor(double target_fps)
+{
+    set_target_fps(target_fps);
+    set_level(QUALITY_FULL);
+}
+
+void QualityGovernor::set_target_fps(double fps)
+{
+    m_budget_ns = 1e9 / fps;
+}
+
+double QualityGovernor::target_fps() const
+{
+    return 1e9 / m_budget_ns;
+}
+
+void QualityGovernor::set_level(int level)
+{
+    static MetricGauge& metric = get_metric_gauge("kinect_quality_level", "Quality level of the governor (0 = full quality)");
+
+    m_level = std::clamp(level, 0, QUALITY_LEVELS - 1);
+    m_frames = 0;
+    m_average_ns = 0;
+    metric.set(m_level);
+}
+
+bool QualityGovernor::update(uint64_t frame_ns)
+{
+    m_average_ns = (m_frames == 0) ? frame_ns : (1 - AVERAGE_WEIGHT) * m_average_ns + AVERAGE_WEIGHT * frame_ns;
+    if (++m_frames < HOLD_FRAMES)
+        return false;
+
+    if (m_average_ns > DOWN_THRESHOLD * m_budget_ns && m_level < QUALITY_LEVELS - 1)
+    {
+        set_level(m_level + 1);
+        return true;
+    }
+    if (m_average_ns < UP_THRESHOLD * m_budget_ns && m_level > QUALITY_FULL)
+    {
+        set_level(m_level - 1);
+        return true;
+    }
+    return false;
+}
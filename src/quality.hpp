@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+
+
+/// \brief Rendering options degraded by the quality governor
+struct render_quality
+{
+    bool shading = true;
+    int contour_period = 1;         // Contours recomputed every N frames (reused in between)
+    int scale = 1;                  // Processing resolution divider
+    bool reduced_previews = false;  // Refresh the previews at a lower rate
+};
+
+/// \brief Quality ladder: each level adds one degradation to the previous ones
+enum quality_level
+{
+    QUALITY_FULL = 0,
+    QUALITY_NO_SHADING = 1,
+    QUALITY_HALF_RATE_CONTOURS = 2,
+    QUALITY_HALF_RESOLUTION = 3,
+    QUALITY_REDUCED_PREVIEWS = 4,
+    QUALITY_LEVELS
+};
+
+render_quality get_render_quality(int level);
+const char* quality_level_name(int level);
+
+
+/// \brief Step the quality down and up to hold a target frame rate
+///
+/// update() is given the processing time of every frame. The level goes down one step when
+/// the average time exceeds DOWN_THRESHOLD of the frame budget, and up one step when it is below
+/// UP_THRESHOLD. After a change, the level is held for HOLD_FRAMES frames so that the average
+/// reflects the new level (hysteresis). The level is exported in the metric "kinect_quality_level".
+class QualityGovernor
+{
+    public:
+        static constexpr double DOWN_THRESHOLD = 0.9;
+        static constexpr double UP_THRESHOLD = 0.5;
+        static constexpr int HOLD_FRAMES = 30;
+
+        explicit QualityGovernor(double target_fps = 25);
+
+        void set_target_fps(double fps);
+        double target_fps() const;
+
+        /// \brief Record the processing time of a frame
+        /// \return true if the level changed
+        bool update(uint64_t frame_ns);
+
+        /// \brief Force a level (and restart the measure)
+        void set_level(int level);
+        int level() const { return m_level; }
+
+    private:
+        double m_budget_ns;
+        double m_average_ns = 0;
+        int m_frames = 0;  // Frames since the last change
+        int m_level = QUALITY_FULL;
+};
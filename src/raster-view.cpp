@@ -0,0 +1,86 @@
+#include "raster-view.hpp"
+
+#include <opencv2/imgproc.hpp>
+
+
+QRasterView::QRasterView(QWidget* parent) : QWidget(parent)
+{
+    this->setWindowFlags(Qt::Window);
+    this->setWindowState(Qt::WindowFullScreen);
+
+    // We paint every pixel ourselves: no background erase, no double compositing
+    this->setAttribute(Qt::WA_OpaquePaintEvent);
+    this->setAttribute(Qt::WA_NoSystemBackground);
+}
+
+cv::Mat& QRasterView::frameBuffer(cv::Size size)
+{
+    if (m_buffer.size() != size)
+    {
+        m_buffer.create(size, CV_8UC4);
+        m_buffer.setTo(cv::Scalar(0, 0, 0, 255));
+        m_image = QImage(m_buffer.data, m_buffer.cols, m_buffer.rows, m_buffer.step, QImage::Format_RGB32);
+        updateTransform();
+    }
+    return m_buffer;
+}
+
+void QRasterView::present()
+{
+    this->update();
+}
+
+void QRasterView::setImage(const cv::Mat& rgb)
+{
+    m_convert_timer.start();
+    cv::Mat& buffer = frameBuffer(rgb.size());
+    // In memory, Format_RGB32 is B, G, R, 0xFF on little-endian
+    cv::cvtColor(rgb, buffer, cv::COLOR_RGB2BGRA);
+    m_convert_timer.stop();
+    m_frame_id = trace_current_frame();
+    present();
+}
+
+void QRasterView::resizeEvent(QResizeEvent* event)
+{
+    QWidget::resizeEvent(event);
+    updateTransform();
+}
+
+void QRasterView::updateTransform()
+{
+    if (m_image.isNull())
+        return;
+
+    // Keep aspect ratio and center the frame
+    QSize scaled = m_image.size().scaled(this->size(), Qt::KeepAspectRatio);
+    m_target = QRect(QPoint((width() - scaled.width()) / 2, (height() - scaled.height()) / 2), scaled);
+
+    m_transform = QTransform();
+    m_transform.translate(m_target.x(), m_target.y());
+    m_transform.scale(qreal(scaled.width()) / m_image.width(), qreal(scaled.height()) / m_image.height());
+}
+
+void QRasterView::paintEvent(QPaintEvent* event)
+{
+    QPainter painter(this);
+
+    if (m_image.isNull())
+    {
+        painter.fillRect(this->rect(), Qt::black);
+        return;
+    }
+
+    TraceFrameScope frame(m_frame_id);
+    m_paint_timer.start();
+    trace_frame_flow(trace_phase::FLOW_END);
+
+    // Letterbox borders only
+    QRegion borders = QRegion(this->rect()).subtracted(m_target);
+    for (const QRect& r : borders)
+        painter.fillRect(r, Qt::black);
+
+    painter.setTransform(m_transform);
+    painter.drawImage(0, 0, m_image);
+    m_paint_timer.stop();
+}
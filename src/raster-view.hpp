@@ -0,0 +1,47 @@
+#pragma once
+
+#include <QtGui>
+#include <QtWidgets>
+
+#include <opencv2/core.hpp>
+
+#include "profiling.hpp"
+
+
+/// \brief Fullscreen output widget that paints a preallocated frame buffer
+///
+/// The frame buffer is a CV_8UC4 (BGRA) matrix wrapped without copy by a
+/// QImage::Format_RGB32 image, which Qt blits without any format conversion.
+/// The scale transform is only recomputed when the widget or the frame is resized.
+class QRasterView : public QWidget
+{
+    public:
+        QRasterView(QWidget* parent = nullptr);
+
+        /// \brief Return the frame buffer (re)allocated to the given size
+        ///
+        /// Draw into it and call present() to display it.
+        cv::Mat& frameBuffer(cv::Size size);
+
+        /// \brief Schedule a repaint of the frame buffer
+        void present();
+
+        /// \brief Convert an RGB888 image into the frame buffer and present it
+        void setImage(const cv::Mat& rgb);
+
+    protected:
+        void paintEvent(QPaintEvent* event) override;
+        void resizeEvent(QResizeEvent* event) override;
+
+    private:
+        void updateTransform();
+
+        cv::Mat m_buffer;
+        QImage m_image;
+        QTransform m_transform;
+        QRect m_target;
+        uint64_t m_frame_id = 0;  // Frame in the buffer (trace)
+
+        FrameTimer m_convert_timer{"qt.convert"};
+        FrameTimer m_paint_timer{"qt.paint"};
+};
@@ -0,0 +1,296 @@
+#include "recording.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+static const char RECORDING_MAGIC[4] = {'K', 'R', 'E', 'C'};
+// 2: DELTA frames
+constexpr static uint32_t RECORDING_VERSION = 2;
+
+// DELTA codes, in the 2 high bits of the first byte
+constexpr static uint8_t CODE_ZEROS = 0x00;  // 00nnnnnn: n + 1 zero residuals
+constexpr static uint8_t CODE_PAIR = 0x40;   // 01aaabbb: residuals a and b in [-4, 3]
+constexpr static uint8_t CODE_SMALL = 0x80;  // 10rrrrrr: residual in [-32, 31]
+constexpr static uint8_t CODE_VALUE = 0xc0;  // 11vvvvvv vvvvvvvv: 14-bit value
+constexpr static int MAX_ZEROS = 64;
+constexpr static int MAX_VALUE = (1 << 14) - 1;
+
+
+static int frame_type(frame_kind kind)
+{
+    return (kind == frame_kind::DEPTH) ? CV_16UC1 : CV_8UC3;
+}
+
+
+// Prediction of a pixel from its decoded left (a), top (b) and top-left (c) neighbors, median
+// edge detector: the smaller of a and b above a ridge, the larger in a hollow, else the plane
+// through the three neighbors. The first row has a zero row above it, and the first column
+// takes its top neighbor as left and top-left one: the first row is predicted from the left,
+// the first column from the top.
+static inline int predict(int a, int b, int c)
+{
+    int low = std::min(a, b), high = std::max(a, b);
+    return (c >= high) ? low : (c <= low) ? high : a + b - c;
+}
+
+static inline bool is_pair_residual(int r)
+{
+    return r >= -4 && r <= 3;
+}
+
+// Encode a row at output, return the end of its codes
+static uint8_t* encode_row(const uint16_t* row, const uint16_t* above, int width, int* residuals, uint8_t* output)
+{
+    residuals[0] = row[0] - above[0];
+    for (int x = 1; x < width; ++x)
+        residuals[x] = row[x] - predict(row[x - 1], above[x], above[x - 1]);
+
+    int x = 0;
+    while (x < width)
+    {
+        int r = residuals[x];
+        bool last = (x + 1 == width);
+        if (r == 0 && (last || residuals[x + 1] == 0))
+        {
+            int n = 1;
+            while (x + n < width && n < MAX_ZEROS && residuals[x + n] == 0)
+                ++n;
+            *output++ = (uint8_t)(CODE_ZEROS | (n - 1));
+            x += n;
+        }
+        else if (!last && is_pair_residual(r) && is_pair_residual(residuals[x + 1]))
+        {
+            *output++ = (uint8_t)(CODE_PAIR | ((r & 7) << 3) | (residuals[x + 1] & 7));
+            x += 2;
+        }
+        else if (r >= -32 && r <= 31)
+        {
+            *output++ = (uint8_t)(CODE_SMALL | (r & 63));
+            ++x;
+        }
+        else
+        {
+            if (row[x] > MAX_VALUE)
+                throw std::invalid_argument("encode_frame: depth above 14 bits");
+            *output++ = (uint8_t)(CODE_VALUE | (row[x] >> 8));
+            *output++ = (uint8_t)(row[x] & 0xff);
+            ++x;
+        }
+    }
+    return output;
+}
+
+static void decode_delta(const frame_header& header, const uint8_t* payload, cv::Mat& frame)
+{
+    const uint8_t* end = payload + header.size;
+    std::vector<uint16_t> zeros(frame.cols, 0);
+    for (int y = 0; y < frame.rows; ++y)
+    {
+        uint16_t* row = frame.ptr<uint16_t>(y);
+        const uint16_t* above = (y > 0) ? frame.ptr<uint16_t>(y - 1) : zeros.data();
+        int left = above[0], top_left = above[0];
+        auto put = [&](int x, int value) {
+            row[x] = (uint16_t)value;
+            left = row[x];
+            top_left = above[x];
+        };
+
+        int x = 0;
+        while (x < frame.cols)
+        {
+            if (payload == end)
+                throw std::runtime_error("decode_frame: truncated DELTA frame");
+            uint8_t code = *payload++;
+            int bits = code & 0x3f;
+            switch (code & 0xc0)
+            {
+                case CODE_ZEROS:
+                    if (x + bits + 1 > frame.cols)
+                        throw std::runtime_error("decode_frame: corrupted DELTA frame");
+                    for (int n = 0; n <= bits; ++n, ++x)
+                        put(x, predict(left, above[x], top_left));
+                    break;
+                case CODE_PAIR:
+                    if (x + 2 > frame.cols)
+                        throw std::runtime_error("decode_frame: corrupted DELTA frame");
+                    put(x, predict(left, above[x], top_left) + (bits >> 3) - ((bits & 32) >> 2));
+                    ++x;
+                    put(x, predict(left, above[x], top_left) + (bits & 7) - ((bits & 4) << 1));
+                    ++x;
+                    break;
+                case CODE_SMALL:
+                    put(x, predict(left, above[x], top_left) + bits - ((bits & 32) << 1));
+                    ++x;
+                    break;
+                default:
+                    if (payload == end)
+                        throw std::runtime_error("decode_frame: truncated DELTA frame");
+                    put(x, (bits << 8) | *payload++);
+                    ++x;
+                    break;
+            }
+        }
+    }
+    if (payload != end)
+        throw std::runtime_error("decode_frame: corrupted DELTA frame");
+}
+
+encoded_frame encode_frame(const cv::Mat& frame, uint32_t timestamp, frame_kind kind)
+{
+    if (frame.type() != frame_type(kind))
+        throw std::invalid_argument("encode_frame: unexpected frame type");
+
+    encoded_frame encoded = {};
+    encoded.header.timestamp = timestamp;
+    encoded.header.kind = kind;
+    encoded.header.width = (uint16_t)frame.cols;
+    encoded.header.height = (uint16_t)frame.rows;
+
+    if (kind == frame_kind::DEPTH)
+    {
+        // Encoded in a buffer of the worst case (2 bytes per pixel), then copied at its size
+        thread_local std::vector<uint8_t> buffer;
+        thread_local std::vector<int> residuals;
+        thread_local std::vector<uint16_t> zeros;
+        buffer.resize(frame.total() * 2);
+        residuals.resize(frame.cols);
+        zeros.assign(frame.cols, 0);
+        uint8_t* output = buffer.data();
+        for (int y = 0; y < frame.rows; ++y)
+        {
+            const uint16_t* above = (y > 0) ? frame.ptr<uint16_t>(y - 1) : zeros.data();
+            output = encode_row(frame.ptr<uint16_t>(y), above, frame.cols, residuals.data(), output);
+        }
+        encoded.header.encoding = frame_encoding::DELTA;
+        encoded.payload.assign(buffer.data(), output);
+    }
+    else
+    {
+        encoded.header.encoding = frame_encoding::RAW;
+        size_t row_size = frame.cols * frame.elemSize();
+        encoded.payload.resize(row_size * frame.rows);
+        for (int y = 0; y < frame.rows; ++y)
+            std::memcpy(encoded.payload.data() + y * row_size, frame.ptr(y), row_size);
+    }
+    encoded.header.size = (uint32_t)encoded.payload.size();
+    return encoded;
+}
+
+void decode_frame(const frame_header& header, const uint8_t* payload, cv::Mat& frame)
+{
+    frame.create(header.height, header.width, frame_type(header.kind));
+    if (header.encoding == frame_encoding::DELTA && header.kind == frame_kind::DEPTH)
+        return decode_delta(header, payload, frame);
+    if (header.encoding != frame_encoding::RAW)
+        throw std::runtime_error("decode_frame: unsupported frame encoding");
+    if (header.size != frame.total() * frame.elemSize())
+        throw std::runtime_error("decode_frame: corrupted frame");
+    std::memcpy(frame.data, payload, header.size);
+}
+
+
+RecordingWriter::RecordingWriter(const std::string& filename)
+{
+    open(filename);
+}
+
+void RecordingWriter::open(const std::string& filename)
+{
+    m_file.open(filename, std::ios::binary | std::ios::trunc);
+    if (!m_file)
+        throw std::runtime_error("Failed to open recording " + filename);
+
+    m_file.write(RECORDING_MAGIC, sizeof(RECORDING_MAGIC));
+    m_file.write(reinterpret_cast<const char*>(&RECORDING_VERSION), sizeof(RECORDING_VERSION));
+    m_frames = 0;
+}
+
+void RecordingWriter::close()
+{
+    m_file.close();
+}
+
+void RecordingWriter::write(const cv::Mat& frame, uint32_t timestamp, frame_kind kind)
+{
+    if (frame.type() != frame_type(kind))
+        throw std::invalid_argument("RecordingWriter: unexpected frame type");
+
+    frame_header header = {};
+    header.timestamp = timestamp;
+    header.kind = kind;
+    header.encoding = frame_encoding::RAW;
+    header.width = (uint16_t)frame.cols;
+    header.height = (uint16_t)frame.rows;
+    header.size = (uint32_t)(frame.total() * frame.elemSize());
+
+    m_file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    size_t row_size = frame.cols * frame.elemSize();
+    for (int y = 0; y < frame.rows; ++y)
+        m_file.write(reinterpret_cast<const char*>(frame.ptr(y)), row_size);
+
+    if (!m_file)
+        throw std::runtime_error("Failed to write recording");
+    ++m_frames;
+}
+
+void RecordingWriter::write(const encoded_frame& frame)
+{
+    if (frame.header.size != frame.payload.size())
+        throw std::invalid_argument("RecordingWriter: inconsistent encoded frame");
+
+    m_file.write(reinterpret_cast<const char*>(&frame.header), sizeof(frame.header));
+    m_file.write(reinterpret_cast<const char*>(frame.payload.data()), frame.payload.size());
+    if (!m_file)
+        throw std::runtime_error("Failed to write recording");
+    ++m_frames;
+}
+
+
+RecordingReader::RecordingReader(const std::string& filename) : m_file(filename, std::ios::binary), m_filename(filename)
+{
+    char magic[4];
+    uint32_t version = 0;
+    m_file.read(magic, sizeof(magic));
+    m_file.read(reinterpret_cast<char*>(&version), sizeof(version));
+
+    if (!m_file || std::memcmp(magic, RECORDING_MAGIC, sizeof(magic)) != 0)
+        throw std::runtime_error(filename + " is not a recording");
+    if (version > RECORDING_VERSION)
+        throw std::runtime_error(filename + ": unsupported recording version");
+}
+
+bool RecordingReader::next(cv::Mat& frame, uint32_t& timestamp, frame_kind& kind)
+{
+    frame_header header;
+    if (!m_file.read(reinterpret_cast<char*>(&header), sizeof(header)))
+        return false;
+
+    if (header.encoding == frame_encoding::RAW)
+    {
+        // Read in place
+        frame.create(header.height, header.width, frame_type(header.kind));
+        if (header.size != frame.total() * frame.elemSize())
+            throw std::runtime_error(m_filename + ": corrupted frame");
+        if (!m_file.read(reinterpret_cast<char*>(frame.data), header.size))
+            throw std::runtime_error(m_filename + ": truncated frame");
+    }
+    else
+    {
+        m_payload.resize(header.size);
+        if (!m_file.read(reinterpret_cast<char*>(m_payload.data()), header.size))
+            throw std::runtime_error(m_filename + ": truncated frame");
+        try
+        {
+            decode_frame(header, m_payload.data(), frame);
+        }
+        catch (const std::runtime_error& e)
+        {
+            throw std::runtime_error(m_filename + ": " + e.what());
+        }
+    }
+
+    timestamp = header.timestamp;
+    kind = header.kind;
+    return true;
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <opencv2/core.hpp>
+
+
+/// Kind of frame stored in a recording
+enum class frame_kind : uint8_t
+{
+    DEPTH = 0, // CV_16UC1, raw 11-bit depth
+    RGB = 1,   // CV_8UC3
+};
+
+/// Encoding of the frame payload
+enum class frame_encoding : uint8_t
+{
+    RAW = 0,
+    DELTA = 1, // DEPTH only, lossless (see encode_frame())
+};
+
+/// \brief Header of a frame in a recording (little-endian)
+///
+/// A recording is the 8-byte file header ("KREC" + uint32 version) followed by frames,
+/// each one being this header followed by `size` bytes of payload.
+struct frame_header
+{
+    uint32_t timestamp;     // libfreenect timestamp
+    frame_kind kind;
+    frame_encoding encoding;
+    uint16_t width;
+    uint16_t height;
+    uint16_t reserved;
+    uint32_t size;          // payload size in bytes
+};
+static_assert(sizeof(frame_header) == 16, "frame_header must be packed");
+
+
+/// \brief Frame encoded in memory, written as is by RecordingWriter
+struct encoded_frame
+{
+    frame_header header;
+    std::vector<uint8_t> payload;
+};
+
+/// \brief Encode a depth frame as DELTA, an RGB frame as RAW
+///
+/// DELTA is lossless: each pixel is predicted from its left, top and top-left neighbors (median
+/// edge detector of LOCO-I) and the residuals are packed in bytes, within each row: a run of 1
+/// to 64 zero residuals, two residuals in [-4, 3], one residual in [-32, 31], or the 14-bit
+/// value (holes, edges). The sensor noise on sand mostly takes the two-residual bytes.
+encoded_frame encode_frame(const cv::Mat& frame, uint32_t timestamp, frame_kind kind = frame_kind::DEPTH);
+
+/// \brief Decode the payload of a frame into \p frame (reused when its size and type match)
+/// \throw std::runtime_error for an unknown encoding or a corrupted payload
+void decode_frame(const frame_header& header, const uint8_t* payload, cv::Mat& frame);
+
+
+/// \brief Write the depth (and RGB) frames to a recording file
+class RecordingWriter
+{
+    public:
+        RecordingWriter() = default;
+        explicit RecordingWriter(const std::string& filename);
+
+        void open(const std::string& filename);
+        bool is_open() const { return m_file.is_open(); }
+        void close();
+
+        void write(const cv::Mat& frame, uint32_t timestamp, frame_kind kind = frame_kind::DEPTH);
+        /// \brief Write a frame encoded by encode_frame()
+        void write(const encoded_frame& frame);
+
+        uint64_t frame_count() const { return m_frames; }
+
+    private:
+        std::ofstream m_file;
+        uint64_t m_frames = 0;
+};
+
+
+/// \brief Read a recording file frame by frame
+class RecordingReader
+{
+    public:
+        explicit RecordingReader(const std::string& filename);
+
+        /// \brief Read the next frame
+        /// \return false at the end of the recording
+        bool next(cv::Mat& frame, uint32_t& timestamp, frame_kind& kind);
+
+    private:
+        std::ifstream m_file;
+        std::string m_filename;
+        std::vector<uint8_t> m_payload;  // Encoded frame, reused
+};
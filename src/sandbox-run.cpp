@@ -0,0 +1,347 @@
+// Headless runner of the depth pipeline (H1 -> colorize -> H2) on recordings
+//
+//   sandbox-run [-c calibration.yml] [-o output_dir] [-j jobs] [-n loops] [-q level] [-p capacity] [-w rain] [-t trace.json] recording...
+//
+// Recordings are files written by the "Record" option of calibration or by its black box (or
+// 16-bit PNG depth images). Each recording is loaded in memory, then processed as fast as
+// possible, without any Qt widget. Recordings are processed in parallel on `jobs` threads.
+//
+// With -p, the stages of a recording run on their own threads (PipelinedExecutor), connected
+// by rings of `capacity` frames: compare the fps and the latency with the sequential run.
+//
+// With several projectors in the calibration, each frame is rendered once then warped into
+// all of them concurrently, and the output frames hold the projectors side by side.
+//
+// With -w (or water_rain in the calibration), the water simulation runs on the recorded
+// terrain: the run reports the steps per second of time spent in the simulation (and the time of
+// a step), water.step times each step.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include "calibration-cache.hpp"
+#include "calibration-utils.hpp"
+#include "palette.hpp"
+#include "pipelined-executor.hpp"
+#include "thread-policy.hpp"
+#include "profiling.hpp"
+#include "recording.hpp"
+#include "utils.hpp"
+
+
+struct runner_options
+{
+    std::string calibration = "calibration.yml";
+    std::string output_dir;
+    std::string trace;
+    int jobs = 1;
+    int loops = 1;
+    int quality = QUALITY_FULL;
+    int pipelined = 0;  // Ring capacity of the pipelined executor, 0 to run the stages in sequence
+    float water_rain = -1;  // Overrides the rain of the calibration when >= 0
+    std::vector<std::string> recordings;
+};
+
+static void usage(const char* argv0)
+{
+    std::cerr << "Usage: " << argv0 << " [-c calibration.yml] [-o output_dir] [-j jobs] [-n loops] [-q level] [-p capacity] [-w rain] [-t trace.json] recording...\n"
+              << "  -c  Calibration written by \"Save Presets\" (default: calibration.yml)\n"
+              << "  -o  Write the projector frames as PNG in this directory\n"
+              << "  -j  Number of recordings processed in parallel (default: 1)\n"
+              << "  -n  Number of times each recording is replayed (default: 1)\n"
+              << "  -q  Quality level of the governor ladder (default: 0, full quality)\n"
+              << "  -p  Run the stages on pipelined threads, with rings of `capacity` frames\n"
+              << "  -w  Simulate the water with this rain (raw depth per second, 0 to disable)\n"
+              << "  -t  Write the timeline of the frames in Chrome trace format\n";
+}
+
+static bool parse_options(int argc, char** argv, runner_options& options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        auto arg = std::string(argv[i]);
+        bool has_value = i + 1 < argc;
+        if (arg == "-c" && has_value)
+            options.calibration = argv[++i];
+        else if (arg == "-o" && has_value)
+            options.output_dir = argv[++i];
+        else if (arg == "-j" && has_value)
+            options.jobs = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "-n" && has_value)
+            options.loops = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "-q" && has_value)
+            options.quality = std::clamp(std::atoi(argv[++i]), 0, QUALITY_LEVELS - 1);
+        else if (arg == "-p" && has_value)
+            options.pipelined = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "-w" && has_value)
+            options.water_rain = std::max(0.f, (float)std::atof(argv[++i]));
+        else if (arg == "-t" && has_value)
+            options.trace = argv[++i];
+        else if (arg.size() > 1 && arg[0] == '-')
+            return false;
+        else
+            options.recordings.push_back(arg);
+    }
+    return !options.recordings.empty();
+}
+
+static std::vector<cv::Mat> load_depth_frames(const std::string& filename)
+{
+    std::vector<cv::Mat> frames;
+
+    if (std::filesystem::path(filename).extension() == ".png")
+    {
+        cv::Mat depth = cv::imread(filename, cv::IMREAD_ANYDEPTH);
+        if (depth.type() != CV_16UC1)
+            throw std::runtime_error(filename + " is not a 16-bit depth image");
+        frames.push_back(depth);
+        return frames;
+    }
+
+    RecordingReader reader(filename);
+    cv::Mat frame;
+    uint32_t timestamp;
+    frame_kind kind;
+    while (reader.next(frame, timestamp, kind))
+        if (kind == frame_kind::DEPTH)
+            frames.push_back(frame.clone());
+    return frames;
+}
+
+
+struct run_result
+{
+    std::string recording;
+    uint64_t frames = 0;
+    uint64_t water_steps = 0;
+    double water_seconds = 0;   // Spent in the steps, apart from the rest of the pipeline
+    double seconds = 0;
+    LatencyHistogram::summary latency;
+};
+
+static void write_output(const runner_options& options, const std::string& stem, uint64_t index, const cv::Mat& out)
+{
+    if (options.output_dir.empty())
+        return;
+
+    std::ostringstream name;
+    name << options.output_dir << '/' << stem << '_' << std::setfill('0') << std::setw(6) << index << ".png";
+    cv::Mat bgr;
+    cv::cvtColor(out, bgr, cv::COLOR_RGB2BGR);
+    cv::imwrite(name.str(), bgr);
+}
+
+static void run_sequential(const std::vector<cv::Mat>& frames, const calibration_data& calibration, const calibration_tables& tables,
+                           const runner_options& options, const std::string& stem, LatencyHistogram& latency, run_result& result)
+{
+    FanoutExecutor fanout("projectors");
+    TerrainRenderer renderer;
+    renderer.set_quality(get_render_quality(options.quality));
+    renderer.set_style(calibration.style);
+
+    for (int loop = 0; loop < options.loops; ++loop)
+    {
+        for (const auto& depth : frames)
+        {
+            trace_new_frame();
+            uint64_t frame_start = profiling_now();
+
+            cv::Mat W, depth_rgb, out;
+            {
+                PROFILE_SCOPE("run.h1");
+                trace_frame_flow(trace_phase::FLOW_START);
+                W = (calibration.H1.empty()) ? depth : unwrap(depth, calibration.H1);
+            }
+            {
+                PROFILE_SCOPE("run.colorize");
+                depth_rgb = renderer.render(W, calibration.min_depth, calibration.max_depth);
+            }
+            {
+                PROFILE_SCOPE("run.h2");
+                unwrap_projectors(depth_rgb, tables, fanout, out);
+                trace_frame_flow(trace_phase::FLOW_END);
+            }
+
+            uint64_t frame_end = profiling_now();
+            latency.record(frame_end - frame_start);
+            trace_slice("frame", frame_start, frame_end);
+
+            write_output(options, stem, result.frames++, out);
+        }
+    }
+    result.water_steps = renderer.water().steps();
+    result.water_seconds = renderer.water().step_ns() / 1e9;
+}
+
+static void run_pipelined(const std::vector<cv::Mat>& frames, const calibration_data& calibration, const calibration_tables& tables,
+                          const runner_options& options, const std::string& stem, LatencyHistogram& latency, run_result& result)
+{
+    FanoutExecutor fanout("projectors");
+    TerrainRenderer renderer;
+    renderer.set_quality(get_render_quality(options.quality));
+    renderer.set_style(calibration.style);
+
+    PipelinedExecutor executor("pipelined", options.pipelined);
+    executor.add_stage("h1", [&](const cv::Mat& depth, cv::Mat& W) {
+        if (calibration.H1.empty())
+            depth.copyTo(W);
+        else
+            unwrap(depth, calibration.H1, W);
+    });
+    executor.add_stage("colorize", [&](const cv::Mat& W, cv::Mat& depth_rgb) {
+        // Into the ring slot: allocated once
+        renderer.render(W, calibration.min_depth, calibration.max_depth, depth_rgb);
+    });
+    executor.add_stage("h2", [&](const cv::Mat& depth_rgb, cv::Mat& out) {
+        unwrap_projectors(depth_rgb, tables, fanout, out);
+    });
+    executor.set_sink([&](const cv::Mat& out, uint64_t, uint64_t latency_ns) {
+        trace_frame_flow(trace_phase::FLOW_END);
+        latency.record(latency_ns);
+        write_output(options, stem, result.frames++, out);
+    });
+
+    executor.start();
+    for (int loop = 0; loop < options.loops; ++loop)
+    {
+        for (const auto& depth : frames)
+        {
+            trace_new_frame();
+            PROFILE_SCOPE("run.push");
+            trace_frame_flow(trace_phase::FLOW_START);
+            executor.push(depth);
+        }
+    }
+    executor.stop();
+    result.water_steps = renderer.water().steps();
+    result.water_seconds = renderer.water().step_ns() / 1e9;
+}
+
+static run_result run_recording(const std::string& filename, const calibration_data& calibration, const runner_options& options)
+{
+    auto frames = load_depth_frames(filename);
+    auto stem = std::filesystem::path(filename).stem().string();
+    // Projector tables of the recording frame size (H1 stays on the reference warpPerspective path)
+    calibration_tables tables;
+    if (!frames.empty())
+        tables = build_calibration_tables(calibration, frames.front().size());
+
+    LatencyHistogram latency;
+    run_result result;
+    result.recording = filename;
+
+    auto start = std::chrono::steady_clock::now();
+    if (options.pipelined > 0)
+        run_pipelined(frames, calibration, tables, options, stem, latency, result);
+    else
+        run_sequential(frames, calibration, tables, options, stem, latency, result);
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    result.latency = latency.summarize();
+    return result;
+}
+
+static void print_result(const run_result& r)
+{
+    std::cout << r.recording << ": " << r.frames << " frames in " << std::fixed << std::setprecision(2) << r.seconds << "s, "
+              << std::setprecision(1) << (r.frames / r.seconds) << " fps, latency (ms) p50=" << std::setprecision(2)
+              << r.latency.p50 / 1e6 << " p95=" << r.latency.p95 / 1e6 << " p99=" << r.latency.p99 / 1e6
+              << " max=" << r.latency.max / 1e6;
+    if (r.water_steps > 0 && r.water_seconds > 0)
+        std::cout << ", water " << std::setprecision(1) << (r.water_steps / r.water_seconds) << " steps/s ("
+                  << std::setprecision(2) << (r.water_seconds * 1e3 / r.water_steps) << " ms per step)";
+    std::cout << std::endl;
+}
+
+
+int main(int argc, char** argv)
+{
+    runner_options options;
+    if (!parse_options(argc, argv, options))
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    calibration_data calibration;
+    try
+    {
+        calibration = load_calibration(options.calibration);
+        if (options.water_rain >= 0)
+            calibration.style.water_rain = options.water_rain;
+        if (!calibration.style.palette.empty())
+            set_active_palette(std::make_shared<const palette>(load_palette(calibration.style.palette)));
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    if (!options.output_dir.empty())
+        std::filesystem::create_directories(options.output_dir);
+    if (!options.trace.empty())
+        set_tracing_enabled(true);
+
+    // Each worker takes the next recording
+    std::atomic<size_t> next_recording = {0};
+    std::mutex output_mutex;
+    std::atomic<uint64_t> total_frames = {0};
+    std::atomic<bool> failed = {false};
+
+    auto worker = [&](int index) {
+        trace_thread_name(trace_intern("worker " + std::to_string(index)));
+        apply_thread_policy(thread_role::WORKER, "worker " + std::to_string(index));
+        for (size_t i = next_recording++; i < options.recordings.size(); i = next_recording++)
+        {
+            try
+            {
+                auto result = run_recording(options.recordings[i], calibration, options);
+                total_frames += result.frames;
+                std::lock_guard lock(output_mutex);
+                print_result(result);
+            }
+            catch (const std::exception& e)
+            {
+                std::lock_guard lock(output_mutex);
+                std::cerr << options.recordings[i] << ": " << e.what() << std::endl;
+                failed = true;
+            }
+        }
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    int jobs = std::min<int>(options.jobs, options.recordings.size());
+    for (int i = 0; i < jobs; ++i)
+        workers.emplace_back(worker, i);
+    for (auto& t : workers)
+        t.join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << "Quality: " << quality_level_name(options.quality) << "\n"
+              << "Total: " << total_frames << " frames in " << std::fixed << std::setprecision(2) << seconds << "s, "
+              << std::setprecision(1) << (total_frames / seconds) << " fps on " << jobs << " thread(s)\n\n"
+              << profiling_report();
+
+    if (!options.trace.empty() && !write_trace(options.trace))
+    {
+        std::cerr << "Failed to write the trace " << options.trace << std::endl;
+        return 1;
+    }
+
+    return failed ? 1 : 0;
+}
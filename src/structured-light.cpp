@@ -0,0 +1,197 @@
+#include "structured-light.hpp"
+
+#include <opencv2/imgproc.hpp>
+#include <stdexcept>
+
+// Taille (en pixels projecteur) d'une cellule de la grille d'accumulation
+constexpr static int MAP_CELL_SIZE = 4;
+// Nombre maximal d'itérations pour boucher les trous de la grille
+constexpr static int MAP_FILL_ITERATIONS = 64;
+
+
+int graycode_bits(int size)
+{
+    int n = 0;
+    while ((1 << n) < size)
+        ++n;
+    return n;
+}
+
+std::vector<cv::Mat> generate_graycode_patterns(int width, int height)
+{
+    std::vector<cv::Mat> patterns;
+
+    patterns.push_back(cv::Mat(height, width, CV_8UC1, cv::Scalar(255)));
+    patterns.push_back(cv::Mat(height, width, CV_8UC1, cv::Scalar(0)));
+
+    // Colonnes : une ligne répétée sur toute la hauteur
+    for (int b = graycode_bits(width) - 1; b >= 0; --b)
+    {
+        cv::Mat row(1, width, CV_8UC1);
+        for (int x = 0; x < width; ++x)
+            row.at<uint8_t>(0, x) = (((x ^ (x >> 1)) >> b) & 1) ? 255 : 0;
+
+        cv::Mat pattern = cv::repeat(row, height, 1);
+        patterns.push_back(pattern);
+        patterns.push_back(255 - pattern);
+    }
+
+    // Lignes : une colonne répétée sur toute la largeur
+    for (int b = graycode_bits(height) - 1; b >= 0; --b)
+    {
+        cv::Mat col(height, 1, CV_8UC1);
+        for (int y = 0; y < height; ++y)
+            col.at<uint8_t>(y, 0) = (((y ^ (y >> 1)) >> b) & 1) ? 255 : 0;
+
+        cv::Mat pattern = cv::repeat(col, 1, width);
+        patterns.push_back(pattern);
+        patterns.push_back(255 - pattern);
+    }
+
+    return patterns;
+}
+
+
+static cv::Mat to_gray(const cv::Mat& input)
+{
+    if (input.channels() == 1)
+        return input;
+
+    cv::Mat gray;
+    cv::cvtColor(input, gray, cv::COLOR_RGB2GRAY);
+    return gray;
+}
+
+// Décode une séquence de bits de Gray (MSB en premier) en binaire.
+// Le bit binaire i est b(i) = b(i+1) XOR g(i), calculé image par image.
+static cv::Mat decode_axis(const std::vector<cv::Mat>& captures, size_t first, int nbits)
+{
+    cv::Mat code = cv::Mat::zeros(captures[0].size(), CV_16UC1);
+    cv::Mat binary = cv::Mat::zeros(captures[0].size(), CV_8UC1);
+    cv::Mat gray;
+
+    for (int i = 0; i < nbits; ++i)
+    {
+        int b = nbits - 1 - i;
+        const cv::Mat& pattern = captures[first + 2 * i];
+        const cv::Mat& inverse = captures[first + 2 * i + 1];
+
+        cv::compare(to_gray(pattern), to_gray(inverse), gray, cv::CMP_GT);
+        cv::bitwise_xor(binary, gray, binary);
+        cv::add(code, cv::Scalar(1 << b), code, binary);
+    }
+    return code;
+}
+
+void decode_graycode(const std::vector<cv::Mat>& captures, int width, int height,
+                     cv::Mat& proj_x, cv::Mat& proj_y, cv::Mat& valid, int min_contrast)
+{
+    int xbits = graycode_bits(width);
+    int ybits = graycode_bits(height);
+
+    if (captures.size() != size_t(2 + 2 * (xbits + ybits)))
+        throw std::runtime_error("Structured light: unexpected number of captures");
+
+    cv::Mat contrast;
+    cv::subtract(to_gray(captures[0]), to_gray(captures[1]), contrast);
+    cv::compare(contrast, cv::Scalar(min_contrast), valid, cv::CMP_GT);
+
+    proj_x = decode_axis(captures, 2, xbits);
+    proj_y = decode_axis(captures, 2 + 2 * xbits, ybits);
+
+    // Les codes hors de l'image projetée sont des erreurs de décodage
+    cv::Mat in_range;
+    cv::compare(proj_x, cv::Scalar(width), in_range, cv::CMP_LT);
+    cv::bitwise_and(valid, in_range, valid);
+    cv::compare(proj_y, cv::Scalar(height), in_range, cv::CMP_LT);
+    cv::bitwise_and(valid, in_range, valid);
+}
+
+
+void build_projector_map(const cv::Mat& proj_x, const cv::Mat& proj_y, const cv::Mat& valid,
+                         int width, int height, const cv::Mat& H1,
+                         cv::Mat& map_x, cv::Mat& map_y)
+{
+    // 1. Coordonnées caméra des pixels décodés (dans l'espace déroulé par H1)
+    std::vector<cv::Point2f> camera;
+    std::vector<cv::Point> projector;
+    camera.reserve(cv::countNonZero(valid));
+    projector.reserve(camera.capacity());
+
+    for (int y = 0; y < valid.rows; ++y)
+    {
+        const uint8_t* v = valid.ptr<uint8_t>(y);
+        const uint16_t* px = proj_x.ptr<uint16_t>(y);
+        const uint16_t* py = proj_y.ptr<uint16_t>(y);
+        for (int x = 0; x < valid.cols; ++x)
+        {
+            if (!v[x])
+                continue;
+            camera.emplace_back(float(x), float(y));
+            projector.emplace_back(px[x], py[x]);
+        }
+    }
+
+    if (camera.empty())
+        throw std::runtime_error("Structured light: no projector pixel decoded");
+
+    if (!H1.empty())
+    {
+        std::vector<cv::Point2f> unwrapped;
+        cv::perspectiveTransform(camera, unwrapped, H1);
+        camera = std::move(unwrapped);
+    }
+
+    // 2. Accumulation sur une grille grossière de l'espace projecteur
+    int gw = (width + MAP_CELL_SIZE - 1) / MAP_CELL_SIZE;
+    int gh = (height + MAP_CELL_SIZE - 1) / MAP_CELL_SIZE;
+    cv::Mat sum_x = cv::Mat::zeros(gh, gw, CV_32FC1);
+    cv::Mat sum_y = cv::Mat::zeros(gh, gw, CV_32FC1);
+    cv::Mat weight = cv::Mat::zeros(gh, gw, CV_32FC1);
+
+    for (size_t i = 0; i < camera.size(); ++i)
+    {
+        int gx = projector[i].x / MAP_CELL_SIZE;
+        int gy = projector[i].y / MAP_CELL_SIZE;
+        sum_x.at<float>(gy, gx) += camera[i].x;
+        sum_y.at<float>(gy, gx) += camera[i].y;
+        weight.at<float>(gy, gx) += 1.f;
+    }
+
+    // 3. Bouchage des cellules vides par convolution normalisée
+    cv::Mat empty;
+    for (int i = 0; i < MAP_FILL_ITERATIONS; ++i)
+    {
+        cv::compare(weight, cv::Scalar(0), empty, cv::CMP_EQ);
+        if (cv::countNonZero(empty) == 0)
+            break;
+
+        cv::Mat bx, by, bw;
+        cv::blur(sum_x, bx, cv::Size(3, 3));
+        cv::blur(sum_y, by, cv::Size(3, 3));
+        cv::blur(weight, bw, cv::Size(3, 3));
+        bx.copyTo(sum_x, empty);
+        by.copyTo(sum_y, empty);
+        bw.copyTo(weight, empty);
+    }
+
+    cv::compare(weight, cv::Scalar(0), empty, cv::CMP_EQ);
+
+    cv::Mat mean_x, mean_y;
+    cv::divide(sum_x, weight, mean_x);
+    cv::divide(sum_y, weight, mean_y);
+    mean_x.setTo(-1, empty);
+    mean_y.setTo(-1, empty);
+
+    // 4. Interpolation à la résolution du projecteur
+    cv::resize(mean_x, map_x, cv::Size(width, height), 0, 0, cv::INTER_LINEAR);
+    cv::resize(mean_y, map_y, cv::Size(width, height), 0, 0, cv::INTER_LINEAR);
+}
+
+
+cv::Mat unwrap_dense(const cv::Mat& wrapped, const cv::Mat& map_x, const cv::Mat& map_y)
+{
+    cv::Mat im_out;
+    cv::remap(wrapped, im_out, map_x, map_y, cv::INTER_LINEAR, cv::BORDER_CONSTANT);
+    return im_out;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <opencv2/core.hpp>
+
+
+/// \brief Number of Gray-code bits needed to encode \p size projector columns (or rows)
+int graycode_bits(int size);
+
+/// \brief Generate the structured-light sequence to project
+///
+/// The sequence is [white, black] followed by, for each column bit then each row bit
+/// (most significant first), the Gray-code pattern and its inverse.
+/// \param width Width of the projected image
+/// \param height Height of the projected image
+/// \return The patterns as CV_8UC1 images
+std::vector<cv::Mat> generate_graycode_patterns(int width, int height);
+
+
+/// \brief Decode the captured structured-light sequence
+///
+/// All the operations are whole-image OpenCV operations (SIMD and multi-threaded).
+/// \param captures The camera images (CV_8UC1 or CV_8UC3) in the order of generate_graycode_patterns()
+/// \param width Width of the projected image
+/// \param height Height of the projected image
+/// \param proj_x [out] Projector column seen by each camera pixel (CV_16UC1)
+/// \param proj_y [out] Projector row seen by each camera pixel (CV_16UC1)
+/// \param valid [out] Mask of the camera pixels lit by the projector (CV_8UC1)
+/// \param min_contrast Minimum white/black difference for a camera pixel to be decoded
+void decode_graycode(const std::vector<cv::Mat>& captures, int width, int height,
+                     cv::Mat& proj_x, cv::Mat& proj_y, cv::Mat& valid, int min_contrast = 20);
+
+
+/// \brief Build the dense projector -> camera correspondence table
+///
+/// Inverts the decoded camera -> projector correspondences into remap tables of the size
+/// of the projected image. The projector pixels that were not seen by the camera are
+/// interpolated from their neighbours.
+/// \param proj_x Decoded projector column (from decode_graycode)
+/// \param proj_y Decoded projector row (from decode_graycode)
+/// \param valid Decoded validity mask (from decode_graycode)
+/// \param width Width of the projected image
+/// \param height Height of the projected image
+/// \param H1 Optional homography applied to the camera coordinates (box unwrapping)
+/// \param map_x [out] For each projector pixel, the x coordinate to sample (CV_32FC1)
+/// \param map_y [out] For each projector pixel, the y coordinate to sample (CV_32FC1)
+void build_projector_map(const cv::Mat& proj_x, const cv::Mat& proj_y, const cv::Mat& valid,
+                         int width, int height, const cv::Mat& H1,
+                         cv::Mat& map_x, cv::Mat& map_y);
+
+
+/// \brief Return a new image warped to the projector with a dense map
+cv::Mat unwrap_dense(const cv::Mat& wrapped, const cv::Mat& map_x, const cv::Mat& map_y);
@@ -0,0 +1,182 @@
+#include "thread-policy.hpp"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+
+static const char* role_variable(thread_role role)
+{
+    switch (role)
+    {
+        case thread_role::CAPTURE:
+            return "KINECT_CAPTURE_THREAD";
+        case thread_role::WORKER:
+            return "KINECT_WORKER_THREADS";
+        case thread_role::DISPLAY:
+            return "KINECT_DISPLAY_THREAD";
+    }
+    return "";
+}
+
+static std::vector<int> parse_cpu_list(const std::string& list)
+{
+    std::vector<int> cpus;
+    std::istringstream items(list);
+    std::string item;
+    while (std::getline(items, item, ','))
+    {
+        auto dash = item.find('-');
+        int first = std::stoi(item.substr(0, dash));
+        int last = (dash == std::string::npos) ? first : std::stoi(item.substr(dash + 1));
+        if (first < 0 || last < first)
+            throw std::invalid_argument("invalid cpu range " + item);
+        for (int cpu = first; cpu <= last; ++cpu)
+            cpus.push_back(cpu);
+    }
+    return cpus;
+}
+
+thread_policy parse_thread_policy(const std::string& text)
+{
+    thread_policy policy;
+    std::istringstream fields(text);
+    std::string field;
+    while (fields >> field)
+    {
+        auto equal = field.find('=');
+        if (equal == std::string::npos)
+            throw std::invalid_argument("thread policy: expected key=value, got " + field);
+
+        std::string key = field.substr(0, equal);
+        std::string value = field.substr(equal + 1);
+        try
+        {
+            if (key == "cpus")
+                policy.cpus = parse_cpu_list(value);
+            else if (key == "fifo")
+                policy.fifo_priority = std::stoi(value);
+            else if (key == "nice")
+                policy.nice = std::stoi(value);
+            else
+                throw std::invalid_argument("unknown key " + key);
+        }
+        catch (const std::logic_error& e)
+        {
+            throw std::invalid_argument("thread policy: " + field + ": " + e.what());
+        }
+    }
+
+    if (policy.fifo_priority < 0 || policy.fifo_priority > 99)
+        throw std::invalid_argument("thread policy: fifo priority must be in 1-99");
+    return policy;
+}
+
+thread_policy get_thread_policy(thread_role role)
+{
+    const char* text = std::getenv(role_variable(role));
+    return (text != nullptr) ? parse_thread_policy(text) : thread_policy();
+}
+
+
+static bool set_nice(int nice, std::ostream& report)
+{
+    // On Linux, the nice value of a thread id only applies to this thread
+    pid_t tid = (pid_t)syscall(SYS_gettid);
+    if (setpriority(PRIO_PROCESS, tid, nice) < 0)
+    {
+        report << "nice " << nice << " denied (" << std::strerror(errno) << ")";
+        return false;
+    }
+    report << "nice " << nice;
+    return true;
+}
+
+std::string apply_thread_policy(const thread_policy& policy)
+{
+    if (policy.empty())
+        return "default";
+
+    std::ostringstream report;
+    const char* separator = "";
+
+    if (!policy.cpus.empty())
+    {
+        long available = sysconf(_SC_NPROCESSORS_CONF);
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        std::string cpus, missing;
+        for (int cpu : policy.cpus)
+        {
+            if (cpu >= available || cpu >= CPU_SETSIZE)
+            {
+                missing += " " + std::to_string(cpu);
+                continue;
+            }
+            CPU_SET(cpu, &set);
+            cpus += (cpus.empty() ? "" : ",") + std::to_string(cpu);
+        }
+        if (!missing.empty())
+            report << "no cpu" << missing << ", ";
+
+        report << separator;
+        int error = cpus.empty() ? EINVAL : pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (error != 0)
+            report << "affinity denied (" << std::strerror(error) << ")";
+        else
+            report << "cpus " << cpus;
+        separator = ", ";
+    }
+
+    bool fifo = false;
+    if (policy.fifo_priority > 0)
+    {
+        sched_param param = {};
+        param.sched_priority = policy.fifo_priority;
+        int error = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        report << separator << "SCHED_FIFO " << policy.fifo_priority;
+        if (error != 0)
+            report << " denied (" << std::strerror(error) << ")";
+        fifo = (error == 0);
+        separator = ", ";
+    }
+
+    // nice is ignored by SCHED_FIFO: only the fallback
+    if (!fifo && policy.nice != 0)
+    {
+        report << separator;
+        set_nice(policy.nice, report);
+    }
+    return report.str();
+}
+
+void apply_thread_policy(thread_role role, const std::string& thread_name)
+{
+    static std::mutex report_mutex;
+
+    std::string report;
+    try
+    {
+        thread_policy policy = get_thread_policy(role);
+        if (policy.empty())
+            return;
+        report = apply_thread_policy(policy);
+    }
+    catch (const std::invalid_argument& e)
+    {
+        report = std::string(role_variable(role)) + ": " + e.what();
+    }
+
+    std::lock_guard lock(report_mutex);
+    std::cout << "Thread policy [" << thread_name << "]: " << report << std::endl;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+
+/// \brief Threads that can be pinned and prioritized
+enum class thread_role
+{
+    CAPTURE,    // libfreenect event loop (AsyncKinectCapture)
+    WORKER,     // processing workers (PipelinedExecutor, sandbox-run)
+    DISPLAY,    // Qt thread (projector output)
+};
+
+/// \brief CPU affinity and scheduling of a thread
+///
+/// Written as space separated fields, e.g. "cpus=2,3 fifo=50" or "cpus=0-1 nice=-5":
+///  - cpus: list of cores (ranges allowed)
+///  - fifo: SCHED_FIFO priority (1-99), needs CAP_SYS_NICE or an rtprio limit
+///  - nice: nice value of the thread, also used when SCHED_FIFO is denied
+struct thread_policy
+{
+    std::vector<int> cpus;
+    int fifo_priority = 0;
+    int nice = 0;
+
+    bool empty() const { return cpus.empty() && fifo_priority == 0 && nice == 0; }
+};
+
+/// \throw std::invalid_argument on a malformed policy
+thread_policy parse_thread_policy(const std::string& text);
+
+/// \brief Policy of a role, from KINECT_CAPTURE_THREAD, KINECT_WORKER_THREADS or KINECT_DISPLAY_THREAD
+thread_policy get_thread_policy(thread_role role);
+
+/// \brief Apply a policy to the calling thread, falling back when a setting is not permitted
+/// \return Description of what was applied, e.g. "cpus 2,3, SCHED_FIFO 50 denied (...), nice -5"
+std::string apply_thread_policy(const thread_policy& policy);
+
+/// \brief Apply the policy of \p role to the calling thread, and print the result if one is configured
+void apply_thread_policy(thread_role role, const std::string& thread_name);
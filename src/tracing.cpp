@@ -0,0 +1,211 @@
+#include "tracing.hpp"
+#include "profiling.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+struct trace_record
+{
+    uint64_t begin_ns;
+    uint64_t end_ns;
+    uint64_t frame_id;
+    const char* name;
+    trace_phase phase;
+};
+
+// Single producer ring: only the owner thread writes, write_trace() reads
+struct trace_buffer
+{
+    trace_record records[TRACE_BUFFER_EVENTS];
+    std::atomic<uint64_t> head = {0};   // Number of records written since the start
+    uint64_t flushed = 0;               // Number of records already written in a trace (reader side)
+    int tid = 0;
+    const char* thread_name = nullptr;
+};
+
+// Buffers are never destroyed: the events of finished threads stay in the trace
+static std::mutex buffers_mutex;
+static std::vector<std::unique_ptr<trace_buffer>> buffers;
+
+static std::mutex names_mutex;
+static std::deque<std::string> names;
+
+static std::atomic<bool> tracing_enabled = {false};
+static std::atomic<uint64_t> next_frame_id = {1};
+
+static thread_local trace_buffer* local_buffer = nullptr;
+static thread_local uint64_t current_frame = 0;
+
+
+static trace_buffer& get_local_buffer()
+{
+    if (local_buffer == nullptr)
+    {
+        auto buffer = std::make_unique<trace_buffer>();
+        std::lock_guard lock(buffers_mutex);
+        buffer->tid = (int)buffers.size() + 1;
+        local_buffer = buffer.get();
+        buffers.push_back(std::move(buffer));
+    }
+    return *local_buffer;
+}
+
+
+void set_tracing_enabled(bool enabled)
+{
+    tracing_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+bool is_tracing_enabled()
+{
+#ifdef KINECT_PROFILING
+    return tracing_enabled.load(std::memory_order_relaxed);
+#else
+    return false;
+#endif
+}
+
+const char* trace_intern(const std::string& name)
+{
+    std::lock_guard lock(names_mutex);
+    for (auto& n : names)
+        if (n == name)
+            return n.c_str();
+
+    names.push_back(name);
+    return names.back().c_str();
+}
+
+void trace_thread_name(const char* name)
+{
+    get_local_buffer().thread_name = name;
+}
+
+void trace_event(const char* name, trace_phase phase, uint64_t begin_ns, uint64_t end_ns)
+{
+    trace_buffer& buffer = get_local_buffer();
+    uint64_t head = buffer.head.load(std::memory_order_relaxed);
+    trace_record& r = buffer.records[head % TRACE_BUFFER_EVENTS];
+    r.begin_ns = begin_ns;
+    r.end_ns = end_ns;
+    r.frame_id = current_frame;
+    r.name = name;
+    r.phase = phase;
+    buffer.head.store(head + 1, std::memory_order_release);
+}
+
+uint64_t trace_new_frame()
+{
+    current_frame = next_frame_id.fetch_add(1, std::memory_order_relaxed);
+    return current_frame;
+}
+
+uint64_t trace_current_frame()
+{
+    return current_frame;
+}
+
+void trace_set_current_frame(uint64_t frame_id)
+{
+    current_frame = frame_id;
+}
+
+void trace_frame_flow(trace_phase phase)
+{
+    if (current_frame != 0 && is_tracing_enabled())
+        trace_event("frame", phase, profiling_now());
+}
+
+
+static void write_record(std::ostream& out, const trace_record& r, int tid)
+{
+    // Timestamps are in µs
+    out << "{\"name\":\"" << r.name << "\",\"ph\":\"" << (char)r.phase << "\",\"pid\":1,\"tid\":" << tid
+        << ",\"ts\":" << r.begin_ns / 1000.;
+
+    switch (r.phase)
+    {
+        case trace_phase::COMPLETE:
+            out << ",\"dur\":" << (r.end_ns - r.begin_ns) / 1000.;
+            break;
+        case trace_phase::INSTANT:
+            out << ",\"s\":\"t\"";
+            break;
+        default:
+            // Flow events are bound to the enclosing slices, the flow id is the frame id
+            out << ",\"cat\":\"frame\",\"id\":" << r.frame_id << ",\"bp\":\"e\"";
+            break;
+    }
+    if (r.frame_id != 0)
+        out << ",\"args\":{\"frame\":" << r.frame_id << "}";
+    out << '}';
+}
+
+bool write_trace(const std::string& filename)
+{
+    std::ofstream out(filename);
+    if (!out)
+        return false;
+
+    out << std::fixed << std::setprecision(3);
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    out << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"opencv_kinect\"}}";
+
+    std::lock_guard lock(buffers_mutex);
+    std::vector<trace_record> records;
+    for (auto& buffer : buffers)
+    {
+        if (buffer->thread_name != nullptr)
+            out << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->tid
+                << ",\"args\":{\"name\":\"" << buffer->thread_name << "\"}}";
+
+        // Copy, then drop the records the owner thread may have overwritten during the copy
+        // (including the one being written)
+        uint64_t head = buffer->head.load(std::memory_order_acquire);
+        uint64_t first = std::max(buffer->flushed, head > TRACE_BUFFER_EVENTS ? head - TRACE_BUFFER_EVENTS : 0);
+        records.clear();
+        for (uint64_t i = first; i < head; ++i)
+            records.push_back(buffer->records[i % TRACE_BUFFER_EVENTS]);
+
+        uint64_t new_head = buffer->head.load(std::memory_order_acquire);
+        uint64_t valid = (new_head >= TRACE_BUFFER_EVENTS) ? new_head - TRACE_BUFFER_EVENTS + 1 : 0;
+        for (uint64_t i = std::max(first, valid); i < head; ++i)
+        {
+            out << ",\n";
+            write_record(out, records[i - first], buffer->tid);
+        }
+        buffer->flushed = head;
+    }
+    out << "\n]}\n";
+    return (bool)out;
+}
+
+
+// KINECT_TRACE=trace.json: trace from the start and write the trace at exit
+static const char* trace_at_exit = nullptr;
+
+static void write_trace_at_exit()
+{
+    if (write_trace(trace_at_exit))
+        std::cerr << "Trace written to " << trace_at_exit << std::endl;
+    else
+        std::cerr << "Failed to write the trace " << trace_at_exit << std::endl;
+}
+
+[[maybe_unused]] static const bool trace_from_environment = []() {
+    trace_at_exit = std::getenv("KINECT_TRACE");
+    if (trace_at_exit == nullptr || trace_at_exit[0] == '\0')
+        return false;
+
+    set_tracing_enabled(true);
+    std::atexit(write_trace_at_exit);
+    return true;
+}();
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+
+/// \brief Timeline of the frame pipeline in the Chrome trace format (chrome://tracing, ui.perfetto.dev)
+///
+/// Every thread records its events in its own ring buffer (the last TRACE_BUFFER_EVENTS
+/// events), without lock. write_trace() collects the events of all the threads.
+/// Tracing is disabled by default; set KINECT_TRACE=trace.json in the environment to enable it
+/// at startup and write the trace at exit.
+///
+/// The profiling timers (PROFILE_SCOPE, pipeline stages, FrameTimer) are recorded as slices.
+/// Events carry the id of the frame being processed by the thread (see trace_new_frame()), and
+/// flow events link the processing of one frame across the capture, the stages and the paint.
+
+constexpr int TRACE_BUFFER_EVENTS = 1 << 15;
+
+enum class trace_phase : char
+{
+    COMPLETE = 'X',   // [begin, end] slice
+    INSTANT = 'i',
+    FLOW_START = 's',
+    FLOW_STEP = 't',
+    FLOW_END = 'f',
+};
+
+/// \brief Enable or disable the recording of the events at runtime
+void set_tracing_enabled(bool enabled);
+bool is_tracing_enabled();
+
+/// \brief Return a pointer to a copy of \p name that lives until the end of the program
+const char* trace_intern(const std::string& name);
+
+/// \brief Name the calling thread in the trace
+void trace_thread_name(const char* name);
+
+/// \brief Record an event of the calling thread (\p name must live until the trace is written)
+void trace_event(const char* name, trace_phase phase, uint64_t begin_ns, uint64_t end_ns = 0);
+
+/// \brief Record a slice of the current frame if tracing is enabled
+inline void trace_slice(const char* name, uint64_t begin_ns, uint64_t end_ns)
+{
+    if (is_tracing_enabled())
+        trace_event(name, trace_phase::COMPLETE, begin_ns, end_ns);
+}
+
+/// \brief Allocate a new frame id and make it the current frame of the calling thread
+uint64_t trace_new_frame();
+uint64_t trace_current_frame();
+void trace_set_current_frame(uint64_t frame_id);
+
+/// \brief Link the enclosing slice to the other slices of the current frame (flow start, step or end)
+void trace_frame_flow(trace_phase phase);
+
+/// \brief Write the events recorded since the last call in \p filename (Chrome JSON trace format)
+/// \return false if the file could not be written
+bool write_trace(const std::string& filename);
+
+
+/// \brief Make \p frame_id the current frame of the thread in a scope
+class TraceFrameScope
+{
+    public:
+        explicit TraceFrameScope(uint64_t frame_id) : m_previous(trace_current_frame())
+        {
+            trace_set_current_frame(frame_id);
+        }
+
+        ~TraceFrameScope()
+        {
+            trace_set_current_frame(m_previous);
+        }
+
+    private:
+        uint64_t m_previous;
+};
@@ -1,4 +1,6 @@
 #include "utils.hpp"
+#include "depth-kernels.hpp"
+#include "profiling.hpp"
 
 #include <cmath>
 
@@ -39,77 +41,58 @@ std::vector<rgb8> get_cmap(float gamma) {
 }
 
 
-// Génère la couleur en fonction de la hauteur normalisée
-cv::Vec3b get_colormap_color(float height) {
-    if (height <= -220.0f) return cv::Vec3b(80, 0, 0);           // Noir
-    //else if (height <= -200.0f) return cv::Vec3b(80, 0, 0);     // Rouge foncé
-    else if (height <= -200.0f) return cv::Vec3b(80, 0, 0);   // Marron foncé
-    else if (height <= -150.0f) return cv::Vec3b(102, 50, 0);   // Marron
-    else if (height <= -125.0f) return cv::Vec3b(160, 108, 19); // Ocre foncé
-    else if (height <= -100.5f) return cv::Vec3b(205, 140, 24);   // Ocre clair
-    else if (height <= -90.5f) return cv::Vec3b(250, 206, 135);  // Beige clair
-    else if (height <= -88.5f) return cv::Vec3b(255, 226, 176);  // Sable
-    else if (height <= -80.0f) return cv::Vec3b(71, 97, 0);       // Vert foncé
-    else if (height <= 5.0f) return cv::Vec3b(47, 122, 16);     // Vert herbe foncé
-    else if (height <= 15.0f) return cv::Vec3b(60, 180, 40);    // Vert vif
-    else if (height <= 25.0f) return cv::Vec3b(90, 220, 80);    // Vert clair
-    else if (height <= 30.0f) return cv::Vec3b(240, 240, 60);   // Jaune clair
-    else if (height <= 35.0f) return cv::Vec3b(255, 255, 160);  // Jaune sable
-    else if (height <= 40.0f) return cv::Vec3b(255, 255, 255);  // Blanc
-    else if (height <= 170.0f) return cv::Vec3b(0, 67, 161);     // Bleu profond
-    else if (height <= 200.0f) return cv::Vec3b(30, 30, 130);    // Bleu foncé
-    //else if (height <= 140.0f) return cv::Vec3b(161, 161, 161); // Gris moyen
-    //else if (height <= 200.0f) return cv::Vec3b(206, 206, 206); // Gris clair
-    else return cv::Vec3b(0, 0, 0); //cv::Vec3b(255, 255, 255);                       // Blanc
-}
-
-
-
-
 // Génère l'image colorisée de la profondeur
 cv::Mat generate_colored_depth(const std::vector<uint16_t>& depth_vector, int width, int height, int min_depth, int max_depth) {
-    cv::Mat depth_img(height, width, CV_8UC3);
-    for (unsigned y = 0; y < height; ++y) {
-        for (unsigned x = 0; x < width; ++x) {
-            unsigned i = y * width + x;
-            int nb = std::clamp(static_cast<int>(depth_vector[i]), min_depth, max_depth);
-            float normalized_height = static_cast<float>(nb - min_depth) / (max_depth - min_depth) * (220.0f - -220.0f) + -220.0f;
-            depth_img.at<cv::Vec3b>(y, x) = get_colormap_color(normalized_height);
-        }
-    }
+    cv::Mat depth_img;
+    generate_colored_depth(depth_vector, width, height, min_depth, max_depth, depth_img);
     return depth_img;
 }
 
+void generate_colored_depth(const std::vector<uint16_t>& depth_vector, int width, int height, int min_depth, int max_depth, cv::Mat& depth_img) {
+    PROFILE_SCOPE("colorize");
+    depth_img.create(height, width, CV_8UC3);
+    // Noyau spécialisé pour la résolution de la Kinect (voir depth-kernels.hpp)
+    get_depth_kernels(width, height).colorize(depth_vector.data(), depth_img.ptr<cv::Vec3b>(), width, height, min_depth, max_depth);
+}
 
-// Ajoute des lignes de niveau avec des contours noirs
-void add_contour_lines(cv::Mat& depth_img, const std::vector<uint16_t>& depth_vector, int width, int height, int step) {
+
+// Détecte les lignes de niveau (masque des contours)
+cv::Mat contour_edges(const std::vector<uint16_t>& depth_vector, int width, int height, int step) {
+    PROFILE_SCOPE("contours");
     cv::Mat gray(height, width, CV_8UC1);
 
     // Créer une image en niveaux de gris à partir des valeurs de profondeur
-    for (unsigned y = 0; y < height; ++y) {
-        for (unsigned x = 0; x < width; ++x) {
-            unsigned i = y * width + x;
-            gray.at<uint8_t>(y, x) = static_cast<uint8_t>((depth_vector[i] % step) * 255 / step);
-        }
-    }
+    get_depth_kernels(width, height).contour_levels(depth_vector.data(), gray.ptr<uint8_t>(), width, height, step);
 
     // Détection des contours avec l'algorithme de Canny
     cv::Mat edges;
     cv::Canny(gray, edges, 50, 150);
+    return edges;
+}
+
+void update_contour_edges(cv::Mat& edges, const std::vector<uint16_t>& depth_vector, int width, int height, int step, cv::Rect area, const cv::Mat& mask) {
+    PROFILE_SCOPE("contours");
+    if (area.empty())
+        return;
+    cv::Mat gray(height, width, CV_8UC1);
+    get_depth_kernels(width, height).contour_levels(depth_vector.data(), gray.ptr<uint8_t>(), width, height, step);
 
+    // area déborde d'une tuile autour des pixels de mask : les bords de Canny restent en dehors
+    cv::Mat area_edges;
+    cv::Canny(gray(area), area_edges, 50, 150);
+    area_edges.copyTo(edges(area), mask(area));
+}
+
+// Ajoute des lignes de niveau avec des contours noirs
+void add_contour_lines(cv::Mat& depth_img, const std::vector<uint16_t>& depth_vector, int width, int height, int step) {
     // Appliquer les contours noirs à l'image colorée
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-            if (edges.at<uint8_t>(y, x) > 0) {
-                depth_img.at<cv::Vec3b>(y, x) = cv::Vec3b(0, 0, 0); // Noir
-            }
-        }
-    }
+    depth_img.setTo(cv::Scalar(0, 0, 0), contour_edges(depth_vector, width, height, step));
 }
 
 
 // Ajoute un ombrage pour simuler le relief
-void add_shading(cv::Mat& depth_img, const cv::Mat& depth_map) {
+void add_shading(cv::Mat& depth_img, const cv::Mat& depth_map, float strength) {
+    PROFILE_SCOPE("shading");
     cv::Mat gradient_x, gradient_y;
     cv::Sobel(depth_map, gradient_x, CV_32F, 1, 0, 3);
     cv::Sobel(depth_map, gradient_y, CV_32F, 0, 1, 3);
@@ -119,7 +102,7 @@ void add_shading(cv::Mat& depth_img, const cv::Mat& depth_map) {
     cv::Mat shading;
     gradient_magnitude.convertTo(shading, CV_8UC1);
     cv::applyColorMap(shading, shading, cv::COLORMAP_BONE);
-    cv::addWeighted(depth_img, 0.7, shading, 0.3, 0, depth_img);
+    cv::addWeighted(depth_img, 1.0 - strength, shading, strength, 0, depth_img);
 }
 
 /*
@@ -210,4 +193,99 @@ uint8_t* process_depth(std::vector<uint16_t> depth_vector, int width, int height
     std::memcpy(res, depth_img.data, depth_img.total() * depth_img.elemSize());
     depth_img.release();
     return res;
-}
\ No newline at end of file
+}
+
+// Même rendu que process_depth, sans les copies intermédiaires
+cv::Mat render_terrain(const cv::Mat& depth, int min_depth, int max_depth) {
+    TerrainRenderer renderer;
+    return renderer.render(depth, min_depth, max_depth);
+}
+
+
+void TerrainRenderer::set_quality(const render_quality& quality) {
+    m_quality = quality;
+}
+
+void TerrainRenderer::set_style(const terrain_style& style) {
+    // Les lignes de niveau en cache ne correspondent plus
+    if (style.contour_step != m_style.contour_step)
+        m_edges.release();
+    m_hole_filler.set_mode(style.holes);
+    m_smoother.set_parameters(style.smoothing_radius, style.smoothing_range);
+    m_occlusion.set_parameters(style.occlusion_height, style.occlusion_motion);
+    if (style.occlusion_height <= 0)
+        m_occlusion.reset();
+    if (style.water_rain <= 0)
+        m_water.reset();
+    m_style = style;
+}
+
+cv::Mat TerrainRenderer::render(const cv::Mat& depth, int min_depth, int max_depth) {
+    cv::Mat depth_img;
+    render(depth, min_depth, max_depth, depth_img);
+    return depth_img;
+}
+
+void TerrainRenderer::render(const cv::Mat& depth, int min_depth, int max_depth, cv::Mat& out) {
+    // Traitement en résolution réduite
+    cv::Mat_<uint16_t> depth16;
+    if (m_quality.scale > 1)
+        cv::resize(depth, depth16, depth.size() / m_quality.scale, 0, 0, cv::INTER_NEAREST);
+    else
+        depth16 = depth;
+
+    // Les mains au-dessus du sable gardent le relief d'avant leur arrivée (avant les trous :
+    // leur ombre fait partie des tuiles gelées)
+    bool occlusion = m_style.occlusion_height > 0;
+    if (occlusion)
+        depth16 = m_occlusion.filter(depth16, min_depth);
+
+    // Les trous (ombres, reflets) sont comblés avant les lignes de niveau : plus de faux contours
+    if (m_style.holes != hole_filling::NONE) {
+        m_hole_filler.fill(depth16, m_filled);
+        depth16 = m_filled;
+    }
+
+    // Lissage du bruit du capteur, sans adoucir les arêtes du relief
+    if (m_style.smoothing_radius > 0) {
+        m_smoother.smooth(depth16, m_smoothed);
+        depth16 = m_smoothed;
+    }
+
+    // L'eau coule sur le relief lissé, sur une grille de taille fixe quelle que soit la qualité
+    if (m_style.water_rain > 0) {
+        m_water.set_terrain(depth16, depth.size() / WATER_GRID_SCALE, max_depth);
+        for (int i = 0; i < WATER_STEPS_PER_FRAME; ++i)
+            m_water.step(m_style.water_rain, m_style.water_evaporation);
+    }
+
+    std::vector<uint16_t>& depth_vector = m_depth_vector;
+    depth_vector.assign(depth16.begin(), depth16.end());
+    int width = depth16.cols;
+    int height = depth16.rows;
+
+    // En pleine résolution, le rendu se fait directement dans l'image de sortie
+    cv::Mat& depth_img = (m_quality.scale > 1) ? m_reduced : out;
+    generate_colored_depth(depth_vector, width, height, min_depth, max_depth, depth_img);
+
+    // Les lignes de niveau sont réutilisées entre deux calculs, et sous les mains
+    if (m_edges.size() != depth_img.size() || m_frame % m_quality.contour_period == 0) {
+        if (occlusion && m_occlusion.held_tiles() > 0 && m_edges.size() == depth_img.size())
+            update_contour_edges(m_edges, depth_vector, width, height, m_style.contour_step, m_occlusion.live_bounds(), m_occlusion.live_mask());
+        else
+            m_edges = contour_edges(depth_vector, width, height, m_style.contour_step);
+    }
+    depth_img.setTo(cv::Scalar(0, 0, 0), m_edges);
+    ++m_frame;
+
+    if (m_quality.shading && m_style.shading_strength > 0) {
+        cv::Mat depth_map(height, width, CV_16UC1, depth_vector.data());
+        add_shading(depth_img, depth_map, m_style.shading_strength);
+    }
+
+    if (m_style.water_rain > 0)
+        m_water.composite(depth_img);
+
+    if (m_quality.scale > 1)
+        cv::resize(m_reduced, out, depth.size(), 0, 0, cv::INTER_LINEAR);
+}
@@ -1,9 +1,15 @@
 #pragma once
 
 #include <cstdint>
+#include <string>
 #include <vector>
 #include <opencv2/imgproc.hpp>
 
+#include "depth-filters.hpp"
+#include "occlusion.hpp"
+#include "quality.hpp"
+#include "water-simulation.hpp"
+
 struct rgb8
 {
     uint8_t r;
@@ -13,6 +19,71 @@ struct rgb8
 
 std::vector<rgb8> get_cmap(float gamma = 3.f);
 
+// Colorise la profondeur avec la palette active (voir palette.hpp)
+cv::Mat generate_colored_depth(const std::vector<uint16_t>& depth_vector, int width, int height, int min_depth, int max_depth);
+void generate_colored_depth(const std::vector<uint16_t>& depth_vector, int width, int height, int min_depth, int max_depth, cv::Mat& depth_img);
+cv::Mat contour_edges(const std::vector<uint16_t>& depth_vector, int width, int height, int step);
+// Recalcule les lignes de niveau de edges dans area, aux pixels non nuls de mask seulement
+void update_contour_edges(cv::Mat& edges, const std::vector<uint16_t>& depth_vector, int width, int height, int step, cv::Rect area, const cv::Mat& mask);
+void add_contour_lines(cv::Mat& depth_img, const std::vector<uint16_t>& depth_vector, int width, int height, int step);
+void add_shading(cv::Mat& depth_img, const cv::Mat& depth_map, float strength = 0.3f);
+
+// Rendu complet du relief (couleurs, lignes de niveau, ombrage) d'une carte de profondeur CV_16UC1
+cv::Mat render_terrain(const cv::Mat& depth, int min_depth, int max_depth);
+
+// Paramètres du rendu, enregistrés avec la calibration
+struct terrain_style
+{
+    int contour_step = 25;          // Écart de profondeur brute entre deux lignes de niveau
+    float shading_strength = 0.3f;  // Poids de l'ombrage (0 : aucun)
+    hole_filling holes = hole_filling::PUSH_PULL;  // Remplissage des pixels sans mesure
+    float smoothing_radius = 4.f;   // Rayon du lissage de la profondeur en pixels (0 : aucun)
+    float smoothing_range = 10.f;   // Écart de profondeur brute conservé comme une arête
+    float water_rain = 0.f;         // Pluie en profondeur brute par seconde (0 : pas d'eau)
+    float water_evaporation = 0.05f;  // Fraction de l'eau évaporée par seconde
+    int occlusion_height = 40;      // Hauteur brute au-dessus du sable d'une main (0 : pas de détection)
+    int occlusion_motion = 6;       // Mouvement brut d'une image à l'autre d'une main
+    std::string palette;            // Fichier de palette d'élévation (vide : palette par défaut)
+};
+
+// Rendu du relief image par image, avec une qualité réglable (voir QualityGovernor)
+class TerrainRenderer
+{
+    public:
+        static constexpr int CONTOUR_STEP = 25;
+        // L'eau est simulée sur une grille deux fois plus petite que l'image de profondeur,
+        // avec deux pas par image (60 pas par seconde à 30 images par seconde)
+        static constexpr int WATER_GRID_SCALE = 2;
+        static constexpr int WATER_STEPS_PER_FRAME = 2;
+
+        void set_quality(const render_quality& quality);
+        const render_quality& quality() const { return m_quality; }
+
+        void set_style(const terrain_style& style);
+        const terrain_style& style() const { return m_style; }
+
+        cv::Mat render(const cv::Mat& depth, int min_depth, int max_depth);
+        // Rendu dans une image réutilisée (réallouée seulement si sa taille change)
+        void render(const cv::Mat& depth, int min_depth, int max_depth, cv::Mat& depth_img);
+
+        const WaterSimulation& water() const { return m_water; }
+        const OcclusionFilter& occlusion() const { return m_occlusion; }
+
+    private:
+        render_quality m_quality;
+        terrain_style m_style;
+        cv::Mat m_edges;        // Lignes de niveau du dernier calcul
+        DepthHoleFiller m_hole_filler;
+        cv::Mat m_filled;       // Profondeur sans trous, réutilisée
+        DepthSmoother m_smoother;
+        cv::Mat m_smoothed;     // Profondeur lissée, réutilisée
+        std::vector<uint16_t> m_depth_vector;  // Profondeur traitée, réutilisée
+        cv::Mat m_reduced;      // Rendu en résolution réduite, réutilisé
+        WaterSimulation m_water;
+        OcclusionFilter m_occlusion;
+        uint64_t m_frame = 0;
+};
+
 uint8_t* process_depth(std::vector<uint16_t> depth_vector, int width, int height, int max_depth, int min_depth);
 cv::Mat uint8ArrayToMat(uint8_t* data, int rows, int cols, int type);
 std::vector<uint16_t> matToVector(cv::Mat_<uint16_t>& mat);
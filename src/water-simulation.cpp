@@ -0,0 +1,274 @@
+#include "water-simulation.hpp"
+#include "profiling.hpp"
+
+#include <algorithm>
+
+#include <opencv2/imgproc.hpp>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define KINECT_AVX2_KERNELS
+#endif
+
+
+// Acceleration of the flow, in raw depth units (about a grid cell) per s^2: slower than real
+// water at the scale of the sandbox, so that it can be followed and the steps stay stable
+constexpr static float GRAVITY = 30.f;
+// Outflows kept from one step to the next (the rest is lost to friction, against oscillations)
+constexpr static float DAMPING = 0.995f;
+// Terrain of the border cells: no water flows towards them
+constexpr static float WALL_HEIGHT = 1e6f;
+// Rows processed by each task of the parallel passes
+constexpr static int TILE_ROWS = 16;
+
+// Rendering: thinner water is not drawn, deeper water has the maximal opacity
+constexpr static float DRY_DEPTH = 0.05f;
+constexpr static float OPAQUE_DEPTH = 8.f;
+constexpr static float WATER_OPACITY = 0.75f;
+static const cv::Vec3f WATER_COLOR(40, 110, 230);
+
+enum direction { LEFT = 0, RIGHT = 1, TOP = 2, BOTTOM = 3 };
+
+
+// Rows y - 1, y and y + 1 of the planes, for the stencils of row y
+struct cell_rows
+{
+    const float* terrain[3];
+    float* water[3];
+    float* outflow[4][3];
+
+    cell_rows(cv::Mat& terrain_plane, cv::Mat& water_plane, cv::Mat* outflow_planes, int y)
+    {
+        for (int i = 0; i < 3; ++i)
+        {
+            terrain[i] = terrain_plane.ptr<float>(y - 1 + i);
+            water[i] = water_plane.ptr<float>(y - 1 + i);
+            for (int d = 0; d < 4; ++d)
+                outflow[d][i] = outflow_planes[d].ptr<float>(y - 1 + i);
+        }
+    }
+};
+
+// Outflows of the cells [begin, end) of a row, accelerated by the surface differences then
+// scaled down when they would take more than the water of the cell
+static void outflow_row(const cell_rows& r, int begin, int end)
+{
+    const float k = GRAVITY * WaterSimulation::TIME_STEP;
+    float* left = r.outflow[LEFT][1];
+    float* right = r.outflow[RIGHT][1];
+    float* top = r.outflow[TOP][1];
+    float* bottom = r.outflow[BOTTOM][1];
+    for (int x = begin; x < end; ++x)
+    {
+        float water = r.water[1][x];
+        float surface = r.terrain[1][x] + water;
+        float l = std::max(0.f, DAMPING * left[x] + k * (surface - r.terrain[1][x - 1] - r.water[1][x - 1]));
+        float rt = std::max(0.f, DAMPING * right[x] + k * (surface - r.terrain[1][x + 1] - r.water[1][x + 1]));
+        float t = std::max(0.f, DAMPING * top[x] + k * (surface - r.terrain[0][x] - r.water[0][x]));
+        float b = std::max(0.f, DAMPING * bottom[x] + k * (surface - r.terrain[2][x] - r.water[2][x]));
+        float outflow = (l + rt + t + b) * WaterSimulation::TIME_STEP;
+        float scale = std::min(1.f, water / std::max(outflow, 1e-6f));
+        left[x] = l * scale;
+        right[x] = rt * scale;
+        top[x] = t * scale;
+        bottom[x] = b * scale;
+    }
+}
+
+// Water of the cells [begin, end) of a row: inflows from the neighbors minus the outflows
+static void water_row(const cell_rows& r, int begin, int end, float rain, float keep)
+{
+    const float dt = WaterSimulation::TIME_STEP;
+    float* water = r.water[1];
+    for (int x = begin; x < end; ++x)
+    {
+        float inflow = r.outflow[RIGHT][1][x - 1] + r.outflow[LEFT][1][x + 1] + r.outflow[BOTTOM][0][x] + r.outflow[TOP][2][x];
+        float outflow = r.outflow[LEFT][1][x] + r.outflow[RIGHT][1][x] + r.outflow[TOP][1][x] + r.outflow[BOTTOM][1][x];
+        water[x] = std::max(0.f, (water[x] + dt * (inflow - outflow + rain)) * keep);
+    }
+}
+
+#ifdef KINECT_AVX2_KERNELS
+__attribute__((target("avx2")))
+static inline __m256 surface_avx2(const float* terrain, const float* water)
+{
+    return _mm256_add_ps(_mm256_loadu_ps(terrain), _mm256_loadu_ps(water));
+}
+
+__attribute__((target("avx2")))
+static void outflow_row_avx2(const cell_rows& r, int begin, int end)
+{
+    const __m256 k = _mm256_set1_ps(GRAVITY * WaterSimulation::TIME_STEP);
+    const __m256 damping = _mm256_set1_ps(DAMPING);
+    const __m256 dt = _mm256_set1_ps(WaterSimulation::TIME_STEP);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1.f);
+    const __m256 epsilon = _mm256_set1_ps(1e-6f);
+    float* const outflows[4] = {r.outflow[LEFT][1], r.outflow[RIGHT][1], r.outflow[TOP][1], r.outflow[BOTTOM][1]};
+
+    int x = begin;
+    for (; x + 8 <= end; x += 8)
+    {
+        __m256 water = _mm256_loadu_ps(r.water[1] + x);
+        __m256 surface = _mm256_add_ps(_mm256_loadu_ps(r.terrain[1] + x), water);
+        __m256 neighbors[4] = {
+            surface_avx2(r.terrain[1] + x - 1, r.water[1] + x - 1),
+            surface_avx2(r.terrain[1] + x + 1, r.water[1] + x + 1),
+            surface_avx2(r.terrain[0] + x, r.water[0] + x),
+            surface_avx2(r.terrain[2] + x, r.water[2] + x),
+        };
+        __m256 flows[4];
+        __m256 total = zero;
+        for (int d = 0; d < 4; ++d)
+        {
+            __m256 flow = _mm256_mul_ps(damping, _mm256_loadu_ps(outflows[d] + x));
+            flow = _mm256_add_ps(flow, _mm256_mul_ps(k, _mm256_sub_ps(surface, neighbors[d])));
+            flows[d] = _mm256_max_ps(zero, flow);
+            total = _mm256_add_ps(total, flows[d]);
+        }
+        __m256 scale = _mm256_min_ps(one, _mm256_div_ps(water, _mm256_max_ps(_mm256_mul_ps(total, dt), epsilon)));
+        for (int d = 0; d < 4; ++d)
+            _mm256_storeu_ps(outflows[d] + x, _mm256_mul_ps(flows[d], scale));
+    }
+    outflow_row(r, x, end);
+}
+
+__attribute__((target("avx2")))
+static void water_row_avx2(const cell_rows& r, int begin, int end, float rain, float keep)
+{
+    const __m256 dt = _mm256_set1_ps(WaterSimulation::TIME_STEP);
+    const __m256 rain_8 = _mm256_set1_ps(rain);
+    const __m256 keep_8 = _mm256_set1_ps(keep);
+    const __m256 zero = _mm256_setzero_ps();
+
+    int x = begin;
+    for (; x + 8 <= end; x += 8)
+    {
+        __m256 inflow = _mm256_add_ps(_mm256_add_ps(_mm256_loadu_ps(r.outflow[RIGHT][1] + x - 1), _mm256_loadu_ps(r.outflow[LEFT][1] + x + 1)),
+                                      _mm256_add_ps(_mm256_loadu_ps(r.outflow[BOTTOM][0] + x), _mm256_loadu_ps(r.outflow[TOP][2] + x)));
+        __m256 outflow = _mm256_add_ps(_mm256_add_ps(_mm256_loadu_ps(r.outflow[LEFT][1] + x), _mm256_loadu_ps(r.outflow[RIGHT][1] + x)),
+                                       _mm256_add_ps(_mm256_loadu_ps(r.outflow[TOP][1] + x), _mm256_loadu_ps(r.outflow[BOTTOM][1] + x)));
+        __m256 water = _mm256_loadu_ps(r.water[1] + x);
+        water = _mm256_add_ps(water, _mm256_mul_ps(dt, _mm256_add_ps(_mm256_sub_ps(inflow, outflow), rain_8)));
+        _mm256_storeu_ps(r.water[1] + x, _mm256_max_ps(zero, _mm256_mul_ps(water, keep_8)));
+    }
+    water_row(r, x, end, rain, keep);
+}
+
+static const bool water_avx2 = __builtin_cpu_supports("avx2");
+#endif
+
+
+void WaterSimulation::set_terrain(const cv::Mat& depth, cv::Size grid_size, int max_depth)
+{
+    if (grid_size != m_water_view.size())
+    {
+        cv::Size padded(grid_size.width + 2, grid_size.height + 2);
+        m_terrain.create(padded, CV_32FC1);
+        m_terrain.setTo(WALL_HEIGHT);
+        m_water = cv::Mat::zeros(padded, CV_32FC1);
+        for (cv::Mat& outflow : m_outflow)
+            outflow = cv::Mat::zeros(padded, CV_32FC1);
+        m_water_view = m_water(cv::Rect(1, 1, grid_size.width, grid_size.height));
+    }
+
+    cv::resize(depth, m_resized, grid_size, 0, 0, cv::INTER_AREA);
+    for (int y = 0; y < grid_size.height; ++y)
+    {
+        const uint16_t* d = m_resized.ptr<uint16_t>(y);
+        float* terrain = m_terrain.ptr<float>(y + 1) + 1;
+        for (int x = 0; x < grid_size.width; ++x)
+            terrain[x] = (float)(max_depth - d[x]);
+    }
+}
+
+void WaterSimulation::update_outflows(int y0, int y1)
+{
+    int end = m_water_view.cols + 1;
+    for (int y = y0; y < y1; ++y)
+    {
+        cell_rows rows(m_terrain, m_water, m_outflow, y);
+#ifdef KINECT_AVX2_KERNELS
+        if (water_avx2)
+        {
+            outflow_row_avx2(rows, 1, end);
+            continue;
+        }
+#endif
+        outflow_row(rows, 1, end);
+    }
+}
+
+void WaterSimulation::update_water(int y0, int y1, float rain, float evaporation)
+{
+    int end = m_water_view.cols + 1;
+    float keep = 1.f - evaporation * TIME_STEP;
+    for (int y = y0; y < y1; ++y)
+    {
+        cell_rows rows(m_terrain, m_water, m_outflow, y);
+#ifdef KINECT_AVX2_KERNELS
+        if (water_avx2)
+        {
+            water_row_avx2(rows, 1, end, rain, keep);
+            continue;
+        }
+#endif
+        water_row(rows, 1, end, rain, keep);
+    }
+}
+
+void WaterSimulation::step(float rain, float evaporation)
+{
+    if (m_water_view.empty())
+        return;
+    PROFILE_SCOPE("water.step");
+    uint64_t start = profiling_now();
+
+    // Each pass only writes its rows: the outflows read the water, the water reads the outflows
+    int rows = m_water_view.rows;
+    cv::Range tiles(0, (rows + TILE_ROWS - 1) / TILE_ROWS);
+    cv::parallel_for_(tiles, [&](const cv::Range& range) {
+        update_outflows(1 + range.start * TILE_ROWS, 1 + std::min(range.end * TILE_ROWS, rows));
+    });
+    cv::parallel_for_(tiles, [&](const cv::Range& range) {
+        update_water(1 + range.start * TILE_ROWS, 1 + std::min(range.end * TILE_ROWS, rows), rain, evaporation);
+    });
+    ++m_steps;
+    m_step_ns += profiling_now() - start;
+}
+
+void WaterSimulation::reset()
+{
+    if (m_water.empty())
+        return;
+    m_water.setTo(0);
+    for (cv::Mat& outflow : m_outflow)
+        outflow.setTo(0);
+}
+
+double WaterSimulation::volume() const
+{
+    return m_water_view.empty() ? 0. : cv::sum(m_water_view)[0];
+}
+
+void WaterSimulation::composite(cv::Mat& image)
+{
+    if (m_water_view.empty())
+        return;
+    PROFILE_SCOPE("water.composite");
+
+    cv::resize(m_water_view, m_upscaled, image.size(), 0, 0, cv::INTER_LINEAR);
+    for (int y = 0; y < image.rows; ++y)
+    {
+        const float* depth = m_upscaled.ptr<float>(y);
+        cv::Vec3b* pixel = image.ptr<cv::Vec3b>(y);
+        for (int x = 0; x < image.cols; ++x)
+        {
+            if (depth[x] < DRY_DEPTH)
+                continue;
+            float alpha = WATER_OPACITY * std::min(depth[x] / OPAQUE_DEPTH, 1.f);
+            cv::Vec3f color = cv::Vec3f(pixel[x][0], pixel[x][1], pixel[x][2]) * (1.f - alpha) + WATER_COLOR * alpha;
+            pixel[x] = cv::Vec3b(cv::saturate_cast<uint8_t>(color[0]), cv::saturate_cast<uint8_t>(color[1]), cv::saturate_cast<uint8_t>(color[2]));
+        }
+    }
+}
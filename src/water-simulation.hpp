@@ -0,0 +1,62 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+
+
+/// \brief Shallow water flowing on the sand (virtual pipe model)
+///
+/// Each cell of the grid holds a water depth and the outflows towards its 4 neighbors, as
+/// through virtual pipes. A step accelerates each outflow by the difference of water surface
+/// height (terrain + water), scales the outflows of a cell so that it does not lose more than
+/// its water, then moves the water. The cells are stored as a structure of arrays (one float
+/// plane per quantity) padded with a wall, so the stencils have no border case: both passes
+/// run as SIMD row updates on tiles of rows processed in parallel (cv::parallel_for_).
+///
+/// Heights are in raw depth units, the terrain is max_depth - depth (the sand surface).
+class WaterSimulation
+{
+    public:
+        /// \brief Simulated time of a step, in seconds
+        static constexpr float TIME_STEP = 1.f / 60;
+
+        /// \brief Set the terrain from a CV_16UC1 depth frame, resampled to \p grid_size
+        ///
+        /// The water is kept while the grid size is the same, and emptied when it changes.
+        void set_terrain(const cv::Mat& depth, cv::Size grid_size, int max_depth);
+
+        /// \brief Advance by TIME_STEP
+        /// \param rain Water added to every cell, in raw depth units per second
+        /// \param evaporation Fraction of the water removed per second
+        void step(float rain, float evaporation);
+
+        /// \brief Remove all the water
+        void reset();
+
+        /// \brief Water depth of each cell (CV_32FC1 of the grid size, view of the simulation)
+        const cv::Mat& water() const { return m_water_view; }
+        cv::Size grid_size() const { return m_water_view.size(); }
+        /// \brief Total water, in raw depth units x cells
+        double volume() const;
+        /// \brief Steps run since the construction, and the time they took (in ns)
+        uint64_t steps() const { return m_steps; }
+        uint64_t step_ns() const { return m_step_ns; }
+
+        /// \brief Blend the water over a rendered terrain (CV_8UC3, RGB) of any size
+        ///
+        /// The water depth is resampled to the size of \p image, and gets more opaque with depth.
+        void composite(cv::Mat& image);
+
+    private:
+        void update_outflows(int y0, int y1);
+        void update_water(int y0, int y1, float rain, float evaporation);
+
+        // Planes of (rows + 2) x (cols + 2), the border is a wall without water
+        cv::Mat m_terrain;
+        cv::Mat m_water;
+        cv::Mat m_outflow[4];   // Towards the left, right, top and bottom neighbors
+        cv::Mat m_water_view;   // Interior of m_water
+        cv::Mat m_resized;      // Depth frame at the grid size
+        cv::Mat m_upscaled;     // Water depth at the size of the composited image
+        uint64_t m_steps = 0;
+        uint64_t m_step_ns = 0;
+};